@@ -1,14 +1,26 @@
-set(OpenGL_GL_PREFERENCE GLVND)
-find_package(OpenGL REQUIRED)
+find_package(Threads REQUIRED)
 
-if (CMAKE_SYSTEM_NAME STREQUAL Linux)
-  find_package(X11 REQUIRED)
+if (BOIDZ_BUILD_GUI)
+  set(OpenGL_GL_PREFERENCE GLVND)
+  find_package(OpenGL)
 
-  if (NOT X11_Xi_FOUND)
-    message(FATAL_ERROR "X11 Xi library is required")
+  if (CMAKE_SYSTEM_NAME STREQUAL Linux)
+    find_package(X11)
+  endif ()
+
+  # the simulation core and the headless tools don't need any of the windowing
+  # libraries, so fall back to building only those on render-less machines
+  if (NOT OPENGL_FOUND)
+    message(WARNING "OpenGL not found, building headless targets only")
+    set(BOIDZ_BUILD_GUI OFF)
+  elseif (CMAKE_SYSTEM_NAME STREQUAL Linux AND NOT X11_Xi_FOUND)
+    message(WARNING "X11 Xi library not found, building headless targets only")
+    set(BOIDZ_BUILD_GUI OFF)
   endif ()
 endif ()
 
-include(cmake/glad.cmake)
-include(cmake/glfw.cmake)
-include(cmake/imgui.cmake)
+if (BOIDZ_BUILD_GUI)
+  include(cmake/glad.cmake)
+  include(cmake/glfw.cmake)
+  include(cmake/imgui.cmake)
+endif ()
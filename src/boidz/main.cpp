@@ -42,8 +42,10 @@ using namespace std::chrono;
 
 #include "boid_collection.hpp"
 #include "frame_graph.hpp"
+#include "frame_source.hpp"
 #include "props.hpp"
 #include "quad_tree.hpp"
+#include "replay.hpp"
 #include "v2.hpp"
 
 struct Color {
@@ -77,7 +79,7 @@ Color add_color(float blend_factor, const Color& c1, const Color& c2)
     return result;
 }
 
-float draw(const BoidCollection& boids)
+float draw(const FrameSource& frames)
 {
     auto start_time = high_resolution_clock::now();
 
@@ -86,17 +88,18 @@ float draw(const BoidCollection& boids)
     // TODO: use transform here instead of transforming coordinates ourself?
     glOrtho(0, WinProps::window_width(), WinProps::window_height(), 0, 100, -100);
 
-    const std::vector<V2>& positions = boids.positions();
+    const V2* positions = frames.positions();
+    const float span = frames.domain_span();
+    const V2 mid_point = {span / 2.f, span / 2.f};
 
     glBegin(GL_POINTS);
-    for (const V2& pos : positions) {
-        const V2 wpos = WinProps::boid_to_window_coordinates(pos);
+    for (size_t i = 0; i < frames.population(); i++) {
+        const V2& pos = positions[i];
+        const V2 wpos = WinProps::boid_to_window_coordinates(pos, span);
 
-        static constexpr V2 mid_point = {WinProps::boid_span / 2.f, WinProps::boid_span / 2.f};
         const float dr = (pos - mid_point).magnitude();
 
-        const Color draw_color =
-            add_color(dr / WinProps::boid_span, Color(1.f, 0.f, 3.f), Color(2.f, 1.f, 0.f));
+        const Color draw_color = add_color(dr / span, Color(1.f, 0.f, 3.f), Color(2.f, 1.f, 0.f));
 
         glColor3f(draw_color.r, draw_color.g, draw_color.b);
         glVertex2f(wpos.x, wpos.y);
@@ -157,11 +160,38 @@ struct BoidSim {
 
 static BoidSim g_sim;
 
+// plays back a recorded trajectory instead of simulating, when one is given on the command line
+struct BoidReplay {
+    Replay replay;
+    bool playing = true;
+    float speed = 1.f;      // frames per displayed frame, negative plays backward
+    double position = 0.0;  // fractional, so that slow speeds advance every few displayed frames
+    int scrub_target = -1;  // frame the slider is being dragged to
+
+    float tick()
+    {
+        auto start_time = high_resolution_clock::now();
+
+        if (playing && scrub_target < 0) {
+            const double last = static_cast<double>(replay.frame_count() - 1);
+            position = std::max(0.0, std::min(position + speed, last));
+            if (position == 0.0 || position == last) playing = false;
+        }
+        replay.seek(static_cast<uint64_t>(position));
+
+        auto end_time = high_resolution_clock::now();
+        return duration_cast<duration<float>>(end_time - start_time).count();
+    }
+};
+
+static BoidReplay g_replay;
+static bool g_replaying = false;
+
 float tick()
 {
     glClearColor(0.05f, 0.05f, 0.05f, 1.0f);  // Set background color to black and
     glClear(GL_COLOR_BUFFER_BIT);
-    return g_sim.tick();
+    return g_replaying ? g_replay.tick() : g_sim.tick();
 }
 
 static void glfw_error_callback(int error, const char* description)
@@ -169,8 +199,18 @@ static void glfw_error_callback(int error, const char* description)
     fprintf(stderr, "Glfw Error %d: %s\n", error, description);
 }
 
-int main(int, char**)
+int main(int argc, char** argv)
 {
+    if (argc > 1) {
+        const ReplayStatus status = g_replay.replay.open(argv[1]);
+        if (status != RP_OK || g_replay.replay.frame_count() == 0) {
+            fprintf(stderr, "can't replay '%s': %s\n", argv[1],
+                    status != RP_OK ? REPLAY_STATUS_NAMES[status] : "no complete frame");
+            return 1;
+        }
+        g_replaying = true;
+    }
+
     // Setup window
     glfwSetErrorCallback(glfw_error_callback);
     if (!glfwInit()) return 1;
@@ -275,7 +315,34 @@ int main(int, char**)
                              ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoCollapse |
                              ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoTitleBar);
 
-            {  // display the user-editable toggles/parameter inputs for each rule type
+            if (g_replaying) {  // playback controls: play/pause, speed and the frame to show
+                const Replay& replay = g_replay.replay;
+                ImGui::Text("%zu boids, %llu frames", replay.population(),
+                            static_cast<unsigned long long>(replay.frame_count()));
+                ImGui::Text("Step %llu", static_cast<unsigned long long>(replay.step()));
+                ImGui::Checkbox("Play", &g_replay.playing);
+
+                ImGui::Text("Speed (frames per frame)");
+                ImGui::SliderFloat("##Replay_Speed_Slider", &g_replay.speed, -32.f, 32.f, "%.2f");
+
+                // while dragging, show the first frame of each chunk, which decodes on its own
+                // and keeps scrubbing fast. the exact frame is decoded once the slider is let go
+                int frame = g_replay.scrub_target;
+                if (frame < 0) frame = static_cast<int>(g_replay.position);
+                ImGui::Text("Frame");
+                if (ImGui::SliderInt("##Replay_Frame_Slider", &frame, 0,
+                                     static_cast<int>(replay.frame_count() - 1))) {
+                    g_replay.scrub_target = frame;
+                }
+                if (g_replay.scrub_target >= 0) {
+                    const bool dragging = ImGui::IsItemActive();
+                    const int target = g_replay.scrub_target;
+                    g_replay.position = dragging ? replay.key_frame(target) : target;
+                    if (!dragging) g_replay.scrub_target = -1;
+                }
+                ImGui::Separator();
+            }
+            else {  // display the user-editable toggles/parameter inputs for each rule type
                 static char checkbox_name_buffer[256];
                 static char input_name_buffer[256];
 
@@ -293,6 +360,26 @@ int main(int, char**)
                 }
             }
 
+            // neighbor search: fixed stencil when the opening angle is zero, Barnes-Hut otherwise
+            if (!g_replaying) {
+                static float opening_angle = g_sim.grid.opening_angle();
+                static float effect_radius = std::sqrt(g_sim.grid.effect_radius_squared());
+
+                ImGui::Text("Opening Angle");
+                if (ImGui::SliderFloat("##Opening_Angle_Slider", &opening_angle, 0.f, 1.5f, "%.2f")) {
+                    g_sim.grid.set_opening_angle(opening_angle);
+                }
+                ImGui::Text("Interaction Radius");
+                if (ImGui::SliderFloat("##Interaction_Radius_Slider", &effect_radius, 0.1f, 64.f, "%.2f")) {
+                    g_sim.grid.set_effect_radius(effect_radius);
+                }
+                static bool compact_grid = g_sim.grid.compact_storage();
+                if (ImGui::Checkbox("Compact Grid", &compact_grid)) {
+                    g_sim.grid.set_compact_storage(compact_grid);
+                }
+                ImGui::Separator();
+            }
+
             ImGui::End();
 
             ImGui::SetNextWindowPos(
@@ -308,9 +395,23 @@ int main(int, char**)
                              ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoCollapse |
                              ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoTitleBar);
 
-            sim_time_graph.draw("Sim. Time");
+            sim_time_graph.draw(g_replaying ? "Decode Time" : "Sim. Time");
             draw_time_graph.draw("Draw Time");
 
+            if (!g_replaying) {  // how evenly the force pass kept the threads busy last frame
+                const LoadBalanceStats& balance = g_sim.boids.force_balance();
+                ImGui::Text("Force Imbalance: %.2f", balance.imbalance());
+                ImGui::Text("Force Idle: %.0f%%", 100.0 * balance.idle_fraction());
+
+                static const std::string topology = Topology::detect().describe();
+                ImGui::Text("Topology: %s", topology.c_str());
+
+                static bool dynamic_balancing = g_sim.boids.load_balancing() == LB_DYNAMIC;
+                if (ImGui::Checkbox("Dynamic Load Balancing", &dynamic_balancing)) {
+                    g_sim.boids.set_load_balancing(dynamic_balancing ? LB_DYNAMIC : LB_STATIC);
+                }
+            }
+
             ImGui::End();
         }
 
@@ -326,7 +427,8 @@ int main(int, char**)
         WinProps::update(display_w, display_h);
         const float frame_sim_time = tick();
         sim_time_graph.attach_new_time_delta(frame_sim_time);
-        const float frame_draw_time = draw(g_sim.boids);
+        const float frame_draw_time =
+            g_replaying ? draw(g_replay.replay) : draw(SimulationFrames(g_sim.boids));
         draw_time_graph.attach_new_time_delta(frame_draw_time);
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
@@ -0,0 +1,989 @@
+// micro benchmarks for the individual stages of a simulation step (grid build, neighbor
+// query, force kernel and integration) over fixed-seed workloads. Results are printed as
+// JSON on stdout, one entry per (workload, population, stage).
+//
+// bytes_per_boid is a model of the memory traffic each stage needs (what it has to read
+// and write given the current data layout), not a hardware counter measurement.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+using namespace std::chrono;
+
+#include "boid_collection.hpp"
+#include "distribution.hpp"
+#include "neighbor_list.hpp"
+#include "props.hpp"
+#include "quad_tree.hpp"
+#include "sparse_grid.hpp"
+
+enum Workload { WL_UNIFORM, WL_CLUSTERED, WL_COLLAPSED, WL_COUNT };
+
+static constexpr const char* WORKLOAD_NAMES[WL_COUNT] = {"uniform", "clustered", "collapsed"};
+
+enum Stage {
+    ST_GRID_INSERT,
+    ST_NEIGHBOR_QUERY,
+    ST_NEIGHBOR_VISIT,
+    ST_FORCE_KERNEL,
+    ST_INTEGRATE,
+    ST_FUSED_STEP,
+    ST_REORDER,
+    ST_INTEGRATE_BRANCHING,
+    ST_FUSED_STEP_BRANCHING,
+    ST_NEIGHBOR_LIST_BUILD,
+    ST_NEIGHBOR_LIST_REFRESH,
+    ST_FORCE_KERNEL_NEIGHBOR_LIST,
+    ST_STEP_GRID,
+    ST_STEP_GRID_IN_REACH,
+    ST_STEP_NEIGHBOR_LIST,
+    ST_COUNT
+};
+
+static constexpr const char* STAGE_NAMES[ST_COUNT] = {
+    "grid_insert", "neighbor_query",        "neighbor_visit",        "force_kernel",
+    "integrate",   "fused_force_integrate", "reorder",               "integrate_branching",
+    "fused_force_integrate_branching",      "neighbor_list_build",   "neighbor_list_refresh",
+    "force_kernel_neighbor_list",           "step_grid",             "step_grid_in_reach",
+    "step_neighbor_list"};
+
+// a handful of gaussian blobs with fixed centers, similar to a flock that has clumped up
+class ClusteredDistribution : public Distribution {
+    std::vector<V2> m_centers;
+    float m_spread;
+
+public:
+    ClusteredDistribution(size_t cluster_count, float spread, uint64_t seed)
+        : Distribution(seed), m_centers(cluster_count), m_spread(spread)
+    {
+        // the centers use the top end of the counter range, the samples the bottom
+        const float low = 0.125f * WinProps::boid_span;
+        const float extent = 0.75f * WinProps::boid_span;
+        for (size_t i = 0; i < cluster_count; i++) {
+            const V2 u = CounterRng::unit_square(m_rng.bits(UINT64_MAX - i));
+            m_centers[i] = {low + extent * u.x, low + extent * u.y};
+        }
+    }
+
+    V2 sample(uint64_t index) const final
+    {
+        const V2 c = m_centers[m_rng.bits(2 * index) % m_centers.size()];
+        const V2 offset = CounterRng::normal_pair(m_rng.bits(2 * index + 1));
+        auto keep_inside = [](float x) { return std::min(WinProps::boid_span - 1e-2f, std::max(1e-2f, x)); };
+        return {keep_inside(c.x + m_spread * offset.x), keep_inside(c.y + m_spread * offset.y)};
+    }
+};
+
+struct Config {
+    std::vector<size_t> sizes = {10000, 100000, 1000000};
+    std::vector<Workload> workloads = {WL_UNIFORM, WL_CLUSTERED, WL_COLLAPSED};
+    bool stages[ST_COUNT] = {true, true, true, true, true, true, true, true,
+                             true, true, true, true, true, true, true};
+    size_t thread_count = 1;
+    int nodes_per_axis = 128;
+    float opening_angle = 0.f;
+    float effect_radius = 0.f;  // 0 keeps the grid's default
+    size_t node_cap = QuadTree::s_default_node_cap;
+    float skin = 0.f;  // 0 lasts NeighborList::s_default_reuse_steps at Max_Speed
+    float dt = 1.f / 60.f;
+    double min_time = 0.5;
+    double max_pairs = 2e9;
+    unsigned seed = 1;
+    KernelIsa kernel_isa = best_kernel_isa();
+    bool reorder = false;
+    bool compact = false;
+    bool verify_kernels = false;
+    bool verify_node_cap = false;
+    Rules params;
+};
+
+static void populate(BoidCollection& boids, Workload wl, size_t count, const Config& cfg)
+{
+    UniformDistribution d_vel(-50.f, 50.f, -50.f, 50.f, cfg.seed + 1);
+
+    switch (wl) {
+        case WL_UNIFORM: {
+            UniformDistribution d_pos(1e-2f, WinProps::boid_span - 1e-2f, 1e-2f, WinProps::boid_span - 1e-2f,
+                                      cfg.seed);
+            boids.reset(count, d_pos, d_vel);
+        } break;
+        case WL_CLUSTERED: {
+            ClusteredDistribution d_pos(16, 4.f, cfg.seed);
+            boids.reset(count, d_pos, d_vel);
+        } break;
+        case WL_COLLAPSED: {
+            // every boid inside the single grid node just above the center of the domain
+            const float node_span = WinProps::boid_span / cfg.nodes_per_axis;
+            const float low = 0.5f * WinProps::boid_span + 0.05f * node_span;
+            const float high = 0.5f * WinProps::boid_span + 0.95f * node_span;
+            UniformDistribution d_pos(low, high, low, high, cfg.seed);
+            boids.reset(count, d_pos, d_vel);
+        } break;
+        default:
+            assert(false);
+    }
+
+    // the distributions hand out boids in random spatial order, which is also what an
+    // unsorted population drifts towards while flocking
+    if (cfg.reorder) boids.reorder();
+}
+
+static QuadTree make_grid(const Config& cfg)
+{
+    QuadTree grid(cfg.nodes_per_axis);
+    grid.set_opening_angle(cfg.opening_angle);
+    if (cfg.effect_radius > 0.f) grid.set_effect_radius(cfg.effect_radius);
+    grid.set_node_cap(cfg.node_cap);
+    grid.set_compact_storage(cfg.compact);
+    return grid;
+}
+
+// the grid searched Barnes-Hut style with an opening angle too small to keep any cell within the
+// radius closed: a cell is only visited whole when its span, a node's at least, is less than the
+// opening angle times its distance, which never reaches twice the domain span. so it sees every
+// boid within reach on its own, like the lists do
+static QuadTree make_reach_grid(const Config& cfg)
+{
+    QuadTree grid = make_grid(cfg);
+    grid.set_opening_angle(0.5f / static_cast<float>(cfg.nodes_per_axis));
+    grid.set_compact_storage(false);
+    return grid;
+}
+
+// lists for the same effect radius as the grid, which has no opening angle or compact storage
+static NeighborList make_lists(const Config& cfg)
+{
+    NeighborList lists(WinProps::boid_span / static_cast<float>(cfg.nodes_per_axis), cfg.skin);
+    if (cfg.effect_radius > 0.f) lists.set_effect_radius(cfg.effect_radius);
+    lists.set_node_cap(cfg.node_cap);
+    return lists;
+}
+
+// number of boid pairs visited by the fine grain part of the neighbor search,
+// used to skip workloads that would take far too long to measure
+static double fine_pair_count(const BoidCollection& boids, int nodes_per_axis, size_t node_cap)
+{
+    std::vector<double> node_pop(nodes_per_axis * nodes_per_axis, 0.0);
+    const float node_span = WinProps::boid_span / static_cast<float>(nodes_per_axis);
+
+    for (const V2& pos : boids.positions()) {
+        const int x = static_cast<int>(std::floor(pos.x / node_span));
+        const int y = static_cast<int>(std::floor(pos.y / node_span));
+        node_pop[nodes_per_axis * y + x] += 1.0;
+    }
+
+    double pairs = 0.0;
+    for (double pop : node_pop) {
+        // nodes over the cap are visited as a single aggregate
+        pairs += (node_cap > 0 && pop > node_cap) ? pop : pop * pop;
+    }
+    return pairs;
+}
+
+struct Timing {
+    double seconds_per_rep = 0.0;  // median
+    size_t reps = 0;
+};
+
+// run 'body' repeatedly (after an untimed 'setup') until min_time has elapsed
+template <typename Setup, typename Body>
+static Timing measure(double min_time, Setup&& setup, Body&& body)
+{
+    std::vector<double> samples;
+    double total = 0.0;
+
+    while (samples.size() < 3 || (total < min_time && samples.size() < 100)) {
+        setup();
+        const auto start_time = steady_clock::now();
+        body();
+        const auto end_time = steady_clock::now();
+        const double dt = duration_cast<duration<double>>(end_time - start_time).count();
+        samples.push_back(dt);
+        total += dt;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    return {samples[samples.size() / 2], samples.size()};
+}
+
+static bool s_first_result = true;
+
+// results that are only computed to keep the compiler from optimizing a benchmark away
+static volatile float s_sink;
+
+static void report(Workload wl, size_t count, const char* stage, const Timing& t, double bytes)
+{
+    const double ns_per_boid = 1e9 * t.seconds_per_rep / count;
+    printf("%s    {\"workload\": \"%s\", \"boids\": %zu, \"stage\": \"%s\", \"reps\": %zu, "
+           "\"ms\": %.4f, \"ns_per_boid\": %.3f, \"bytes_per_boid\": %.1f, \"gb_per_sec\": %.3f}",
+           s_first_result ? "" : ",\n", WORKLOAD_NAMES[wl], count, stage, t.reps, 1e3 * t.seconds_per_rep,
+           ns_per_boid, bytes / count, bytes / t.seconds_per_rep * 1e-9);
+    s_first_result = false;
+    fflush(stdout);
+}
+
+static void report_skipped(Workload wl, size_t count, double pairs)
+{
+    printf("%s    {\"workload\": \"%s\", \"boids\": %zu, \"skipped\": \"%.3g fine grain pairs exceeds "
+           "--max-pairs\"}",
+           s_first_result ? "" : ",\n", WORKLOAD_NAMES[wl], count, pairs);
+    s_first_result = false;
+    fflush(stdout);
+}
+
+// how often the lists of the last rep of step_neighbor_list were built, and how long they were
+static void report_lists(Workload wl, size_t count, const NeighborList& lists)
+{
+    const NeighborListStats& stats = lists.stats();
+    printf("%s    {\"workload\": \"%s\", \"boids\": %zu, \"neighbor_list\": {\"skin\": %g, "
+           "\"steps_per_rebuild\": %.2f, \"mean_list_length\": %.2f, \"crowded_cells\": %zu, "
+           "\"list_bytes\": %zu, \"memory_bytes\": %zu}}",
+           s_first_result ? "" : ",\n", WORKLOAD_NAMES[wl], count, lists.skin(), stats.steps_per_rebuild(),
+           stats.mean_list_length(), lists.crowded_cell_count(), lists.list_bytes(), lists.memory_bytes());
+    s_first_result = false;
+    fflush(stdout);
+}
+
+// steps timed together by the step stages
+static constexpr size_t s_step_batch = 16;
+
+static void run_case(Workload wl, size_t count, const Config& cfg)
+{
+    const Rules& params = cfg.params;
+    const float dt = cfg.dt;
+
+    UniformDistribution d_unused(0.f, 1.f, 0.f, 1.f, cfg.seed);
+    BoidCollection boids(0, d_unused, d_unused, cfg.thread_count);
+    QuadTree grid = make_grid(cfg);
+    Scheduler scheduler(cfg.thread_count);
+    boids.set_kernel_isa(cfg.kernel_isa);
+    const double nodes = static_cast<double>(cfg.nodes_per_axis) * cfg.nodes_per_axis;
+
+    populate(boids, wl, count, cfg);
+    const double pairs = fine_pair_count(boids, cfg.nodes_per_axis, cfg.node_cap);
+    if (pairs > cfg.max_pairs) {
+        report_skipped(wl, count, pairs);
+        return;
+    }
+
+    auto nothing = [] {};
+
+    // the later stages need a populated grid and the neighbor count for their byte models
+    grid.insert(boids, scheduler);
+
+    size_t fine_total = 0;    // individual boids visited
+    size_t coarse_total = 0;  // pseudoboids visited
+    for (const V2& pos : boids.positions()) {
+        grid.for_each_neighbor(pos, [&](const auto& node) { fine_total += node.count; },
+                               [&](const PseudoBoid&) { coarse_total++; });
+    }
+    const size_t neighbor_total = fine_total + coarse_total;
+
+    // pos/vel of one boid in the grid's storage, and the bytes read when visiting every
+    // neighborhood in place
+    const double member_bytes = cfg.compact ? 2.0 * (sizeof(uint16_t) + sizeof(int16_t)) : 2.0 * sizeof(V2);
+    const double visit_bytes = member_bytes * fine_total + sizeof(PseudoBoid) * coarse_total;
+
+    // count pass: pos in, node index out. scatter: pos/vel/node index in, sorted pos/vel out.
+    // pseudoboids: sorted pos/vel in. per node: the per thread counts, offsets and pseudoboids
+    auto insert_bytes_of = [&](double stored_bytes) {
+        return (sizeof(V2) + sizeof(int)) * count + (2.0 * sizeof(V2) + sizeof(int) + stored_bytes) * count +
+               stored_bytes * count +
+               ((3.0 * cfg.thread_count + 1.0) * sizeof(size_t) + sizeof(PseudoBoid)) * nodes;
+    };
+    const double insert_bytes = insert_bytes_of(member_bytes);
+
+    if (cfg.stages[ST_GRID_INSERT]) {
+        const Timing t = measure(cfg.min_time, nothing, [&] { grid.insert(boids, scheduler); });
+        report(wl, count, STAGE_NAMES[ST_GRID_INSERT], t, insert_bytes);
+    }
+
+    if (cfg.stages[ST_NEIGHBOR_QUERY]) {
+        std::vector<PseudoBoid> neighbors;
+        const Timing t = measure(cfg.min_time, nothing, [&] {
+            for (const V2& pos : boids.positions()) {
+                grid.get_pseudoboid_neighbors(pos, neighbors);
+            }
+        });
+
+        // every neighbor is read from the grid and written out again as a PseudoBoid
+        const double bytes = sizeof(V2) * count + visit_bytes + sizeof(PseudoBoid) * neighbor_total;
+        report(wl, count, STAGE_NAMES[ST_NEIGHBOR_QUERY], t, bytes);
+    }
+
+    if (cfg.stages[ST_NEIGHBOR_VISIT]) {
+        // the same neighborhoods visited in place, reduced to a position sum so nothing is elided
+        V2 sink = V2::null();
+        const Timing t = measure(cfg.min_time, nothing, [&] {
+            for (const V2& pos : boids.positions()) {
+                grid.for_each_neighbor(pos,
+                                       [&](const auto& node) {
+                                           for (size_t i = 0; i < node.count; i++) {
+                                               sink += {node.x(i), node.y(i)};
+                                           }
+                                       },
+                                       [&](const PseudoBoid& pb) { sink += pb.pos; });
+            }
+        });
+        s_sink = sink.x + sink.y;
+
+        report(wl, count, STAGE_NAMES[ST_NEIGHBOR_VISIT], t, sizeof(V2) * count + visit_bytes);
+    }
+
+    if (cfg.stages[ST_FORCE_KERNEL]) {
+        // the neighborhood visited in place, pos/vel in and the velocity change out
+        const Timing t = measure(cfg.min_time, nothing, [&] { boids.compute_forces(params, grid); });
+        const double bytes = 3.0 * sizeof(V2) * count + visit_bytes;
+        report(wl, count, STAGE_NAMES[ST_FORCE_KERNEL], t, bytes);
+    }
+
+    if (cfg.stages[ST_INTEGRATE]) {
+        // pos/vel and the velocity change in, pos/vel out
+        const Timing t = measure(cfg.min_time,
+                                 [&] {
+                                     populate(boids, wl, count, cfg);
+                                     boids.compute_forces(params, grid);
+                                 },
+                                 [&] { boids.integrate(dt, params); });
+        report(wl, count, STAGE_NAMES[ST_INTEGRATE], t, 5.0 * sizeof(V2) * count);
+    }
+
+    if (cfg.stages[ST_FUSED_STEP]) {
+        // the force kernel without the velocity change round trip, plus pos/vel out
+        const Timing t = measure(cfg.min_time, [&] { populate(boids, wl, count, cfg); },
+                                 [&] { boids.compute_forces_and_integrate(dt, params, grid); });
+        const double bytes = 4.0 * sizeof(V2) * count + visit_bytes;
+        report(wl, count, STAGE_NAMES[ST_FUSED_STEP], t, bytes);
+    }
+
+    // the two stages above again, checking the rule toggles for every boid instead of running
+    // the kernels compiled for the enabled rules
+    boids.set_rule_dispatch(RD_BRANCHING);
+
+    if (cfg.stages[ST_INTEGRATE_BRANCHING]) {
+        const Timing t = measure(cfg.min_time,
+                                 [&] {
+                                     populate(boids, wl, count, cfg);
+                                     boids.compute_forces(params, grid);
+                                 },
+                                 [&] { boids.integrate(dt, params); });
+        report(wl, count, STAGE_NAMES[ST_INTEGRATE_BRANCHING], t, 5.0 * sizeof(V2) * count);
+    }
+
+    if (cfg.stages[ST_FUSED_STEP_BRANCHING]) {
+        const Timing t = measure(cfg.min_time, [&] { populate(boids, wl, count, cfg); },
+                                 [&] { boids.compute_forces_and_integrate(dt, params, grid); });
+        report(wl, count, STAGE_NAMES[ST_FUSED_STEP_BRANCHING], t, 4.0 * sizeof(V2) * count + visit_bytes);
+    }
+
+    boids.set_rule_dispatch(RD_SPECIALIZED);
+
+    if (cfg.stages[ST_REORDER]) {
+        // keys: pos in, key/index out. two radix passes: key/index in and out.
+        // permutation: index, pos/vel and id in, pos/vel, id and index of id out
+        Config unsorted = cfg;
+        unsorted.reorder = false;
+        const Timing t = measure(cfg.min_time, [&] { populate(boids, wl, count, unsorted); },
+                                 [&] { boids.reorder(); });
+        const double bytes =
+            (sizeof(V2) + 8.0) * count + 2.0 * 16.0 * count + (4.0 + 4.0 * sizeof(V2) + 12.0) * count;
+        report(wl, count, STAGE_NAMES[ST_REORDER], t, bytes);
+    }
+
+    auto enabled = [](bool on) { return on; };
+    if (std::none_of(cfg.stages + ST_NEIGHBOR_LIST_BUILD, cfg.stages + ST_COUNT, enabled)) return;
+
+    NeighborList lists = make_lists(cfg);
+    populate(boids, wl, count, cfg);
+    lists.insert(boids, scheduler);
+
+    // the entries within reach, the candidates further out aren't counted. member pos/vel as in
+    // the force pass, one entry and one pseudoboid per crowded cell on a list
+    const double entry_total = static_cast<double>(lists.entry_count());
+    const double list_visit_bytes =
+        (sizeof(uint32_t) + 2.0 * sizeof(V2)) * entry_total + sizeof(size_t) * count;
+
+    // count pass: pos in, bucket out. scatter: bucket in, member index out. lists: pos and the
+    // candidates' index and pos in, entries out, then copied into place. members: pos/vel in and out
+    const double build_bytes = (sizeof(V2) + sizeof(uint32_t)) * count + 2.0 * sizeof(uint32_t) * count +
+                               (sizeof(V2) + 2.0 * sizeof(size_t)) * count +
+                               (sizeof(uint32_t) + sizeof(V2) + 2.0 * sizeof(uint32_t)) * entry_total +
+                               4.0 * sizeof(V2) * count;
+
+    // pos/vel in and out, and the positions of the last rebuild in
+    const double refresh_bytes = 5.0 * sizeof(V2) * count;
+
+    if (cfg.stages[ST_NEIGHBOR_LIST_BUILD]) {
+        const Timing t = measure(cfg.min_time, [&] { populate(boids, wl, count, cfg); },
+                                 [&] { lists.insert(boids, scheduler); });
+        report(wl, count, STAGE_NAMES[ST_NEIGHBOR_LIST_BUILD], t, build_bytes);
+    }
+
+    // an insert for boids that haven't moved, reusing the lists
+    if (cfg.stages[ST_NEIGHBOR_LIST_REFRESH]) {
+        const Timing t = measure(cfg.min_time, nothing, [&] { lists.insert(boids, scheduler); });
+        report(wl, count, STAGE_NAMES[ST_NEIGHBOR_LIST_REFRESH], t, refresh_bytes);
+    }
+
+    if (cfg.stages[ST_FORCE_KERNEL_NEIGHBOR_LIST]) {
+        const Timing t = measure(cfg.min_time, nothing, [&] { boids.compute_forces(params, lists); });
+        report(wl, count, STAGE_NAMES[ST_FORCE_KERNEL_NEIGHBOR_LIST], t,
+               3.0 * sizeof(V2) * count + list_visit_bytes);
+    }
+
+    // whole steps, a batch of them per rep starting from the workload, so the lists' rebuilds
+    // are spread over the steps they were reused for. the times are per step.
+    auto measure_steps = [&](auto& neighbors) {
+        Timing t = measure(cfg.min_time,
+                           [&] {
+                               populate(boids, wl, count, cfg);
+                               lists.reset_stats();
+                           },
+                           [&] {
+                               for (size_t i = 0; i < s_step_batch; i++) boids.update(dt, params, neighbors);
+                           });
+        t.seconds_per_rep /= s_step_batch;
+        return t;
+    };
+
+    if (cfg.stages[ST_STEP_GRID]) {
+        const Timing t = measure_steps(grid);
+        const double bytes = insert_bytes + 4.0 * sizeof(V2) * count + visit_bytes;
+        report(wl, count, STAGE_NAMES[ST_STEP_GRID], t, bytes);
+    }
+
+    // the same neighbors as the lists, members visited in place. the levels above the nodes
+    // aren't counted
+    if (cfg.stages[ST_STEP_GRID_IN_REACH]) {
+        QuadTree reach_grid = make_reach_grid(cfg);
+        populate(boids, wl, count, cfg);
+        reach_grid.insert(boids, scheduler);
+
+        size_t reach_fine_total = 0;
+        size_t reach_coarse_total = 0;
+        for (const V2& pos : boids.positions()) {
+            reach_grid.for_each_neighbor(pos, [&](const auto& node) { reach_fine_total += node.count; },
+                                         [&](const PseudoBoid&) { reach_coarse_total++; });
+        }
+
+        const Timing t = measure_steps(reach_grid);
+        const double bytes = insert_bytes_of(2.0 * sizeof(V2)) + 4.0 * sizeof(V2) * count +
+                             2.0 * sizeof(V2) * reach_fine_total + sizeof(PseudoBoid) * reach_coarse_total;
+        report(wl, count, STAGE_NAMES[ST_STEP_GRID_IN_REACH], t, bytes);
+    }
+
+    if (cfg.stages[ST_STEP_NEIGHBOR_LIST]) {
+        const Timing t = measure_steps(lists);
+        const NeighborListStats& stats = lists.stats();
+        const double bytes = refresh_bytes + 4.0 * sizeof(V2) * count + list_visit_bytes +
+                             build_bytes / std::max(1.0, stats.steps_per_rebuild());
+        report(wl, count, STAGE_NAMES[ST_STEP_NEIGHBOR_LIST], t, bytes);
+        report_lists(wl, count, lists);
+    }
+}
+
+// the vector kernels only change the order of the additions, so their error is bounded by a
+// small multiple of float epsilon times the sum of the magnitudes of everything that was added
+static constexpr double s_kernel_tolerance = 1e-5;
+
+static void run_node_kernel(KernelIsa isa, float px, float py, float radius_sq, const NodeSpan& node,
+                            NeighborSums& sums)
+{
+    node_kernel(isa)(px, py, radius_sq, node, sums);
+}
+
+static void run_node_kernel(KernelIsa isa, float px, float py, float radius_sq, const CompactNodeSpan& node,
+                            NeighborSums& sums)
+{
+    compact_node_kernel(isa)(px, py, radius_sq, node, sums);
+}
+
+// largest round trip error of the compact encoding over the population, against its bound
+static bool verify_encoding(Workload wl, size_t count, const BoidCollection& boids)
+{
+    double pos_error = 0.0;
+    double vel_error = 0.0;
+    const float pos_step = CompactEncoding::pos_step(boids.domain_span());
+    const float pos_bound = CompactEncoding::max_pos_error(boids.domain_span());
+
+    for (size_t i = 0; i < boids.population(); i++) {
+        const V2 pos = boids.positions()[i];
+        const V2 vel = boids.velocities()[i];
+        for (float x : {pos.x, pos.y}) {
+            const uint16_t encoded = CompactEncoding::encode_pos(x, pos_step);
+            const float decoded = CompactEncoding::decode_pos(encoded, pos_step);
+            pos_error = std::max(pos_error, std::fabs(static_cast<double>(decoded) - x));
+        }
+        for (float v : {vel.x, vel.y}) {
+            const float decoded = CompactEncoding::decode_vel(CompactEncoding::encode_vel(v));
+            vel_error = std::max(vel_error, std::fabs(static_cast<double>(decoded) - v));
+        }
+    }
+
+    // the bounds are exact, decoding only adds a rounding of the (small) result on top
+    const bool passed =
+        pos_error <= pos_bound * (1.0 + 1e-6) && vel_error <= CompactEncoding::max_vel_error * (1.0 + 1e-6);
+
+    printf("%s    {\"workload\": \"%s\", \"boids\": %zu, \"encoding\": \"compact\", "
+           "\"max_pos_error\": %.3g, \"pos_bound\": %.3g, \"max_vel_error\": %.3g, \"vel_bound\": %.3g, "
+           "\"passed\": %s}",
+           s_first_result ? "" : ",\n", WORKLOAD_NAMES[wl], count, pos_error, pos_bound, vel_error,
+           CompactEncoding::max_vel_error, passed ? "true" : "false");
+    s_first_result = false;
+    fflush(stdout);
+
+    return passed;
+}
+
+// compare every supported vector node kernel to the scalar one, over the fine grain
+// neighborhood of every boid. coarse grain pseudoboids always go through the scalar path.
+// with --compact, the compact kernels are compared to the scalar compact kernel instead.
+static bool verify_kernels(Workload wl, size_t count, const Config& cfg)
+{
+    UniformDistribution d_unused(0.f, 1.f, 0.f, 1.f, cfg.seed);
+    BoidCollection boids(0, d_unused, d_unused, cfg.thread_count);
+    Scheduler scheduler(cfg.thread_count);
+
+    // without the cap, so that the crowded nodes of the collapsed workload go through the node
+    // kernels too instead of being handed out as their aggregate
+    QuadTree grid = make_grid(cfg);
+    grid.set_node_cap(0);
+
+    populate(boids, wl, count, cfg);
+    const double pairs = fine_pair_count(boids, cfg.nodes_per_axis, 0);
+    if (pairs > cfg.max_pairs) {
+        report_skipped(wl, count, pairs);
+        return true;
+    }
+
+    grid.insert(boids, scheduler);
+
+    const float radius_sq = grid.effect_radius_squared();
+    bool all_passed = !cfg.compact || verify_encoding(wl, count, boids);
+
+    for (int isa = KI_SCALAR + 1; isa < KI_COUNT; isa++) {
+        if (!kernel_isa_supported(static_cast<KernelIsa>(isa))) continue;
+
+        double max_error = 0.0;
+
+        for (const V2& pos : boids.positions()) {
+            NeighborSums expected, actual;
+            double scale[7] = {0.0};
+
+            grid.for_each_neighbor(pos,
+                                   [&](const auto& node) {
+                                       run_node_kernel(KI_SCALAR, pos.x, pos.y, radius_sq, node, expected);
+                                       run_node_kernel(static_cast<KernelIsa>(isa), pos.x, pos.y, radius_sq,
+                                                       node, actual);
+
+                                       for (size_t i = 0; i < node.count; i++) {
+                                           const double dx = pos.x - node.x(i);
+                                           const double dy = pos.y - node.y(i);
+                                           const double separation = dx * dx + dy * dy;
+                                           if (separation >= radius_sq) continue;
+
+                                           scale[0] += std::fabs(node.x(i));
+                                           scale[1] += std::fabs(node.y(i));
+                                           scale[2] += std::fabs(node.vx(i));
+                                           scale[3] += std::fabs(node.vy(i));
+                                           scale[4] += 1.0;
+                                           if (separation > 1e-7) {
+                                               scale[5] += std::fabs(dx) / separation;
+                                               scale[6] += std::fabs(dy) / separation;
+                                           }
+                                       }
+                                   },
+                                   [](const PseudoBoid&) {});
+
+            const float e[7] = {expected.pos_x, expected.pos_y, expected.vel_x, expected.vel_y,
+                                expected.weight, expected.dens_x, expected.dens_y};
+            const float a[7] = {actual.pos_x, actual.pos_y, actual.vel_x, actual.vel_y,
+                                actual.weight, actual.dens_x, actual.dens_y};
+
+            for (int c = 0; c < 7; c++) {
+                const double error = std::fabs(static_cast<double>(a[c]) - e[c]) / std::max(scale[c], 1e-30);
+                max_error = std::isfinite(error) ? std::max(max_error, error) : INFINITY;
+            }
+        }
+
+        const bool passed = max_error <= s_kernel_tolerance;
+        all_passed = all_passed && passed;
+
+        printf("%s    {\"workload\": \"%s\", \"boids\": %zu, \"kernel\": \"%s%s\", \"max_rel_error\": %.3g, "
+               "\"tolerance\": %.3g, \"passed\": %s}",
+               s_first_result ? "" : ",\n", WORKLOAD_NAMES[wl], count, KERNEL_ISA_NAMES[isa],
+               cfg.compact ? "_compact" : "", max_error, s_kernel_tolerance, passed ? "true" : "false");
+        s_first_result = false;
+        fflush(stdout);
+    }
+
+    return all_passed;
+}
+
+// a fixed set of points, the index'th sample being the index'th point
+class PointDistribution : public Distribution {
+    std::vector<V2> m_points;
+
+public:
+    explicit PointDistribution(std::vector<V2> points) : Distribution(0), m_points(std::move(points)) {}
+
+    V2 sample(uint64_t index) const final { return m_points[index]; }
+};
+
+// the node of the given span at the center of the domain, just over the cap: cap boids clumped at
+// its low corner and a stray one at its high corner, out of reach of the clump. one more boid
+// sits across that corner in the next node, within reach of the stray.
+static std::vector<V2> crowded_node(float span, size_t cap)
+{
+    const float low = span * std::floor(0.5f * WinProps::boid_span / span);
+    std::vector<V2> points;
+    for (size_t i = 0; i < cap; i++) {
+        const float angle = 6.2831853f * static_cast<float>(i) / static_cast<float>(cap);
+        points.push_back({low + span * (0.05f + 0.02f * std::cos(angle)),
+                          low + span * (0.05f + 0.02f * std::sin(angle))});
+    }
+    points.push_back({low + 0.95f * span, low + 0.95f * span});
+    points.push_back({low + 1.05f * span, low + 1.05f * span});
+    return points;
+}
+
+// the stray boid is out of reach of the clump, and of the aggregate of the rest of its node, so
+// it sees the same neighbors whether its node is handed out member by member or as its aggregate:
+// only the boid across the corner. its velocity change has to be the same with and without the
+// cap. span is that of the grid's nodes, with the effect radius at half of it or less. make_grid
+// makes a fresh grid.
+template <typename MakeGrid>
+static bool verify_node_cap(const char* name, MakeGrid&& make_grid, float span, const Config& cfg)
+{
+    auto capped = make_grid();
+    auto uncapped = make_grid();
+    capped.set_node_cap(cfg.node_cap > 0 ? cfg.node_cap : QuadTree::s_default_node_cap);
+    uncapped.set_node_cap(0);
+    const size_t cap = capped.node_cap();
+
+    const std::vector<V2> points = crowded_node(span, cap);
+    std::vector<V2> velocities(points.size());
+    for (size_t i = 0; i < velocities.size(); i++) {
+        const float angle = 0.7f * static_cast<float>(i);
+        velocities[i] = {3.f * std::cos(angle), 3.f * std::sin(angle)};
+    }
+
+    Scheduler scheduler(cfg.thread_count);
+    BoidCollection boids(points.size(), PointDistribution(points), PointDistribution(velocities),
+                         cfg.thread_count);
+    boids.set_kernel_isa(cfg.kernel_isa);
+
+    capped.insert(boids, scheduler);
+    boids.compute_forces(cfg.params, capped);
+    const UninitializedVector<V2> with_cap = boids.velocity_changes();
+
+    uncapped.insert(boids, scheduler);
+    boids.compute_forces(cfg.params, uncapped);
+    const UninitializedVector<V2>& without_cap = boids.velocity_changes();
+
+    const size_t stray = cap;
+    const double error =
+        (with_cap[stray] - without_cap[stray]).magnitude() / std::max(1.f, without_cap[stray].magnitude());
+
+    const bool passed = error <= s_kernel_tolerance;
+    printf("%s    {\"grid\": \"%s\", \"node_cap\": %zu, \"boids\": %zu, \"rel_error\": %.3g, "
+           "\"tolerance\": %.3g, \"passed\": %s}",
+           s_first_result ? "" : ",\n", name, cap, points.size(), error, s_kernel_tolerance,
+           passed ? "true" : "false");
+    s_first_result = false;
+    fflush(stdout);
+
+    return passed;
+}
+
+static bool verify_node_caps(const Config& cfg)
+{
+    const float node_span = WinProps::boid_span / static_cast<float>(cfg.nodes_per_axis);
+
+    bool passed = verify_node_cap("grid", [&] { return QuadTree(cfg.nodes_per_axis); }, node_span, cfg);
+
+    auto make_barnes_hut = [&] {
+        QuadTree grid(cfg.nodes_per_axis);
+        grid.set_opening_angle(0.5f);
+        return grid;
+    };
+    passed = verify_node_cap("grid_barnes_hut", make_barnes_hut, node_span, cfg) && passed;
+
+    passed = verify_node_cap("sparse", [&] { return SparseGrid(node_span); }, node_span, cfg) && passed;
+
+    // without a skin the lists' cells are as wide as the effect radius, or a little wider
+    const int cells_per_axis = static_cast<int>(WinProps::boid_span / (0.5f * node_span));
+    const float cell_span = WinProps::boid_span / static_cast<float>(cells_per_axis);
+    passed = verify_node_cap("neighbor_list", [&] { return NeighborList(node_span, 0.f); }, cell_span, cfg) &&
+             passed;
+
+    return passed;
+}
+
+static void print_usage(const char* program)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --sizes N,N,...     populations to run (default 10000,100000,1000000)\n"
+            "  --workloads W,...   any of uniform,clustered,collapsed (default all)\n"
+            "  --stages S,...      any of grid_insert,neighbor_query,neighbor_visit,force_kernel,\n"
+            "                      integrate,fused_force_integrate,reorder,integrate_branching,\n"
+            "                      fused_force_integrate_branching,neighbor_list_build,\n"
+            "                      neighbor_list_refresh,force_kernel_neighbor_list,\n"
+            "                      step_grid,step_grid_in_reach,step_neighbor_list (default all). the step\n"
+            "                      stages time batches of 16 whole steps, so that the lists' rebuilds are\n"
+            "                      spread over the steps they were reused for. step_neighbor_list sees\n"
+            "                      every boid within the radius on its own, and so does\n"
+            "                      step_grid_in_reach, the grid searched with every cell opened, while\n"
+            "                      step_grid's fixed stencil does less work for a different flock. crowded\n"
+            "                      cells are aggregated over different boids by the two. the neighbor lists\n"
+            "                      have no opening angle or compact storage\n"
+            "  --threads N         threads, including the calling one (default 1)\n"
+            "  --grid N            grid nodes per axis (default 128)\n"
+            "  --opening-angle T   Barnes-Hut neighbor search with opening angle T, 0 uses the fixed\n"
+            "                      stencil of adjacent nodes (default 0)\n"
+            "  --radius R          interaction radius (default: half a grid node)\n"
+            "  --node-cap N        nodes with more boids only count as their aggregate, 0 for no cap\n"
+            "                      (default 512)\n"
+            "  --skin F            how much further than the radius the neighbor lists reach. has to\n"
+            "                      outlast a step at Max_Speed (default: as much as lasts 2 steps at it)\n"
+            "  --dt SECONDS        time step of the integration and step stages (default 1/60). the lists\n"
+            "                      are rebuilt once a boid moved half the skin, so this sets how long\n"
+            "                      they last\n"
+            "  --min-time SECONDS  minimum measuring time per stage (default 0.5)\n"
+            "  --max-pairs N       skip cases with more fine grain pairs than this (default 2e9)\n"
+            "  --seed N            workload seed (default 1)\n"
+            "  --reorder           sort each population along a Morton curve before timing it\n"
+            "  --kernel ISA        force kernel instruction set: scalar,sse2,avx2,avx512 (default: best)\n"
+            "  --compact           store the grid's copy of the boids as 16 bit fixed point\n"
+            "  --disable R,...     turn rules off for the force and integration stages, any of\n"
+            "                      Center_Of_Mass,Density,Confine,Average_Velocity,Gravity,Random_Noise,\n"
+            "                      Max_Force,Max_Speed\n"
+            "  --verify-kernels    instead of timing, check that every vector force kernel the cpu\n"
+            "                      supports matches the scalar one within tolerance (with --compact,\n"
+            "                      the compact kernels and the encoding's error bound). every node is\n"
+            "                      checked member by member, whatever --node-cap\n"
+            "  --verify-node-cap   instead of timing, check that a boid out of reach of the others in its\n"
+            "                      crowded node sees the same neighbors whether the node is over\n"
+            "                      --node-cap or not, with every kind of grid\n",
+            program);
+}
+
+static std::vector<std::string> split_list(const char* list)
+{
+    std::vector<std::string> result;
+    std::string item;
+    for (const char* c = list; *c; c++) {
+        if (*c == ',') {
+            result.push_back(item);
+            item.clear();
+        }
+        else {
+            item += *c;
+        }
+    }
+    result.push_back(item);
+    return result;
+}
+
+static bool parse_args(int argc, char** argv, Config& cfg)
+{
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+
+        if (strcmp(arg, "--reorder") == 0) {
+            cfg.reorder = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--compact") == 0) {
+            cfg.compact = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--verify-kernels") == 0) {
+            cfg.verify_kernels = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--verify-node-cap") == 0) {
+            cfg.verify_node_cap = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0 || i + 1 >= argc) {
+            return false;
+        }
+
+        const char* value = argv[++i];
+
+        if (strcmp(arg, "--sizes") == 0) {
+            cfg.sizes.clear();
+            for (const std::string& s : split_list(value)) {
+                cfg.sizes.push_back(strtoull(s.c_str(), nullptr, 10));
+            }
+        }
+        else if (strcmp(arg, "--workloads") == 0) {
+            cfg.workloads.clear();
+            for (const std::string& s : split_list(value)) {
+                const auto it = std::find_if(std::begin(WORKLOAD_NAMES), std::end(WORKLOAD_NAMES),
+                                             [&](const char* name) { return s == name; });
+                if (it == std::end(WORKLOAD_NAMES)) {
+                    fprintf(stderr, "unknown workload '%s'\n", s.c_str());
+                    return false;
+                }
+                cfg.workloads.push_back(static_cast<Workload>(it - std::begin(WORKLOAD_NAMES)));
+            }
+        }
+        else if (strcmp(arg, "--stages") == 0) {
+            std::fill(std::begin(cfg.stages), std::end(cfg.stages), false);
+            for (const std::string& s : split_list(value)) {
+                const auto it = std::find_if(std::begin(STAGE_NAMES), std::end(STAGE_NAMES),
+                                             [&](const char* name) { return s == name; });
+                if (it == std::end(STAGE_NAMES)) {
+                    fprintf(stderr, "unknown stage '%s'\n", s.c_str());
+                    return false;
+                }
+                cfg.stages[it - std::begin(STAGE_NAMES)] = true;
+            }
+        }
+        else if (strcmp(arg, "--threads") == 0) {
+            cfg.thread_count = strtoull(value, nullptr, 10);
+        }
+        else if (strcmp(arg, "--grid") == 0) {
+            cfg.nodes_per_axis = atoi(value);
+        }
+        else if (strcmp(arg, "--opening-angle") == 0) {
+            cfg.opening_angle = std::max(0.f, strtof(value, nullptr));
+        }
+        else if (strcmp(arg, "--radius") == 0) {
+            cfg.effect_radius = std::max(0.f, strtof(value, nullptr));
+        }
+        else if (strcmp(arg, "--node-cap") == 0) {
+            cfg.node_cap = strtoull(value, nullptr, 10);
+        }
+        else if (strcmp(arg, "--skin") == 0) {
+            cfg.skin = std::max(0.f, strtof(value, nullptr));
+        }
+        else if (strcmp(arg, "--dt") == 0) {
+            cfg.dt = strtof(value, nullptr);
+        }
+        else if (strcmp(arg, "--min-time") == 0) {
+            cfg.min_time = strtod(value, nullptr);
+        }
+        else if (strcmp(arg, "--max-pairs") == 0) {
+            cfg.max_pairs = strtod(value, nullptr);
+        }
+        else if (strcmp(arg, "--seed") == 0) {
+            cfg.seed = static_cast<unsigned>(strtoul(value, nullptr, 10));
+        }
+        else if (strcmp(arg, "--disable") == 0) {
+            for (const std::string& s : split_list(value)) {
+                const auto it = std::find_if(std::begin(RULE_NAMES_NOSPACE), std::end(RULE_NAMES_NOSPACE),
+                                             [&](const char* name) { return s == name; });
+                if (it == std::end(RULE_NAMES_NOSPACE)) {
+                    fprintf(stderr, "unknown rule '%s'\n", s.c_str());
+                    return false;
+                }
+                cfg.params.toggles[it - std::begin(RULE_NAMES_NOSPACE)] = false;
+            }
+        }
+        else if (strcmp(arg, "--kernel") == 0) {
+            const auto it = std::find_if(std::begin(KERNEL_ISA_NAMES), std::end(KERNEL_ISA_NAMES),
+                                         [&](const char* name) { return strcmp(value, name) == 0; });
+            const KernelIsa isa = static_cast<KernelIsa>(it - std::begin(KERNEL_ISA_NAMES));
+            if (it == std::end(KERNEL_ISA_NAMES) || !kernel_isa_supported(isa)) {
+                fprintf(stderr, "kernel '%s' is unknown or not supported by this cpu\n", value);
+                return false;
+            }
+            cfg.kernel_isa = isa;
+        }
+        else {
+            fprintf(stderr, "unknown argument '%s'\n", arg);
+            return false;
+        }
+    }
+
+    for (size_t count : cfg.sizes) {
+        if (count == 0) return false;
+    }
+
+    // a skin a boid can cross half of in one step would have the lists built every step
+    const float max_speed = cfg.params.values[RT_MAX_VELOCITY];
+    const float step_skin = NeighborList::skin_lasting(max_speed, cfg.dt, 1);
+    if (cfg.skin == 0.f) {
+        cfg.skin = NeighborList::skin_lasting(max_speed, cfg.dt);
+    }
+    else if (cfg.skin <= step_skin) {
+        fprintf(stderr, "--skin has to be more than %g to outlast a step at Max_Speed %g\n", step_skin,
+                max_speed);
+        return false;
+    }
+
+    return cfg.thread_count > 0 && cfg.nodes_per_axis > 1;
+}
+
+int main(int argc, char** argv)
+{
+    Config cfg;
+
+    if (!parse_args(argc, argv, cfg)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    printf("{\n");
+    printf("  \"threads\": %zu,\n", cfg.thread_count);
+    printf("  \"grid_nodes_per_axis\": %d,\n", cfg.nodes_per_axis);
+    {
+        const QuadTree grid = make_grid(cfg);
+        printf("  \"opening_angle\": %g,\n", grid.opening_angle());
+        printf("  \"effect_radius\": %g,\n", std::sqrt(grid.effect_radius_squared()));
+        printf("  \"node_cap\": %zu,\n", grid.node_cap());
+        printf("  \"compact\": %s,\n", grid.compact_storage() ? "true" : "false");
+    }
+    printf("  \"skin\": %g,\n", cfg.skin);
+    printf("  \"dt\": %g,\n", cfg.dt);
+    printf("  \"seed\": %u,\n", cfg.seed);
+    if (!cfg.verify_kernels && !cfg.verify_node_cap) {
+        printf("  \"kernel\": \"%s\",\n", KERNEL_ISA_NAMES[cfg.kernel_isa]);
+        printf("  \"reorder\": %s,\n", cfg.reorder ? "true" : "false");
+        printf("  \"disabled_rules\": [");
+        bool first = true;
+        for (int rt = 0; rt < RT_COUNT; rt++) {
+            if (cfg.params.toggles[rt]) continue;
+            printf("%s\"%s\"", first ? "" : ", ", RULE_NAMES_NOSPACE[rt]);
+            first = false;
+        }
+        printf("],\n");
+    }
+    printf("  \"results\": [\n");
+
+    bool passed = true;
+
+    if (cfg.verify_node_cap) {
+        passed = verify_node_caps(cfg);
+        printf("\n  ]\n}\n");
+        return passed ? 0 : 1;
+    }
+
+    for (Workload wl : cfg.workloads) {
+        for (size_t count : cfg.sizes) {
+            if (cfg.verify_kernels) {
+                passed = verify_kernels(wl, count, cfg) && passed;
+            }
+            else {
+                run_case(wl, count, cfg);
+            }
+        }
+    }
+
+    printf("\n  ]\n}\n");
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,788 @@
+#include "boid_collection.hpp"
+
+#include <string.h>
+
+#include <chrono>
+#include <type_traits>
+using namespace std::chrono;
+
+#include "force_kernel.hpp"
+#include "neighbor_list.hpp"
+#include "parallel.hpp"
+#include "sparse_grid.hpp"
+
+static constexpr float wrap_real(float x, float m) { return x - m * std::floor(x / m); }
+
+// boids per scheduler task. the force pass costs anywhere from a few to thousands of neighbor
+// visits per boid, so its pieces are kept small enough for stealing to even out dense regions
+static constexpr size_t s_force_grain = 256;
+static constexpr size_t s_stream_grain = 16384;
+
+BoidCollection::BoidCollection(size_t new_boid_count, const Distribution& init_pos,
+                               const Distribution& init_vel, size_t thread_count)
+    : m_scheduler(thread_count)
+{
+    reset(new_boid_count, init_pos, init_vel);
+}
+
+BoidCollection::BoidCollection(void)
+{
+    UniformDistribution d_pos(0.25f * WinProps::boid_span, 0.75f * WinProps::boid_span,
+                              0.25f * WinProps::boid_span, 0.75f * WinProps::boid_span);
+    UniformDistribution d_vel(-50.f, 50.f, -50.f, 50.f);
+    reset(30000, d_pos, d_vel);
+}
+
+void BoidCollection::reset(size_t new_boid_count, const Distribution& init_pos, const Distribution& init_vel)
+{
+    clear_ghosts();
+    for (UninitializedVector<V2>* vec : {&m_pos, &m_vel}) {
+        assert(vec->size() == m_count);
+        vec->resize(new_boid_count);
+    }
+
+    init_pos.fill(m_scheduler, m_pos.data(), new_boid_count);
+    init_vel.fill(m_scheduler, m_vel.data(), new_boid_count);
+
+    m_delta_vel.clear();
+
+    m_ids.resize(new_boid_count);
+    m_indices.resize(new_boid_count);
+    for (size_t i = 0; i < new_boid_count; i++) {
+        m_ids[i] = static_cast<uint32_t>(i);
+        m_indices[i] = static_cast<uint32_t>(i);
+    }
+
+    m_count = new_boid_count;
+    m_species_offsets = {0, new_boid_count};
+    m_step = 0;
+    m_order_version++;
+    m_pages_placed = false;
+}
+
+// the distributions fill the whole population in one go, which is then cut into the species,
+// so that the same total draws the same boids however it is split up
+void BoidCollection::reset(const std::vector<size_t>& species_counts, const Distribution& init_pos,
+                           const Distribution& init_vel)
+{
+    assert(!species_counts.empty() && species_counts.size() <= SpeciesRules::max_species);
+
+    size_t total = 0;
+    for (size_t count : species_counts) total += count;
+    reset(total, init_pos, init_vel);
+
+    m_species_offsets.assign(1, 0);
+    for (size_t count : species_counts) m_species_offsets.push_back(m_species_offsets.back() + count);
+}
+
+bool BoidCollection::restore(size_t count, const V2* pos, const V2* vel, const uint32_t* ids, size_t step,
+                             uint64_t seed)
+{
+    assert(count <= UINT32_MAX);
+
+    for (UninitializedVector<V2>* vec : {&m_pos, &m_vel}) vec->resize(count);
+    m_ids.resize(count);
+    m_delta_vel.clear();
+    m_ghost_count = 0;
+
+    // straight memory copies, each thread streaming through its own pieces of the arrays
+    parallel_for(m_scheduler, 0, count, s_stream_grain, [&](size_t low, size_t high) {
+        memcpy(&m_pos[low], pos + low, (high - low) * sizeof(V2));
+        memcpy(&m_vel[low], vel + low, (high - low) * sizeof(V2));
+        memcpy(&m_ids[low], ids + low, (high - low) * sizeof(uint32_t));
+    });
+
+    // n ids in range landing in n distinct slots is exactly a permutation
+    bool valid = true;
+    m_indices.assign(count, UINT32_MAX);
+    for (size_t i = 0; i < count && valid; i++) {
+        const uint32_t id = m_ids[i];
+        valid = id < count && m_indices[id] == UINT32_MAX;
+        if (valid) m_indices[id] = static_cast<uint32_t>(i);
+    }
+
+    if (!valid) {
+        for (UninitializedVector<V2>* vec : {&m_pos, &m_vel}) vec->clear();
+        m_ids.clear();
+        m_indices.clear();
+        count = 0;
+        step = 0;
+    }
+
+    m_count = count;
+    m_species_offsets = {0, count};
+    m_step = step;
+    m_order_version++;
+    set_seed(seed);
+    m_pages_placed = false;
+    return valid;
+}
+
+void BoidCollection::clear_ghosts(void)
+{
+    if (m_ghost_count == 0) return;
+
+    for (UninitializedVector<V2>* vec : {&m_pos, &m_vel}) vec->resize(m_count);
+    m_ghost_count = 0;
+}
+
+void BoidCollection::add_boids(const MigratingBoid* boids, size_t count)
+{
+    assert(species_count() == 1);
+    clear_ghosts();
+    if (count == 0) return;
+
+    assert(m_count + count <= UINT32_MAX);
+    const V2* old_data = m_pos.data();
+
+    for (size_t i = 0; i < count; i++) {
+        const MigratingBoid& boid = boids[i];
+        if (boid.id >= m_indices.size()) m_indices.resize(boid.id + size_t(1), UINT32_MAX);
+        assert(m_indices[boid.id] == UINT32_MAX);
+
+        m_indices[boid.id] = static_cast<uint32_t>(m_count + i);
+        m_pos.push_back(boid.pos);
+        m_vel.push_back(boid.vel);
+        m_ids.push_back(boid.id);
+    }
+
+    m_count += count;
+    m_species_offsets.back() = m_count;
+    m_order_version++;
+    if (m_pos.data() != old_data) m_pages_placed = false;
+}
+
+void BoidCollection::set_ghosts(size_t count, const V2* pos, const V2* vel)
+{
+    assert(species_count() == 1);
+    const V2* old_data = m_pos.data();
+
+    for (UninitializedVector<V2>* vec : {&m_pos, &m_vel}) vec->resize(m_count + count);
+    if (count > 0) {
+        memcpy(&m_pos[m_count], pos, count * sizeof(V2));
+        memcpy(&m_vel[m_count], vel, count * sizeof(V2));
+    }
+    m_ghost_count = count;
+
+    if (m_pos.data() != old_data) m_pages_placed = false;
+}
+
+uint64_t BoidCollection::state_hash(void) const
+{
+    uint64_t hash = mix_bits(m_step ^ mix_bits(m_count));
+
+    for (size_t i = 0; i < m_count; i++) {
+        uint64_t pos_bits, vel_bits;
+        memcpy(&pos_bits, &m_pos[i], sizeof(pos_bits));
+        memcpy(&vel_bits, &m_vel[i], sizeof(vel_bits));
+        hash = mix_bits(hash ^ pos_bits);
+        hash = mix_bits(hash ^ vel_bits ^ (static_cast<uint64_t>(m_ids[i]) << 32));
+    }
+
+    return hash;
+}
+
+bool BoidCollection::pin_threads(const Topology& topology)
+{
+    if (!m_scheduler.pin_threads(topology.compact_cpus(m_scheduler.thread_count()))) return false;
+
+    m_place_pages = true;
+    m_pages_placed = false;
+    return true;
+}
+
+// uniformly spread over the domain, keeping clear of the edges where confine pushes hardest
+static inline V2 respawn_position(const CounterRng& rng, uint64_t step, uint32_t id, float span)
+{
+    const V2 unit = CounterRng::unit_square(rng.bits(step, id));
+
+    const float margin = 2.f;
+    const float extent = span - 2.f * margin;
+    return {margin + extent * unit.x, margin + extent * unit.y};
+}
+
+// spread the low 11 bits of x out to the even bits of the result
+static inline uint32_t spread_bits(uint32_t x)
+{
+    x &= 0x000007ff;
+    x = (x | (x << 8)) & 0x00ff00ff;
+    x = (x | (x << 4)) & 0x0f0f0f0f;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    return x;
+}
+
+// position along a Z curve through a 2048 x 2048 lattice over the domain, which is
+// already much finer than any useful grid. scale is 2048 / domain span
+static inline uint32_t morton_key(V2 pos, float scale)
+{
+    auto quantize = [=](float x) { return static_cast<uint32_t>(std::min(2047.f, std::max(0.f, x * scale))); };
+    return spread_bits(quantize(pos.x)) | (spread_bits(quantize(pos.y)) << 1);
+}
+
+void BoidCollection::reorder(void)
+{
+    assert(m_count <= UINT32_MAX);
+
+    for (int i = 0; i < 2; i++) {
+        m_sort_keys[i].resize(m_count);
+        m_sort_order[i].resize(m_count);
+    }
+
+    // with several species the species goes in front of the 22 bit Morton key, and takes a
+    // third digit to sort by. the species are stored in order already, so they stay where they are.
+    const float scale = 2048.f / m_domain_span;
+    parallel_for(m_scheduler, 0, m_count, s_stream_grain, [&](size_t low, size_t high) {
+        for_each_species_span(low, high, [&](size_t species, size_t span_low, size_t span_high) {
+            const uint32_t species_key = static_cast<uint32_t>(species) << 22;
+            for (size_t i = span_low; i < span_high; i++) {
+                m_sort_keys[0][i] = species_key | morton_key(m_pos[i], scale);
+                m_sort_order[0][i] = static_cast<uint32_t>(i);
+            }
+        });
+    });
+
+    // least significant digit radix sort of the keys, 11 bits at a time.
+    // each pass is stable, so boids with equal keys keep their relative order.
+    constexpr int digit_bits = 11;
+    constexpr uint32_t digit_mask = (1u << digit_bits) - 1;
+    const int pass_count = species_count() > 1 ? 3 : 2;
+
+    for (int pass = 0; pass < pass_count; pass++) {
+        const int shift = pass * digit_bits;
+        const UninitializedVector<uint32_t>& keys_in = m_sort_keys[pass % 2];
+        const UninitializedVector<uint32_t>& order_in = m_sort_order[pass % 2];
+        UninitializedVector<uint32_t>& keys_out = m_sort_keys[(pass + 1) % 2];
+        UninitializedVector<uint32_t>& order_out = m_sort_order[(pass + 1) % 2];
+
+        size_t cursors[digit_mask + 1] = {0};
+        for (size_t i = 0; i < m_count; i++) {
+            cursors[(keys_in[i] >> shift) & digit_mask]++;
+        }
+
+        size_t total = 0;
+        for (size_t& c : cursors) {
+            const size_t digit_count = c;
+            c = total;
+            total += digit_count;
+        }
+
+        for (size_t i = 0; i < m_count; i++) {
+            const size_t dst = cursors[(keys_in[i] >> shift) & digit_mask]++;
+            keys_out[dst] = keys_in[i];
+            order_out[dst] = order_in[i];
+        }
+    }
+
+    // after an even number of passes the result ends up back in the first buffer
+    const UninitializedVector<uint32_t>& order = m_sort_order[pass_count % 2];
+
+    // ghosts stay behind the population, in their own order
+    auto permute = [&](UninitializedVector<V2>& values) {
+        const bool grows = m_reorder_buffer.capacity() < values.size();
+        m_reorder_buffer.resize(values.size());
+        if (grows && m_place_pages) place_pages(m_scheduler, m_reorder_buffer);
+
+        parallel_for(m_scheduler, 0, m_count, s_stream_grain, [&](size_t low, size_t high) {
+            for (size_t i = low; i < high; i++) {
+                m_reorder_buffer[i] = values[order[i]];
+            }
+        });
+        std::copy(values.begin() + m_count, values.end(), m_reorder_buffer.begin() + m_count);
+        values.swap(m_reorder_buffer);
+    };
+
+    permute(m_pos);
+    permute(m_vel);
+    if (m_delta_vel.size() == m_count) permute(m_delta_vel);
+
+    // the keys are no longer needed, so their buffer receives the new id array
+    UninitializedVector<uint32_t>& new_ids = m_sort_keys[pass_count % 2];
+    parallel_for(m_scheduler, 0, m_count, s_stream_grain, [&](size_t low, size_t high) {
+        for (size_t i = low; i < high; i++) {
+            new_ids[i] = m_ids[order[i]];
+            m_indices[new_ids[i]] = static_cast<uint32_t>(i);
+        }
+    });
+    m_ids.swap(new_ids);
+    m_order_version++;
+}
+
+struct BoidCollection::RuleConstants {
+    const bool* toggles = nullptr;  // only read by the branching kernels
+    float center_of_mass = 0.f;
+    float density = 0.f;
+    float average_velocity = 0.f;
+    double confine_scale = 0.0;  // the confine value times 1e3
+    float domain_span = 0.f;
+    float gravity_step = 0.f;  // gravity times dt
+    float noise_scale = 0.f;   // noise times sqrt(dt)
+    float max_force = 0.f;
+    float max_speed = 0.f;
+    float dt = 0.f;
+
+    RuleConstants(void) = default;
+
+    RuleConstants(const Rules& params, float span, float step_dt)
+        : toggles(params.toggles),
+          center_of_mass(params.values[RT_CENTER_OF_MASS]),
+          density(params.values[RT_DENSITY]),
+          average_velocity(params.values[RT_AVERAGE_VELOCITY]),
+          confine_scale(1e3 * params.values[RT_CONFINE]),
+          domain_span(span),
+          gravity_step(params.values[RT_GRAVITY] * step_dt),
+          noise_scale(params.values[RT_RANDOM_NOISE] * std::sqrt(step_dt)),
+          max_force(100.f),
+          max_speed(params.values[RT_MAX_VELOCITY]),
+          dt(step_dt)
+    {
+        // the maximum force and speed always apply. the toggle of the first only decides whether
+        // its value or the default limit does, and the second's toggle has never been read
+        const float force_limit = params.values[RT_MAX_FORCE];
+        if (params.toggles[RT_MAX_FORCE] && force_limit >= 0.f && force_limit < 300.f) {
+            max_force = force_limit;
+        }
+    }
+};
+
+// the rules the kernels are specialized for come first, so their toggles form the low bits of
+// the mask, and the neighbor rules come before the others
+static_assert(RT_CENTER_OF_MASS == 0 && RT_DENSITY == 1 && RT_CONFINE == 2 && RT_AVERAGE_VELOCITY == 3 &&
+                  RT_GRAVITY == 4 && RT_RANDOM_NOISE == 5 && RT_MAX_FORCE == 6,
+              "the rule kernels depend on the order of the rules");
+
+static constexpr size_t s_force_rule_count = RT_GRAVITY;        // the rules of apply_rules
+static constexpr size_t s_specialized_rule_count = RT_MAX_FORCE;  // those and integrate_boid's
+static constexpr uint32_t s_neighbor_rules =
+    (1u << RT_CENTER_OF_MASS) | (1u << RT_DENSITY) | (1u << RT_AVERAGE_VELOCITY);
+
+// neighbors of one thread's piece of the boids are gathered this many at a time before the rules
+// are applied to them, so that the kernel is only called through a pointer once per block
+static constexpr size_t s_rule_block = 64;
+
+template <uint32_t rules>
+static inline bool rule_enabled(const bool* toggles, RuleType rt)
+{
+    if constexpr (rules == (1u << RT_COUNT)) {
+        return toggles[rt];
+    }
+    else {
+        return ((rules >> rt) & 1) != 0;
+    }
+}
+
+static inline uint32_t rule_mask(const Rules& params, size_t rule_count)
+{
+    uint32_t mask = 0;
+    for (size_t rt = 0; rt < rule_count; rt++) {
+        if (params.toggles[rt]) mask |= 1u << rt;
+    }
+    return mask;
+}
+
+static inline float quartic(float x)
+{
+    const float square = x * x;
+    return square * square;
+}
+
+template <bool fused, size_t... masks>
+constexpr std::array<BoidCollection::RuleKernel, sizeof...(masks)> BoidCollection::rule_kernels(
+    std::index_sequence<masks...>)
+{
+    return {&BoidCollection::apply_rules<static_cast<uint32_t>(masks), fused>...};
+}
+
+template <size_t... masks>
+constexpr std::array<BoidCollection::IntegrateKernel, sizeof...(masks)> BoidCollection::integrate_kernels(
+    std::index_sequence<masks...>)
+{
+    return {&BoidCollection::integrate_range<static_cast<uint32_t>(masks << s_force_rule_count)>...};
+}
+
+// the force pass without integration only depends on the first rules, integration only on the
+// ones after them, so those kernels are only instantiated for the toggles they read
+BoidCollection::RuleKernel BoidCollection::rule_kernel(const Rules& params, bool fused) const
+{
+    static constexpr auto s_fused_kernels =
+        rule_kernels<true>(std::make_index_sequence<size_t(1) << s_specialized_rule_count>());
+    static constexpr auto s_force_kernels =
+        rule_kernels<false>(std::make_index_sequence<size_t(1) << s_force_rule_count>());
+
+    if (m_rule_dispatch == RD_BRANCHING) {
+        return fused ? &BoidCollection::apply_rules<s_branching_rules, true>
+                     : &BoidCollection::apply_rules<s_branching_rules, false>;
+    }
+    return fused ? s_fused_kernels[rule_mask(params, s_specialized_rule_count)]
+                 : s_force_kernels[rule_mask(params, s_force_rule_count)];
+}
+
+BoidCollection::IntegrateKernel BoidCollection::integrate_kernel(const Rules& params) const
+{
+    static constexpr auto s_kernels = integrate_kernels(
+        std::make_index_sequence<size_t(1) << (s_specialized_rule_count - s_force_rule_count)>());
+
+    if (m_rule_dispatch == RD_BRANCHING) return &BoidCollection::integrate_range<s_branching_rules>;
+    return s_kernels[rule_mask(params, s_specialized_rule_count) >> s_force_rule_count];
+}
+
+template <bool weighted, typename Grid>
+void BoidCollection::update_thread(const SpeciesRules& species, size_t species_index, const Grid& grid,
+                                   size_t low_index, size_t high_index, RuleKernel kernel,
+                                   const RuleConstants& constants, bool gather)
+{
+    const SpeciesInteraction* interactions = species.interactions[species_index];
+    const uint32_t neighbor_mask = species.neighbor_mask(species_index);
+    const bool counts_own_species = (neighbor_mask >> species_index) & 1;
+    const size_t species_count = species.species_count;
+
+    const NodeKernel accumulate_node = node_kernel(kernel_isa());
+    const CompactNodeKernel accumulate_compact_node = compact_node_kernel(kernel_isa());
+    const float radius_sq = grid.effect_radius_squared();
+
+    auto accumulate = [&](V2 at, const auto& node, NeighborSums& sums) {
+        if constexpr (std::is_same<std::decay_t<decltype(node)>, CompactNodeSpan>::value) {
+            accumulate_compact_node(at.x, at.y, radius_sq, node, sums);
+        }
+        else {
+            accumulate_node(at.x, at.y, radius_sq, node, sums);
+        }
+    };
+
+    NeighborSums block_sums[s_rule_block];
+
+    for (size_t block = low_index; block < high_index; block += s_rule_block) {
+        const size_t block_end = std::min(high_index, block + s_rule_block);
+
+        for (size_t id = block; id < block_end && gather; id++) {
+            const V2 pos = m_pos[id];
+            const V2 vel = m_vel[id];
+
+            // with a compact grid the neighbors are gathered around the boid's own decoded
+            // position. its copy in the grid then sits at a separation of exactly zero and drops
+            // out of the density rule, just like it does with a float grid, and the self removal
+            // below is exact.
+            const V2 at = grid.stored_position(pos);
+            const V2 self_vel = grid.stored_velocity(vel);
+
+            // the neighbors of each species are summed separately when they are weighted below
+            NeighborSums species_sums[weighted ? SpeciesRules::max_species : 1];
+            auto sums_of = [&](size_t neighbor_species) -> NeighborSums& {
+                return species_sums[weighted ? neighbor_species : 0];
+            };
+
+            // the aggregate the boid's own bucket is handed out as, when it is over the node cap
+            const PseudoBoid* own_crowd = nullptr;
+            if (counts_own_species) {
+                if constexpr (std::is_same<Grid, NeighborList>::value) {
+                    own_crowd = grid.crowd_of(id);
+                }
+                else {
+                    own_crowd = grid.crowd_at(pos, species_index);
+                }
+            }
+
+            // remove self from total. its copy is always within the radius of itself, so it is
+            // counted whenever its bucket is handed out member by member
+            if (counts_own_species && own_crowd == nullptr) {
+                NeighborSums& own = sums_of(species_index);
+                own.pos_x = -at.x;
+                own.pos_y = -at.y;
+                own.vel_x = -self_vel.x;
+                own.vel_y = -self_vel.y;
+                own.weight = -1.f;
+            }
+
+            auto fine = [&](size_t neighbor_species, const auto& node) {
+                accumulate(at, node, sums_of(neighbor_species));
+            };
+
+            // an aggregate holding the boid itself can be out of reach of it, and is then dropped
+            // along with the boid, so the boid is taken out of it before the radius test instead
+            auto coarse = [&](size_t neighbor_species, const PseudoBoid& pb) {
+                if (&pb != own_crowd) {
+                    accumulate_pseudoboid(at.x, at.y, radius_sq, pb, sums_of(neighbor_species));
+                    return;
+                }
+                const float others = pb.weight - 1.f;
+                const PseudoBoid rest((pb.weight * pb.pos - at) / others,
+                                      (pb.weight * pb.vel - self_vel) / others, others);
+                accumulate_pseudoboid(at.x, at.y, radius_sq, rest, sums_of(neighbor_species));
+            };
+
+            // the neighbor lists are kept per boid rather than looked up by position
+            if constexpr (std::is_same<Grid, NeighborList>::value) {
+                grid.for_each_species_neighbor_of(id, neighbor_mask, fine, coarse);
+            }
+            else {
+                grid.for_each_species_neighbor(pos, neighbor_mask, fine, coarse);
+            }
+
+            NeighborSums sums = species_sums[0];
+            if constexpr (weighted) {
+                sums = NeighborSums();
+                for (size_t b = 0; b < species_count; b++) {
+                    if (((neighbor_mask >> b) & 1) == 0) continue;
+
+                    const float flocking = interactions[b].flocking;
+                    const float separation = interactions[b].separation;
+                    const NeighborSums& partial = species_sums[b];
+                    sums.pos_x += flocking * partial.pos_x;
+                    sums.pos_y += flocking * partial.pos_y;
+                    sums.vel_x += flocking * partial.vel_x;
+                    sums.vel_y += flocking * partial.vel_y;
+                    sums.weight += flocking * partial.weight;
+                    sums.dens_x += separation * partial.dens_x;
+                    sums.dens_y += separation * partial.dens_y;
+                }
+            }
+
+            block_sums[id - block] = sums;
+        }
+
+        (this->*kernel)(constants, block, block_end - block, block_sums);
+    }
+}
+
+// the rules are summed in a fixed order: average velocity, confine, density, center of mass
+template <uint32_t rules, bool fused>
+void BoidCollection::apply_rules(const RuleConstants& constants, size_t first_id, size_t count,
+                                 const NeighborSums* sums)
+{
+    const bool* toggles = constants.toggles;
+
+    for (size_t i = 0; i < count; i++) {
+        const size_t id = first_id + i;
+        const V2 pos = m_pos[id];
+
+        const V2 pos_sum = {sums[i].pos_x, sums[i].pos_y};
+        const V2 vel_sum = {sums[i].vel_x, sums[i].vel_y};
+        const float weight_sum = sums[i].weight;
+        const V2 dens_accum = {sums[i].dens_x, sums[i].dens_y};
+
+        V2 dv = V2::null();
+        const bool has_neighbors = weight_sum > 0.f;
+        const float inverted_weight_sum = has_neighbors ? 1.f / weight_sum : 0.f;
+
+        if (rule_enabled<rules>(toggles, RT_AVERAGE_VELOCITY) && has_neighbors) {
+            const V2 avg_vel = vel_sum * inverted_weight_sum;
+            dv += constants.average_velocity * avg_vel;
+        }
+
+        if (rule_enabled<rules>(toggles, RT_CONFINE)) {
+            // @FIXME: Use smaller delta time increments when close to edge
+
+            const float s = constants.domain_span;
+            const float x = std::min(s - 1e-3F, std::max(1e-3F, pos.x));
+            const float y = std::min(s - 1e-3F, std::max(1e-3F, pos.y));
+
+            const float confine_x = constants.confine_scale * (1.f / quartic(x) - 1.f / quartic(x - s));
+            const float confine_y = constants.confine_scale * (1.f / quartic(y) - 1.f / quartic(y - s));
+
+            dv += {confine_x, confine_y};
+        }
+
+        if (rule_enabled<rules>(toggles, RT_DENSITY) && has_neighbors) {
+            dv += constants.density * dens_accum;
+        }
+
+        if (rule_enabled<rules>(toggles, RT_CENTER_OF_MASS) && has_neighbors) {
+            const V2 avg_pos = pos_sum * inverted_weight_sum;
+            dv += constants.center_of_mass * (avg_pos - pos);
+        }
+
+        if constexpr (fused) {
+            integrate_boid<rules>(id, dv, constants);
+        }
+        else {
+            m_delta_vel[id] = dv;
+        }
+    }
+}
+
+template <uint32_t rules>
+void BoidCollection::integrate_range(const RuleConstants& constants, size_t low_index, size_t high_index)
+{
+    for (size_t id = low_index; id < high_index; id++) {
+        integrate_boid<rules>(id, m_delta_vel[id], constants);
+    }
+}
+
+template <uint32_t rules>
+inline void BoidCollection::integrate_boid(size_t id, V2 dv, const RuleConstants& constants)
+{
+    const bool* toggles = constants.toggles;
+
+    if (rule_enabled<rules>(toggles, RT_GRAVITY)) dv.y += constants.gravity_step;
+
+    // a random walk: the kick scales with the square root of the time step, so the spread it
+    // causes over a given time doesn't depend on dt. drawn from the boid's id and the step, so
+    // it's the same no matter which thread integrates the boid or where it is stored.
+    if (rule_enabled<rules>(toggles, RT_RANDOM_NOISE)) {
+        const V2 kick = CounterRng::unit_disc(m_noise_rng.bits(m_step, m_ids[id]));
+        dv += constants.noise_scale * kick;
+    }
+
+    const float force_magnitude = dv.magnitude();
+    if (force_magnitude > constants.max_force) {
+        dv *= constants.max_force / force_magnitude;
+    }
+
+    V2& vel = m_vel[id];
+    vel += dv;
+    vel = clamp(vel, constants.max_speed);
+
+    V2& pos = m_pos[id];
+    pos = pos + constants.dt * vel;
+
+    if (!WinProps::is_boid_onscreen(pos, m_domain_span)) {
+        // respawn at a spot picked from the seed, the step and the boid's id, so that boids
+        // leaving in the same step don't all pile up in one grid node
+        pos = respawn_position(m_respawn_rng, m_step, m_ids[id], m_domain_span);
+        vel = {10.f, 10.f};
+    }
+}
+
+template <typename Grid>
+void BoidCollection::update(float dt, const SpeciesRules& species, Grid& grid)
+{
+    assert(species.species_count == species_count());
+
+    if (m_reorder_interval > 0 && m_step % m_reorder_interval == 0) {
+        reorder();
+    }
+
+    m_step++;
+
+    const bool place = m_place_pages && !m_pages_placed;
+    if (place) {
+        for (UninitializedVector<V2>* vec : {&m_pos, &m_vel, &m_delta_vel}) place_pages(m_scheduler, *vec);
+        place_pages(m_scheduler, m_ids);
+        place_pages(m_scheduler, m_indices);
+    }
+
+    grid.insert(*this, m_scheduler);
+
+    // the grid may have reallocated on the first insert at this population, so place it after
+    if (place) {
+        grid.place_pages(m_scheduler);
+        m_pages_placed = true;
+    }
+
+    if (m_fused_integration) {
+        compute_forces_and_integrate(dt, species, grid);
+    }
+    else {
+        compute_forces(species, grid);
+        integrate(dt, species);
+    }
+}
+
+template <typename Grid>
+void BoidCollection::force_pass(const SpeciesRules& species, const Grid& grid, float dt, bool fused)
+{
+    m_thread_busy.resize(m_scheduler.thread_count());
+    for (BusyTime& busy : m_thread_busy) busy.seconds = 0.0;
+
+    auto seconds_since = [](steady_clock::time_point start) {
+        return duration_cast<duration<double>>(steady_clock::now() - start).count();
+    };
+
+    // the kernels of each species are picked once for the whole pass
+    RuleKernel kernels[SpeciesRules::max_species];
+    RuleConstants constants[SpeciesRules::max_species];
+    bool gather[SpeciesRules::max_species];
+    for (size_t s = 0; s < species.species_count; s++) {
+        const Rules& params = species.rules[s];
+        kernels[s] = rule_kernel(params, fused);
+        constants[s] = RuleConstants(params, m_domain_span, dt);
+        const bool uses_neighbors = (rule_mask(params, s_force_rule_count) & s_neighbor_rules) != 0;
+        gather[s] = m_rule_dispatch == RD_BRANCHING || uses_neighbors;
+    }
+
+    auto timed_piece = [&](size_t low, size_t high) {
+        const auto piece_start = steady_clock::now();
+        for_each_species_span(low, high, [&](size_t s, size_t span_low, size_t span_high) {
+            if (species.unweighted(s)) {
+                this->update_thread<false>(species, s, grid, span_low, span_high, kernels[s], constants[s],
+                                           gather[s]);
+            }
+            else {
+                this->update_thread<true>(species, s, grid, span_low, span_high, kernels[s], constants[s],
+                                          gather[s]);
+            }
+        });
+        m_thread_busy[Scheduler::current_thread_index()].seconds += seconds_since(piece_start);
+    };
+
+    const auto pass_start = steady_clock::now();
+
+    if (m_load_balancing == LB_DYNAMIC) {
+        parallel_for(m_scheduler, 0, m_count, s_force_grain, timed_piece);
+    }
+    else {
+        parallel_for_ranges(m_scheduler, m_count,
+                            [&](size_t, size_t low, size_t high) { timed_piece(low, high); });
+    }
+
+    m_force_balance.wall_seconds = seconds_since(pass_start);
+    m_force_balance.busiest_seconds = 0.0;
+    m_force_balance.mean_busy_seconds = 0.0;
+    for (const BusyTime& busy : m_thread_busy) {
+        m_force_balance.busiest_seconds = std::max(m_force_balance.busiest_seconds, busy.seconds);
+        m_force_balance.mean_busy_seconds += busy.seconds / m_thread_busy.size();
+    }
+}
+
+template <typename Grid>
+void BoidCollection::compute_forces(const SpeciesRules& species, const Grid& grid)
+{
+    assert(species.species_count == species_count());
+
+    if (m_delta_vel.size() != m_count) {
+        m_delta_vel.resize(m_count);
+        if (m_place_pages) place_pages(m_scheduler, m_delta_vel);
+    }
+    force_pass(species, grid, 0.f, false);
+}
+
+void BoidCollection::integrate(float dt, const SpeciesRules& species)
+{
+    assert(m_delta_vel.size() == m_count && species.species_count == species_count());
+
+    IntegrateKernel kernels[SpeciesRules::max_species];
+    RuleConstants constants[SpeciesRules::max_species];
+    for (size_t s = 0; s < species.species_count; s++) {
+        kernels[s] = integrate_kernel(species.rules[s]);
+        constants[s] = RuleConstants(species.rules[s], m_domain_span, dt);
+    }
+
+    parallel_for(m_scheduler, 0, m_count, s_stream_grain, [&](size_t low, size_t high) {
+        for_each_species_span(low, high, [&](size_t s, size_t span_low, size_t span_high) {
+            (this->*kernels[s])(constants[s], span_low, span_high);
+        });
+    });
+}
+
+// the force pass only reads other boids through the grid's node-sorted copy of pos/vel,
+// which stays untouched until the next insert. that copy acts as the front buffer, so each
+// boid can be integrated in place as soon as its own force is known.
+template <typename Grid>
+void BoidCollection::compute_forces_and_integrate(float dt, const SpeciesRules& species, const Grid& grid)
+{
+    assert(species.species_count == species_count());
+    force_pass(species, grid, dt, true);
+}
+
+template void BoidCollection::update(float dt, const SpeciesRules& species, QuadTree& grid);
+template void BoidCollection::update(float dt, const SpeciesRules& species, SparseGrid& grid);
+template void BoidCollection::update(float dt, const SpeciesRules& species, NeighborList& grid);
+template void BoidCollection::compute_forces(const SpeciesRules& species, const QuadTree& grid);
+template void BoidCollection::compute_forces(const SpeciesRules& species, const SparseGrid& grid);
+template void BoidCollection::compute_forces(const SpeciesRules& species, const NeighborList& grid);
+template void BoidCollection::compute_forces_and_integrate(float dt, const SpeciesRules& species,
+                                                          const QuadTree& grid);
+template void BoidCollection::compute_forces_and_integrate(float dt, const SpeciesRules& species,
+                                                          const SparseGrid& grid);
+template void BoidCollection::compute_forces_and_integrate(float dt, const SpeciesRules& species,
+                                                          const NeighborList& grid);
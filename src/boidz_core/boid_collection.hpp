@@ -0,0 +1,460 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "distribution.hpp"
+#include "force_kernel.hpp"
+#include "parallel.hpp"
+#include "quad_tree.hpp"
+#include "random.hpp"
+#include "scheduler.hpp"
+#include "topology.hpp"
+#include "v2.hpp"
+
+class QuadTree;
+
+enum RuleType {
+    RT_CENTER_OF_MASS,
+    RT_DENSITY,
+    RT_CONFINE,
+    RT_AVERAGE_VELOCITY,
+    RT_GRAVITY,
+    RT_RANDOM_NOISE,
+    RT_MAX_FORCE,
+    RT_MAX_VELOCITY,
+    RT_COUNT
+};
+
+static constexpr const char* RULE_NAMES_NOSPACE[RT_COUNT] = {
+    "Center_Of_Mass", "Density",      "Confine",   "Average_Velocity",
+    "Gravity",        "Random_Noise", "Max_Force", "Max_Speed"};
+
+static constexpr const char* RULE_NAMES[RT_COUNT] = {"Center Of Mass",   "Density",      "Confine",
+                                                     "Average Velocity", "Gravity",      "Random Noise",
+                                                     "Maximum Force",    "Maximum Speed"};
+
+struct Rules {
+    float values[RT_COUNT] = {
+        10.f,  // Center Of Mass
+        10.f,  // Density
+        10.f,  // Confine
+        10.f,  // Average Velocity
+        10.f,  // Gravity
+        10.f,  // Random Noise
+        10.f,  // Maximum Force
+        10.f,  // Maximum Velocity
+    };
+
+    bool toggles[RT_COUNT] = {
+        true,  // Center Of Mass
+        true,  // Density
+        true,  // Confine
+        true,  // Average Velocity
+        true,  // Gravity
+        true,  // Random Noise
+        true,  // Maximum Force
+        true,  // Maximum Velocity
+    };
+};
+
+// how boids of one species treat neighbors of another
+struct SpeciesInteraction {
+    float flocking = 1.f;    // weight of such a neighbor in the averages center of mass and
+                             // average velocity steer towards
+    float separation = 1.f;  // scale of the push away from such a neighbor (the density rule)
+};
+
+// the rules of every species in a collection, and how the species react to each other
+struct SpeciesRules {
+    static constexpr size_t max_species = 8;
+
+    size_t species_count = 1;
+    Rules rules[max_species];
+    SpeciesInteraction interactions[max_species][max_species];  // [species][neighbor's species]
+
+    SpeciesRules(void) = default;
+
+    // species_count species following the same rules, each treating the others as its own
+    explicit SpeciesRules(const Rules& shared, size_t count = 1) : species_count(count)
+    {
+        assert(count >= 1 && count <= max_species);
+        for (Rules& r : rules) r = shared;
+    }
+
+    // bit b is set if species takes neighbors of species b into account at all
+    inline uint32_t neighbor_mask(size_t species) const
+    {
+        uint32_t mask = 0;
+        for (size_t b = 0; b < species_count; b++) {
+            const SpeciesInteraction& interaction = interactions[species][b];
+            if (interaction.flocking != 0.f || interaction.separation != 0.f) mask |= 1u << b;
+        }
+        return mask;
+    }
+
+    // whether species weighs every species it takes into account by one
+    inline bool unweighted(size_t species) const
+    {
+        for (size_t b = 0; b < species_count; b++) {
+            const SpeciesInteraction& interaction = interactions[species][b];
+            const bool ignored = interaction.flocking == 0.f && interaction.separation == 0.f;
+            if (!ignored && (interaction.flocking != 1.f || interaction.separation != 1.f)) return false;
+        }
+        return true;
+    }
+};
+
+// how the rules are applied: RD_SPECIALIZED runs one of the kernels compiled for every
+// combination of rule toggles, picked once per step and species, so a disabled rule costs
+// nothing. RD_BRANCHING runs one kernel that checks the toggles for every boid. both give the
+// same results, the second is there to measure the first against.
+enum RuleDispatch { RD_SPECIALIZED, RD_BRANCHING, RD_COUNT };
+
+static constexpr const char* RULE_DISPATCH_NAMES[RD_COUNT] = {"specialized", "branching"};
+
+// how the force pass is spread over the threads: LB_STATIC hands each thread one equal share of
+// the boid indices, LB_DYNAMIC splits the boids into small pieces that idle threads steal, so
+// threads that got a dense (expensive) part of the flock don't hold everybody else up
+enum LoadBalancing { LB_STATIC, LB_DYNAMIC, LB_COUNT };
+
+static constexpr const char* LOAD_BALANCING_NAMES[LB_COUNT] = {"static", "dynamic"};
+
+// per thread busy time of the last force pass, against its wall clock time
+struct LoadBalanceStats {
+    double wall_seconds = 0.0;
+    double busiest_seconds = 0.0;
+    double mean_busy_seconds = 0.0;
+
+    // busiest thread over the average one, 1 is perfectly balanced
+    inline double imbalance(void) const
+    {
+        return mean_busy_seconds > 0.0 ? busiest_seconds / mean_busy_seconds : 1.0;
+    }
+
+    // share of the available thread time spent waiting instead of working
+    inline double idle_fraction(void) const
+    {
+        return wall_seconds > 0.0 ? std::max(0.0, 1.0 - mean_busy_seconds / wall_seconds) : 0.0;
+    }
+};
+
+// a boid on its way from one collection to another, see BoidCollection::remove_boids
+struct MigratingBoid {
+    uint32_t id;
+    V2 pos;
+    V2 vel;
+};
+
+class BoidCollection {
+    // the population's positions and velocities, followed by those of the ghosts
+    UninitializedVector<V2> m_pos;
+    UninitializedVector<V2> m_vel;
+
+    // summed velocity change from the neighbor rules, only used when integration
+    // runs as a separate pass after the force pass
+    UninitializedVector<V2> m_delta_vel;
+
+    // stable identity of the boid stored at each index, and the index of each id. indices
+    // change whenever the population is reordered, ids never do
+    UninitializedVector<uint32_t> m_ids;
+    UninitializedVector<uint32_t> m_indices;
+
+    // scratch space for reorder, kept around to avoid reallocating every time
+    UninitializedVector<uint32_t> m_sort_keys[2];
+    UninitializedVector<uint32_t> m_sort_order[2];
+    UninitializedVector<V2> m_reorder_buffer;
+
+    // seconds spent in force pass pieces by each thread, padded so threads don't share lines
+    struct alignas(64) BusyTime {
+        double seconds = 0.0;
+    };
+    std::vector<BusyTime> m_thread_busy;
+    LoadBalanceStats m_force_balance;
+    LoadBalancing m_load_balancing = LB_DYNAMIC;
+
+    // set once the threads are pinned: the per boid arrays (and the grid's) are then moved to
+    // pages first touched by the thread working on them, whenever they may have been reallocated
+    bool m_place_pages = false;
+    bool m_pages_placed = false;
+
+    size_t m_count = 0;
+    size_t m_ghost_count = 0;
+
+    // species s owns the indices [m_species_offsets[s], m_species_offsets[s + 1]), the last
+    // entry being m_count
+    std::vector<size_t> m_species_offsets = {0, 0};
+    size_t m_step = 0;
+    float m_domain_span = WinProps::boid_span;
+    uint64_t m_order_version = 0;
+    uint64_t m_seed = 0;
+    CounterRng m_respawn_rng = CounterRng(0, RS_RESPAWN);
+    CounterRng m_noise_rng = CounterRng(0, RS_NOISE);
+    size_t m_reorder_interval = 0;
+    bool m_fused_integration = true;
+    bool m_deterministic = false;
+    KernelIsa m_kernel_isa = best_kernel_isa();
+    RuleDispatch m_rule_dispatch = RD_SPECIALIZED;
+
+    Scheduler m_scheduler;
+
+    // split [low_index, high_index) where one species ends and the next begins, calling
+    // span(species, low, high) for each part in turn
+    template <typename Span>
+    inline void for_each_species_span(size_t low_index, size_t high_index, Span&& span) const
+    {
+        for (size_t s = species_of(low_index); low_index < high_index; s++) {
+            const size_t end = std::min(high_index, m_species_offsets[s + 1]);
+            span(s, low_index, end);
+            low_index = end;
+        }
+    }
+
+    // the rule values of one species and step, in the form the kernels use them
+    struct RuleConstants;
+
+    // rule kernels, instantiated for a mask of the toggles of the rules below RT_MAX_FORCE
+    // (bit rt for rule rt), or for s_branching_rules to check the toggles at runtime instead.
+    // apply_rules turns count boids' neighbor sums into their velocity change, integrating it
+    // right away if fused, integrate_range integrates the velocity changes of a force pass.
+    using RuleKernel = void (BoidCollection::*)(const RuleConstants& constants, size_t first_id, size_t count,
+                                                const NeighborSums* sums);
+    using IntegrateKernel = void (BoidCollection::*)(const RuleConstants& constants, size_t low_index,
+                                                     size_t high_index);
+
+    static constexpr uint32_t s_branching_rules = 1u << RT_COUNT;
+
+    template <uint32_t rules, bool fused>
+    void apply_rules(const RuleConstants& constants, size_t first_id, size_t count, const NeighborSums* sums);
+    template <uint32_t rules>
+    void integrate_range(const RuleConstants& constants, size_t low_index, size_t high_index);
+    template <uint32_t rules>
+    void integrate_boid(size_t id, V2 dv, const RuleConstants& constants);
+
+    template <bool fused, size_t... masks>
+    static constexpr std::array<RuleKernel, sizeof...(masks)> rule_kernels(std::index_sequence<masks...>);
+    template <size_t... masks>
+    static constexpr std::array<IntegrateKernel, sizeof...(masks)> integrate_kernels(
+        std::index_sequence<masks...>);
+
+    RuleKernel rule_kernel(const Rules& params, bool fused) const;
+    IntegrateKernel integrate_kernel(const Rules& params) const;
+
+    // weighted sums the neighbors of each species apart and weighs them by the interactions of
+    // species_index. without, they go straight into one sum, for species that treat all the
+    // species they see alike. gather does the neighbor search, which can be skipped when no rule
+    // uses its sums
+    template <bool weighted, typename Grid>
+    void update_thread(const SpeciesRules& species, size_t species_index, const Grid& grid, size_t low_index,
+                       size_t high_index, RuleKernel kernel, const RuleConstants& constants, bool gather);
+    void clear_ghosts(void);
+    template <typename Grid>
+    void force_pass(const SpeciesRules& species, const Grid& grid, float dt, bool fused);
+
+public:
+    BoidCollection(void);
+    BoidCollection(size_t new_boid_count, const Distribution& init_pos, const Distribution& init_vel,
+                   size_t thread_count = std::thread::hardware_concurrency());
+
+    // a fresh population of new_boid_count boids, drawn from the distributions in parallel
+    void reset(size_t new_boid_count, const Distribution& init_pos, const Distribution& init_vel);
+
+    // the same with several species, species_counts[s] boids of species s. each species is
+    // stored contiguously, in species order, and stays that way.
+    void reset(const std::vector<size_t>& species_counts, const Distribution& init_pos,
+               const Distribution& init_vel);
+
+    // replace the whole state with count boids copied from pos, vel and ids (ids[i] being the
+    // id of the boid at index i, a permutation of 0 .. count - 1), continuing from step with
+    // seed. the copy is spread over the simulation threads. returns false, leaving the
+    // collection empty, if ids isn't a permutation. the restored boids are all of one species.
+    bool restore(size_t count, const V2* pos, const V2* vel, const uint32_t* ids, size_t step, uint64_t seed);
+
+    // move every boid for which leave(pos) is true out of the collection, appending it to
+    // removed. the boids that stay keep their order. with add_boids this lets several collections
+    // share one population, each holding the boids of its own part of the domain, the ids then
+    // being unique over all of them rather than a permutation of 0 .. population() - 1. only
+    // for collections of a single species, like set_ghosts and add_boids.
+    template <typename Leave>
+    void remove_boids(Leave&& leave, std::vector<MigratingBoid>& removed);
+
+    // append count boids after those already there. none of their ids may be in the collection.
+    void add_boids(const MigratingBoid* boids, size_t count);
+
+    // copies of count boids that belong to some other collection, for the grids to insert as
+    // neighbors of this collection's own boids. they are stored after the population in
+    // positions() and velocities(), and take no part in anything else: they feel no forces, never
+    // move, and are left out of reorder and state_hash. they last until the next set_ghosts, or
+    // until boids are added, removed, reset or restored.
+    void set_ghosts(size_t count, const V2* pos, const V2* vel);
+
+    // grid is a QuadTree, a SparseGrid or a NeighborList, the three these are instantiated for.
+    // species has to cover the collection's species, the overloads taking Rules apply them to
+    // every species.
+    template <typename Grid>
+    void update(float dt, const SpeciesRules& species, Grid& grid);
+    template <typename Grid>
+    void update(float dt, const Rules& params, Grid& grid)
+    {
+        update(dt, SpeciesRules(params, species_count()), grid);
+    }
+
+    // the individual stages of update, exposed separately so they can be timed on their own
+    template <typename Grid>
+    void compute_forces(const SpeciesRules& species, const Grid& grid);
+    void integrate(float dt, const SpeciesRules& species);
+    template <typename Grid>
+    void compute_forces_and_integrate(float dt, const SpeciesRules& species, const Grid& grid);
+
+    template <typename Grid>
+    void compute_forces(const Rules& params, const Grid& grid)
+    {
+        compute_forces(SpeciesRules(params, species_count()), grid);
+    }
+    void integrate(float dt, const Rules& params) { integrate(dt, SpeciesRules(params, species_count())); }
+    template <typename Grid>
+    void compute_forces_and_integrate(float dt, const Rules& params, const Grid& grid)
+    {
+        compute_forces_and_integrate(dt, SpeciesRules(params, species_count()), grid);
+    }
+
+    // side length of the square the boids live in, [0, span) on both axes (WinProps::boid_span
+    // by default). the confine rule pushes boids back from its edges, boids that leave it anyway
+    // respawn inside, and the grids pick the new span up on their next insert.
+    inline void set_domain_span(float span)
+    {
+        assert(span > 0.f);
+        m_domain_span = span;
+    }
+    inline float domain_span(void) const { return m_domain_span; }
+
+    // seeds everything the simulation picks at random, like the noise rule and where boids that
+    // left the domain reappear
+    inline void set_seed(uint64_t seed)
+    {
+        m_seed = seed;
+        m_respawn_rng = CounterRng(seed, RS_RESPAWN);
+        m_noise_rng = CounterRng(seed, RS_NOISE);
+    }
+    inline uint64_t seed(void) const { return m_seed; }
+
+    // number of updates since the last reset or restore. together with the seed this is all
+    // the random state there is, every random pick is a CounterRng draw keyed by the two.
+    inline size_t step(void) const { return m_step; }
+
+    // permute every per boid array into Morton order of the boid positions, so that boids
+    // which are close in space are also close in memory. ids are carried along, and each
+    // species is sorted on its own, keeping its place in the storage.
+    void reorder(void);
+
+    // run reorder at the start of every interval'th update, 0 (the default) never reorders
+    inline void set_reorder_interval(size_t interval) { m_reorder_interval = interval; }
+    inline size_t reorder_interval(void) const { return m_reorder_interval; }
+
+    // integrate each boid right after computing its force (default), instead of
+    // storing the velocity change and integrating everything in a second pass
+    inline void set_fused_integration(bool fused) { m_fused_integration = fused; }
+    inline bool fused_integration(void) const { return m_fused_integration; }
+
+    // pin the simulation threads to cpus of topology, one numa node after the other, and from then
+    // on keep each thread's share of the boid and grid arrays in memory first touched by that
+    // thread. returns false where pinning isn't supported, the collection then runs as before.
+    bool pin_threads(const Topology& topology);
+    inline const std::vector<int>& pinned_cpus(void) const { return m_scheduler.pinned_cpus(); }
+
+    inline void set_load_balancing(LoadBalancing lb) { m_load_balancing = lb; }
+    inline LoadBalancing load_balancing(void) const { return m_load_balancing; }
+
+    inline void set_rule_dispatch(RuleDispatch dispatch) { m_rule_dispatch = dispatch; }
+    inline RuleDispatch rule_dispatch(void) const { return m_rule_dispatch; }
+
+    // how evenly the last force pass (fused or not) kept the threads busy
+    inline const LoadBalanceStats& force_balance(void) const { return m_force_balance; }
+
+    // instruction set used by the force kernel, the best one the cpu supports by default.
+    // the vector kernels only differ from the scalar one by floating point rounding
+    inline void set_kernel_isa(KernelIsa isa)
+    {
+        assert(kernel_isa_supported(isa));
+        m_kernel_isa = isa;
+    }
+    inline KernelIsa kernel_isa(void) const { return m_deterministic ? KI_SCALAR : m_kernel_isa; }
+
+    // the same seed, settings and initial state always give bit for bit the same states, no
+    // matter the number of threads: every boid's force is summed in the grid's order, which
+    // doesn't depend on how the boids were split up, and every random draw is keyed by step
+    // and id. what can still differ between machines is the force kernel, since the vector
+    // kernels round differently than the scalar one and not every cpu has every kernel.
+    // deterministic mode runs the scalar kernel no matter what set_kernel_isa asked for.
+    inline void set_deterministic(bool deterministic) { m_deterministic = deterministic; }
+    inline bool deterministic(void) const { return m_deterministic; }
+
+    // 64 bit hash of the step, and the ids, positions and velocities in storage order. cheap
+    // enough to take after every step, to find the first one where two runs part ways.
+    uint64_t state_hash(void) const;
+
+    // result of the last compute_forces, the velocity change of each boid before integration
+    inline const UninitializedVector<V2>& velocity_changes(void) const { return m_delta_vel; }
+
+    inline size_t population(void) const { return m_count; }
+    inline size_t species_count(void) const { return m_species_offsets.size() - 1; }
+    // species_count() + 1 entries, species s owning the indices [offsets[s], offsets[s + 1])
+    inline const std::vector<size_t>& species_offsets(void) const { return m_species_offsets; }
+    inline size_t species_of(size_t index) const
+    {
+        return std::upper_bound(m_species_offsets.begin() + 1, m_species_offsets.end() - 1, index) -
+               (m_species_offsets.begin() + 1);
+    }
+    inline size_t ghost_count(void) const { return m_ghost_count; }
+    // boids the grids insert, the population followed by the ghosts
+    inline size_t grid_population(void) const { return m_count + m_ghost_count; }
+    inline size_t thread_count(void) const { return m_scheduler.thread_count(); }
+    inline const UninitializedVector<V2>& positions(void) const { return m_pos; }
+    inline const UninitializedVector<V2>& velocities(void) const { return m_vel; }
+
+    // id of the boid currently stored at index. ids run from 0 to population() - 1, unless
+    // boids were removed or added since the last reset or restore
+    inline const UninitializedVector<uint32_t>& ids(void) const { return m_ids; }
+    inline uint32_t id_of(size_t index) const { return m_ids[index]; }
+    inline size_t index_of(uint32_t id) const { return m_indices[id]; }
+
+    // changes whenever boids move to different indices (reset, restore, reorder and removing
+    // or adding boids), so a copy of ids() only needs refreshing when this differs from the one
+    // it was taken at
+    inline uint64_t order_version(void) const { return m_order_version; }
+};
+
+template <typename Leave>
+void BoidCollection::remove_boids(Leave&& leave, std::vector<MigratingBoid>& removed)
+{
+    assert(species_count() == 1);
+    clear_ghosts();
+
+    size_t kept = 0;
+    for (size_t i = 0; i < m_count; i++) {
+        const uint32_t id = m_ids[i];
+        if (leave(m_pos[i])) {
+            removed.push_back({id, m_pos[i], m_vel[i]});
+            m_indices[id] = UINT32_MAX;
+            continue;
+        }
+
+        m_pos[kept] = m_pos[i];
+        m_vel[kept] = m_vel[i];
+        m_ids[kept] = id;
+        m_indices[id] = static_cast<uint32_t>(kept);
+        kept++;
+    }
+
+    if (kept == m_count) return;
+
+    for (UninitializedVector<V2>* vec : {&m_pos, &m_vel}) vec->resize(kept);
+    m_ids.resize(kept);
+    m_count = kept;
+    m_species_offsets.back() = kept;
+    m_order_version++;
+}
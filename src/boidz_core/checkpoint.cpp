@@ -0,0 +1,106 @@
+#include "checkpoint.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "mapped_file.hpp"
+
+static constexpr char s_checkpoint_magic[8] = {'B', 'O', 'I', 'D', 'Z', 'C', 'K', 'P'};
+
+CheckpointStatus save_checkpoint(const char* path, const BoidCollection& boids, const Rules& params,
+                                 const QuadTree& grid)
+{
+    if (boids.species_count() > 1) return CS_SEVERAL_SPECIES;
+
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, s_checkpoint_magic, sizeof(header.magic));
+    header.version = s_checkpoint_version;
+    header.byte_order = s_checkpoint_byte_order;
+    header.data_offset = s_checkpoint_data_offset;
+    header.population = boids.population();
+    header.step = boids.step();
+    header.seed = boids.seed();
+    header.nodes_per_axis = grid.nodes_per_axis();
+    header.effect_radius_squared = grid.effect_radius_squared();
+    header.opening_angle = grid.opening_angle();
+    header.compact_storage = grid.compact_storage() ? 1 : 0;
+    header.node_cap = grid.node_cap();
+    header.domain_span = boids.domain_span();
+    header.rule_count = RT_COUNT;
+    for (int rt = 0; rt < RT_COUNT; rt++) {
+        header.rule_toggles[rt] = params.toggles[rt] ? 1 : 0;
+        header.rule_values[rt] = params.values[rt];
+    }
+
+    const std::string temp_path = std::string(path) + ".tmp";
+    FILE* file = fopen(temp_path.c_str(), "wb");
+    if (!file) return CS_OPEN_FAILED;
+
+    const size_t count = boids.population();
+    std::vector<char> padding(s_checkpoint_data_offset - sizeof(header), 0);
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    written = written && fwrite(padding.data(), 1, padding.size(), file) == padding.size();
+    written = written && fwrite(boids.positions().data(), sizeof(V2), count, file) == count;
+    written = written && fwrite(boids.velocities().data(), sizeof(V2), count, file) == count;
+    written = written && fwrite(boids.ids().data(), sizeof(uint32_t), count, file) == count;
+    written = fclose(file) == 0 && written;
+
+    if (!written || rename(temp_path.c_str(), path) != 0) {
+        remove(temp_path.c_str());
+        return CS_WRITE_FAILED;
+    }
+
+    return CS_OK;
+}
+
+CheckpointStatus load_checkpoint(const char* path, BoidCollection& boids, Rules& params, QuadTree& grid)
+{
+    MappedFile file;
+    if (!file.open(path)) return CS_OPEN_FAILED;
+
+    CheckpointHeader header;
+    if (file.size() < sizeof(header)) return CS_NOT_A_CHECKPOINT;
+    memcpy(&header, file.data(), sizeof(header));
+
+    if (memcmp(header.magic, s_checkpoint_magic, sizeof(header.magic)) != 0) return CS_NOT_A_CHECKPOINT;
+    if (header.byte_order == __builtin_bswap32(s_checkpoint_byte_order)) return CS_WRONG_BYTE_ORDER;
+    if (header.version != s_checkpoint_version || header.byte_order != s_checkpoint_byte_order ||
+        header.rule_count != RT_COUNT) {
+        return CS_WRONG_VERSION;
+    }
+
+    if (header.data_offset < sizeof(header) || header.population > UINT32_MAX || header.nodes_per_axis < 2 ||
+        !(header.effect_radius_squared >= 0.f) || !(header.opening_angle >= 0.f) ||
+        !(header.domain_span > 0.f)) {
+        return CS_CORRUPT;
+    }
+
+    const size_t count = header.population;
+    const size_t data_bytes = count * (2 * sizeof(V2) + sizeof(uint32_t));
+    if (file.size() < header.data_offset + data_bytes) return CS_TRUNCATED;
+
+    const char* data = file.data() + header.data_offset;
+    const V2* pos = reinterpret_cast<const V2*>(data);
+    const V2* vel = reinterpret_cast<const V2*>(data + count * sizeof(V2));
+    const uint32_t* ids = reinterpret_cast<const uint32_t*>(data + 2 * count * sizeof(V2));
+
+    if (!boids.restore(count, pos, vel, ids, header.step, header.seed)) return CS_CORRUPT;
+    boids.set_domain_span(header.domain_span);
+
+    grid = QuadTree(header.nodes_per_axis);
+    grid.set_effect_radius_squared(header.effect_radius_squared);
+    grid.set_opening_angle(header.opening_angle);
+    grid.set_compact_storage(header.compact_storage != 0);
+    grid.set_node_cap(header.node_cap);
+
+    for (int rt = 0; rt < RT_COUNT; rt++) {
+        params.toggles[rt] = header.rule_toggles[rt] != 0;
+        params.values[rt] = header.rule_values[rt];
+    }
+
+    return CS_OK;
+}
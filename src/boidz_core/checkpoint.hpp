@@ -0,0 +1,73 @@
+#pragma once
+
+#include "boid_collection.hpp"
+#include "quad_tree.hpp"
+
+// a checkpoint is everything needed to continue a simulation exactly where it left off: the
+// boids (positions, velocities and ids, in their current order), the rules, the domain, the
+// grid settings and the step counter and seed, which are all the random state there is.
+//
+// layout (native byte order, version 2):
+//   CheckpointHeader, zero padded to s_checkpoint_data_offset
+//   V2 positions[population]
+//   V2 velocities[population]
+//   uint32_t ids[population]
+// the arrays start on a page boundary, so restoring maps the file and copies them straight
+// into the collection without any parsing. the header's byte_order field tells files written
+// with the other byte order apart, and those are refused rather than converted.
+
+enum CheckpointStatus {
+    CS_OK,
+    CS_OPEN_FAILED,
+    CS_WRITE_FAILED,
+    CS_NOT_A_CHECKPOINT,
+    CS_WRONG_VERSION,
+    CS_WRONG_BYTE_ORDER,
+    CS_TRUNCATED,
+    CS_CORRUPT,
+    CS_SEVERAL_SPECIES,
+    CS_COUNT
+};
+
+static constexpr const char* CHECKPOINT_STATUS_NAMES[CS_COUNT] = {
+    "ok", "can't open file", "write failed", "not a checkpoint", "unsupported version",
+    "written with the other byte order", "truncated", "corrupt", "several species"};
+
+static constexpr uint32_t s_checkpoint_version = 2;
+static constexpr uint32_t s_checkpoint_byte_order = 0x01020304;
+static constexpr size_t s_checkpoint_data_offset = 4096;
+
+struct CheckpointHeader {
+    char magic[8];  // "BOIDZCKP"
+    uint32_t version;
+    uint32_t byte_order;  // s_checkpoint_byte_order
+    uint32_t data_offset;
+    uint64_t population;
+    uint64_t step;
+    uint64_t seed;
+
+    int32_t nodes_per_axis;
+    float effect_radius_squared;
+    float opening_angle;
+    uint32_t compact_storage;
+    uint64_t node_cap;
+
+    uint32_t rule_count;  // RT_COUNT when written, the rules below only fit an equal one
+    uint8_t rule_toggles[RT_COUNT];
+    float rule_values[RT_COUNT];
+
+    float domain_span;
+};
+
+static_assert(sizeof(CheckpointHeader) <= s_checkpoint_data_offset, "header must fit before the data");
+static_assert(sizeof(V2) == 2 * sizeof(float), "positions and velocities are stored as float pairs");
+
+// writes to a temporary file next to path and renames it into place once complete, so an
+// interrupted save never clobbers the previous checkpoint. there is one set of rules in the
+// file, so collections of several species are refused with CS_SEVERAL_SPECIES.
+CheckpointStatus save_checkpoint(const char* path, const BoidCollection& boids, const Rules& params,
+                                 const QuadTree& grid);
+
+// replaces boids, params and grid with the checkpoint's. on failure they are left untouched,
+// except for a corrupt id table, which leaves boids empty (see BoidCollection::restore).
+CheckpointStatus load_checkpoint(const char* path, BoidCollection& boids, Rules& params, QuadTree& grid);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <random>
+#include <vector>
+
+#include "parallel.hpp"
+#include "props.hpp"
+#include "random.hpp"
+#include "scheduler.hpp"
+#include "v2.hpp"
+
+// a distribution of points in the plane, drawn from a CounterRng. samples are numbered and the
+// index'th one only depends on the seed and the index, so any number of threads can draw a
+// population at once (see fill) and it always comes out the same.
+class Distribution {
+protected:
+    CounterRng m_rng;
+
+    Distribution(void) : m_rng(std::random_device()()) {}
+    Distribution(uint64_t seed) : m_rng(seed) {}
+
+public:
+    virtual ~Distribution(void) = default;
+
+    virtual V2 sample(uint64_t index) const = 0;
+
+    // out[i] = sample(first_index + i) for i < count, spread over the scheduler's threads
+    void fill(Scheduler& scheduler, V2* out, size_t count, uint64_t first_index = 0) const
+    {
+        parallel_for(scheduler, 0, count, s_fill_grain, [&](size_t low, size_t high) {
+            for (size_t i = low; i < high; i++) out[i] = sample(first_index + i);
+        });
+    }
+
+private:
+    static constexpr size_t s_fill_grain = 16384;
+};
+
+class UniformDistribution : public Distribution {
+    V2 m_low;
+    V2 m_extent;
+
+public:
+    UniformDistribution(void) = delete;
+
+    UniformDistribution(float x_low, float x_high, float y_low, float y_high)
+        : Distribution(), m_low{x_low, y_low}, m_extent{x_high - x_low, y_high - y_low}
+    {
+    }
+
+    UniformDistribution(float x_low, float x_high, float y_low, float y_high, uint64_t seed)
+        : Distribution(seed), m_low{x_low, y_low}, m_extent{x_high - x_low, y_high - y_low}
+    {
+    }
+
+    V2 sample(uint64_t index) const final
+    {
+        const V2 u = CounterRng::unit_square(m_rng.bits(index));
+        return {m_low.x + m_extent.x * u.x, m_low.y + m_extent.y * u.y};
+    }
+};
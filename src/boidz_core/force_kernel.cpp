@@ -0,0 +1,326 @@
+#include "force_kernel.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BOIDZ_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+// every kernel is written once for both NodeSpan and CompactNodeSpan, the only difference
+// being how members are loaded. compact members are decoded with the same single multiply as
+// CompactEncoding, so the compact kernels agree with each other up to rounding just the same.
+// positions are loaded along with the span's pos_step, which float spans just ignore.
+static inline float pos_step(const NodeSpan&) { return 1.f; }
+static inline float pos_step(const CompactNodeSpan& node) { return node.pos_step; }
+
+template <typename Span>
+static void accumulate_node_scalar(float px, float py, float radius_sq, const Span& node, NeighborSums& sums)
+{
+    for (size_t i = 0; i < node.count; i++) {
+        accumulate_neighbor(px, py, radius_sq, node.x(i), node.y(i), node.vx(i), node.vy(i), 1.f, sums);
+    }
+}
+
+#ifdef BOIDZ_X86_KERNELS
+
+// The vector kernels keep one partial sum per lane and only reduce them at the end of the
+// node, so the additions happen in a different order than in the scalar kernel and the
+// results differ from it by rounding only. Members outside the effect radius are masked
+// out with a bitwise and, which also zeroes the 1 / separation of the boid itself (inf).
+
+__attribute__((target("sse2"))) static inline float hsum_sse2(__m128 v)
+{
+    const __m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+    const __m128 sums = _mm_add_ps(v, shuf);
+    return _mm_cvtss_f32(_mm_add_ss(sums, _mm_movehl_ps(shuf, sums)));
+}
+
+__attribute__((target("sse2"))) static inline __m128 load4(const float* p, float = 0.f)
+{
+    return _mm_loadu_ps(p);
+}
+
+// sse2 has no 16 to 32 bit extension, so interleave with zeros (unsigned) or with the value
+// itself and shift the copy back down (signed)
+__attribute__((target("sse2"))) static inline __m128 load4(const uint16_t* p, float step)
+{
+    const __m128i q = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+    const __m128 values = _mm_cvtepi32_ps(_mm_unpacklo_epi16(q, _mm_setzero_si128()));
+    return _mm_mul_ps(_mm_set1_ps(step), values);
+}
+
+__attribute__((target("sse2"))) static inline __m128 load4(const int16_t* p)
+{
+    const __m128i q = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+    const __m128 values = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(q, q), 16));
+    return _mm_mul_ps(_mm_set1_ps(CompactEncoding::vel_step), values);
+}
+
+template <typename Span>
+__attribute__((target("sse2"))) static void accumulate_node_sse2(float px, float py, float radius_sq,
+                                                                const Span& node, NeighborSums& sums)
+{
+    const __m128 vpx = _mm_set1_ps(px);
+    const __m128 vpy = _mm_set1_ps(py);
+    const __m128 vradius_sq = _mm_set1_ps(radius_sq);
+    const __m128 vmin_sep = _mm_set1_ps(1e-7f);
+    const __m128 one = _mm_set1_ps(1.f);
+
+    __m128 pos_x = _mm_setzero_ps(), pos_y = _mm_setzero_ps();
+    __m128 vel_x = _mm_setzero_ps(), vel_y = _mm_setzero_ps();
+    __m128 weight = _mm_setzero_ps();
+    __m128 dens_x = _mm_setzero_ps(), dens_y = _mm_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 4 <= node.count; i += 4) {
+        const __m128 x = load4(node.pos_x + i, pos_step(node));
+        const __m128 y = load4(node.pos_y + i, pos_step(node));
+        const __m128 dx = _mm_sub_ps(vpx, x);
+        const __m128 dy = _mm_sub_ps(vpy, y);
+        const __m128 separation = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+
+        const __m128 in_range = _mm_cmplt_ps(separation, vradius_sq);
+        pos_x = _mm_add_ps(pos_x, _mm_and_ps(in_range, x));
+        pos_y = _mm_add_ps(pos_y, _mm_and_ps(in_range, y));
+        vel_x = _mm_add_ps(vel_x, _mm_and_ps(in_range, load4(node.vel_x + i)));
+        vel_y = _mm_add_ps(vel_y, _mm_and_ps(in_range, load4(node.vel_y + i)));
+        weight = _mm_add_ps(weight, _mm_and_ps(in_range, one));
+
+        const __m128 dense = _mm_and_ps(in_range, _mm_cmpgt_ps(separation, vmin_sep));
+        const __m128 density_weight = _mm_and_ps(dense, _mm_div_ps(one, separation));
+        dens_x = _mm_add_ps(dens_x, _mm_mul_ps(density_weight, dx));
+        dens_y = _mm_add_ps(dens_y, _mm_mul_ps(density_weight, dy));
+    }
+
+    sums.pos_x += hsum_sse2(pos_x);
+    sums.pos_y += hsum_sse2(pos_y);
+    sums.vel_x += hsum_sse2(vel_x);
+    sums.vel_y += hsum_sse2(vel_y);
+    sums.weight += hsum_sse2(weight);
+    sums.dens_x += hsum_sse2(dens_x);
+    sums.dens_y += hsum_sse2(dens_y);
+
+    for (; i < node.count; i++) {
+        accumulate_neighbor(px, py, radius_sq, node.x(i), node.y(i), node.vx(i), node.vy(i), 1.f, sums);
+    }
+}
+
+__attribute__((target("avx2"))) static inline float hsum_avx2(__m256 v)
+{
+    const __m128 halves = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    const __m128 shuf = _mm_shuffle_ps(halves, halves, _MM_SHUFFLE(2, 3, 0, 1));
+    const __m128 sums = _mm_add_ps(halves, shuf);
+    return _mm_cvtss_f32(_mm_add_ss(sums, _mm_movehl_ps(shuf, sums)));
+}
+
+__attribute__((target("avx2"))) static inline __m256 load8(const float* p, float = 0.f)
+{
+    return _mm256_loadu_ps(p);
+}
+
+__attribute__((target("avx2"))) static inline __m256 load8(const uint16_t* p, float step)
+{
+    const __m128i q = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m256 values = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(q));
+    return _mm256_mul_ps(_mm256_set1_ps(step), values);
+}
+
+__attribute__((target("avx2"))) static inline __m256 load8(const int16_t* p)
+{
+    const __m128i q = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m256 values = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(q));
+    return _mm256_mul_ps(_mm256_set1_ps(CompactEncoding::vel_step), values);
+}
+
+template <typename Span>
+__attribute__((target("avx2"))) static void accumulate_node_avx2(float px, float py, float radius_sq,
+                                                                const Span& node, NeighborSums& sums)
+{
+    const __m256 vpx = _mm256_set1_ps(px);
+    const __m256 vpy = _mm256_set1_ps(py);
+    const __m256 vradius_sq = _mm256_set1_ps(radius_sq);
+    const __m256 vmin_sep = _mm256_set1_ps(1e-7f);
+    const __m256 one = _mm256_set1_ps(1.f);
+
+    __m256 pos_x = _mm256_setzero_ps(), pos_y = _mm256_setzero_ps();
+    __m256 vel_x = _mm256_setzero_ps(), vel_y = _mm256_setzero_ps();
+    __m256 weight = _mm256_setzero_ps();
+    __m256 dens_x = _mm256_setzero_ps(), dens_y = _mm256_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 8 <= node.count; i += 8) {
+        const __m256 x = load8(node.pos_x + i, pos_step(node));
+        const __m256 y = load8(node.pos_y + i, pos_step(node));
+        const __m256 dx = _mm256_sub_ps(vpx, x);
+        const __m256 dy = _mm256_sub_ps(vpy, y);
+        const __m256 separation = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+
+        const __m256 in_range = _mm256_cmp_ps(separation, vradius_sq, _CMP_LT_OQ);
+        pos_x = _mm256_add_ps(pos_x, _mm256_and_ps(in_range, x));
+        pos_y = _mm256_add_ps(pos_y, _mm256_and_ps(in_range, y));
+        vel_x = _mm256_add_ps(vel_x, _mm256_and_ps(in_range, load8(node.vel_x + i)));
+        vel_y = _mm256_add_ps(vel_y, _mm256_and_ps(in_range, load8(node.vel_y + i)));
+        weight = _mm256_add_ps(weight, _mm256_and_ps(in_range, one));
+
+        const __m256 dense = _mm256_and_ps(in_range, _mm256_cmp_ps(separation, vmin_sep, _CMP_GT_OQ));
+        const __m256 density_weight = _mm256_and_ps(dense, _mm256_div_ps(one, separation));
+        dens_x = _mm256_add_ps(dens_x, _mm256_mul_ps(density_weight, dx));
+        dens_y = _mm256_add_ps(dens_y, _mm256_mul_ps(density_weight, dy));
+    }
+
+    sums.pos_x += hsum_avx2(pos_x);
+    sums.pos_y += hsum_avx2(pos_y);
+    sums.vel_x += hsum_avx2(vel_x);
+    sums.vel_y += hsum_avx2(vel_y);
+    sums.weight += hsum_avx2(weight);
+    sums.dens_x += hsum_avx2(dens_x);
+    sums.dens_y += hsum_avx2(dens_y);
+
+    for (; i < node.count; i++) {
+        accumulate_neighbor(px, py, radius_sq, node.x(i), node.y(i), node.vx(i), node.vy(i), 1.f, sums);
+    }
+}
+
+// the Skylake-X subset: foundation plus the 8/16 bit (bw) and 128/256 bit (vl) masked instructions
+#define BOIDZ_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vl")))
+
+// (_mm512_reduce_add_ps trips a bogus -Wuninitialized in some gcc versions)
+BOIDZ_TARGET_AVX512 static inline float hsum_avx512(__m512 v)
+{
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, v);
+    return hsum_avx2(_mm256_add_ps(_mm256_load_ps(lanes), _mm256_load_ps(lanes + 8)));
+}
+
+// loads the values at p in mask, zeroing the other lanes. (the conversions are masked as well,
+// the unmasked ones trip the same warning as _mm512_reduce_add_ps)
+BOIDZ_TARGET_AVX512 static inline __m512 load16(const float* p, __mmask16 mask, float = 0.f)
+{
+    return _mm512_maskz_loadu_ps(mask, p);
+}
+
+BOIDZ_TARGET_AVX512 static inline __m512 load16(const uint16_t* p, __mmask16 mask, float step)
+{
+    const __m512i bits = _mm512_maskz_cvtepu16_epi32(mask, _mm256_maskz_loadu_epi16(mask, p));
+    return _mm512_mul_ps(_mm512_set1_ps(step), _mm512_maskz_cvtepi32_ps(mask, bits));
+}
+
+BOIDZ_TARGET_AVX512 static inline __m512 load16(const int16_t* p, __mmask16 mask)
+{
+    const __m512i bits = _mm512_maskz_cvtepi16_epi32(mask, _mm256_maskz_loadu_epi16(mask, p));
+    return _mm512_mul_ps(_mm512_set1_ps(CompactEncoding::vel_step), _mm512_maskz_cvtepi32_ps(mask, bits));
+}
+
+// with AVX-512 the tail of the node is handled with masked loads instead of a scalar loop
+template <typename Span>
+BOIDZ_TARGET_AVX512 static void accumulate_node_avx512(float px, float py, float radius_sq, const Span& node,
+                                                       NeighborSums& sums)
+{
+    const __m512 vpx = _mm512_set1_ps(px);
+    const __m512 vpy = _mm512_set1_ps(py);
+    const __m512 vradius_sq = _mm512_set1_ps(radius_sq);
+    const __m512 vmin_sep = _mm512_set1_ps(1e-7f);
+    const __m512 one = _mm512_set1_ps(1.f);
+
+    __m512 pos_x = _mm512_setzero_ps(), pos_y = _mm512_setzero_ps();
+    __m512 vel_x = _mm512_setzero_ps(), vel_y = _mm512_setzero_ps();
+    __m512 weight = _mm512_setzero_ps();
+    __m512 dens_x = _mm512_setzero_ps(), dens_y = _mm512_setzero_ps();
+
+    for (size_t i = 0; i < node.count; i += 16) {
+        const size_t remaining = node.count - i;
+        const __mmask16 lanes = remaining >= 16 ? 0xFFFF : static_cast<__mmask16>((1u << remaining) - 1);
+
+        const __m512 x = load16(node.pos_x + i, lanes, pos_step(node));
+        const __m512 y = load16(node.pos_y + i, lanes, pos_step(node));
+        const __m512 dx = _mm512_sub_ps(vpx, x);
+        const __m512 dy = _mm512_sub_ps(vpy, y);
+        const __m512 separation = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+
+        const __mmask16 in_range = _mm512_mask_cmp_ps_mask(lanes, separation, vradius_sq, _CMP_LT_OQ);
+        pos_x = _mm512_mask_add_ps(pos_x, in_range, pos_x, x);
+        pos_y = _mm512_mask_add_ps(pos_y, in_range, pos_y, y);
+        vel_x = _mm512_mask_add_ps(vel_x, in_range, vel_x, load16(node.vel_x + i, in_range));
+        vel_y = _mm512_mask_add_ps(vel_y, in_range, vel_y, load16(node.vel_y + i, in_range));
+        weight = _mm512_mask_add_ps(weight, in_range, weight, one);
+
+        const __mmask16 dense = _mm512_mask_cmp_ps_mask(in_range, separation, vmin_sep, _CMP_GT_OQ);
+        const __m512 density_weight = _mm512_maskz_div_ps(dense, one, separation);
+        dens_x = _mm512_mask_add_ps(dens_x, dense, dens_x, _mm512_mul_ps(density_weight, dx));
+        dens_y = _mm512_mask_add_ps(dens_y, dense, dens_y, _mm512_mul_ps(density_weight, dy));
+    }
+
+    sums.pos_x += hsum_avx512(pos_x);
+    sums.pos_y += hsum_avx512(pos_y);
+    sums.vel_x += hsum_avx512(vel_x);
+    sums.vel_y += hsum_avx512(vel_y);
+    sums.weight += hsum_avx512(weight);
+    sums.dens_x += hsum_avx512(dens_x);
+    sums.dens_y += hsum_avx512(dens_y);
+}
+
+#endif  // BOIDZ_X86_KERNELS
+
+bool kernel_isa_supported(KernelIsa isa)
+{
+    switch (isa) {
+        case KI_SCALAR:
+            return true;
+#ifdef BOIDZ_X86_KERNELS
+        case KI_SSE2:
+            return __builtin_cpu_supports("sse2");
+        case KI_AVX2:
+            return __builtin_cpu_supports("avx2");
+        case KI_AVX512:
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+                   __builtin_cpu_supports("avx512vl");
+#endif
+        default:
+            return false;
+    }
+}
+
+KernelIsa best_kernel_isa(void)
+{
+    for (int isa = KI_COUNT - 1; isa > KI_SCALAR; isa--) {
+        if (kernel_isa_supported(static_cast<KernelIsa>(isa))) {
+            return static_cast<KernelIsa>(isa);
+        }
+    }
+    return KI_SCALAR;
+}
+
+NodeKernel node_kernel(KernelIsa isa)
+{
+    assert(kernel_isa_supported(isa));
+
+    switch (isa) {
+#ifdef BOIDZ_X86_KERNELS
+        case KI_SSE2:
+            return accumulate_node_sse2<NodeSpan>;
+        case KI_AVX2:
+            return accumulate_node_avx2<NodeSpan>;
+        case KI_AVX512:
+            return accumulate_node_avx512<NodeSpan>;
+#endif
+        default:
+            return accumulate_node_scalar<NodeSpan>;
+    }
+}
+
+CompactNodeKernel compact_node_kernel(KernelIsa isa)
+{
+    assert(kernel_isa_supported(isa));
+
+    switch (isa) {
+#ifdef BOIDZ_X86_KERNELS
+        case KI_SSE2:
+            return accumulate_node_sse2<CompactNodeSpan>;
+        case KI_AVX2:
+            return accumulate_node_avx2<CompactNodeSpan>;
+        case KI_AVX512:
+            return accumulate_node_avx512<CompactNodeSpan>;
+#endif
+        default:
+            return accumulate_node_scalar<CompactNodeSpan>;
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "quad_tree.hpp"
+
+// instruction sets the force kernel has been written for. all but KI_SCALAR are only
+// available on x86 and are picked at runtime depending on what the cpu supports. KI_AVX512
+// needs the bw and vl extensions on top of the foundation, as every AVX-512 cpu but Xeon Phi has.
+enum KernelIsa { KI_SCALAR, KI_SSE2, KI_AVX2, KI_AVX512, KI_COUNT };
+
+static constexpr const char* KERNEL_ISA_NAMES[KI_COUNT] = {"scalar", "sse2", "avx2", "avx512"};
+
+// running sums of the neighbor rules for a single boid
+struct NeighborSums {
+    float pos_x = 0.f;
+    float pos_y = 0.f;
+    float vel_x = 0.f;
+    float vel_y = 0.f;
+    float weight = 0.f;
+    float dens_x = 0.f;
+    float dens_y = 0.f;
+};
+
+// accumulates every member of node closer than sqrt(radius_sq) to (px, py) into sums,
+// each with a weight of one
+using NodeKernel = void (*)(float px, float py, float radius_sq, const NodeSpan& node, NeighborSums& sums);
+
+// the same, for a grid in compact storage mode
+using CompactNodeKernel = void (*)(float px, float py, float radius_sq, const CompactNodeSpan& node,
+                                   NeighborSums& sums);
+
+bool kernel_isa_supported(KernelIsa isa);
+KernelIsa best_kernel_isa(void);
+
+// the node kernel for isa, which must be supported by this cpu
+NodeKernel node_kernel(KernelIsa isa);
+CompactNodeKernel compact_node_kernel(KernelIsa isa);
+
+inline void accumulate_neighbor(float px, float py, float radius_sq, float x, float y, float vx, float vy,
+                                float weight, NeighborSums& sums)
+{
+    const float dx = px - x;
+    const float dy = py - y;
+    const float separation = dx * dx + dy * dy;
+
+    if (separation < radius_sq) {
+        sums.pos_x += weight * x;
+        sums.pos_y += weight * y;
+        sums.vel_x += weight * vx;
+        sums.vel_y += weight * vy;
+        sums.weight += weight;
+
+        if (separation > 1e-7) {
+            const float density_weight = weight / separation;
+            sums.dens_x += density_weight * dx;
+            sums.dens_y += density_weight * dy;
+        }
+    }
+}
+
+inline void accumulate_pseudoboid(float px, float py, float radius_sq, const PseudoBoid& pb, NeighborSums& sums)
+{
+    accumulate_neighbor(px, py, radius_sq, pb.pos.x, pb.pos.y, pb.vel.x, pb.vel.y, pb.weight, sums);
+}
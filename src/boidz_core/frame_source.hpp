@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "boid_collection.hpp"
+#include "v2.hpp"
+
+// boid positions to draw or analyze, whether they come from a running simulation or from a
+// recording. only the order of a single frame is meaningful, consumers mustn't assume that a
+// boid keeps its index from one frame to the next.
+class FrameSource {
+public:
+    virtual ~FrameSource(void) = default;
+
+    virtual size_t population(void) const = 0;
+
+    // simulation step the current frame was taken at
+    virtual uint64_t step(void) const = 0;
+
+    // population() positions of the current frame
+    virtual const V2* positions(void) const = 0;
+
+    // side length of the square domain the positions lie in
+    virtual float domain_span(void) const = 0;
+};
+
+// the current state of a simulation, straight from its arrays
+class SimulationFrames final : public FrameSource {
+    const BoidCollection& m_boids;
+
+public:
+    explicit SimulationFrames(const BoidCollection& boids) : m_boids(boids) {}
+
+    size_t population(void) const override { return m_boids.population(); }
+    uint64_t step(void) const override { return m_boids.step(); }
+    const V2* positions(void) const override { return m_boids.positions().data(); }
+    float domain_span(void) const override { return m_boids.domain_span(); }
+};
@@ -0,0 +1,91 @@
+#include "mapped_file.hpp"
+
+#include <stdio.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define BOIDZ_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+void MappedFile::close(void)
+{
+#ifdef BOIDZ_HAVE_MMAP
+    if (m_mapped) munmap(const_cast<char*>(m_data), m_size);
+#endif
+
+    m_buffer.clear();
+    m_buffer.shrink_to_fit();
+    m_data = nullptr;
+    m_size = 0;
+    m_mapped = false;
+    m_open = false;
+}
+
+bool MappedFile::open(const char* path, bool populate)
+{
+    close();
+
+#ifdef BOIDZ_HAVE_MMAP
+    const int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    m_size = static_cast<size_t>(info.st_size);
+
+    // mmap refuses empty mappings, but an empty file is still a file
+    if (m_size > 0) {
+        int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+        // fault the whole file in with one call instead of one page at a time
+        if (populate) flags |= MAP_POPULATE;
+#endif
+        void* mapping = mmap(nullptr, m_size, PROT_READ, flags, fd, 0);
+        if (mapping == MAP_FAILED) {
+            ::close(fd);
+            m_size = 0;
+            return false;
+        }
+
+        m_data = static_cast<const char*>(mapping);
+        m_mapped = true;
+    }
+
+    // the mapping stays valid after the descriptor is gone
+    ::close(fd);
+#else
+    // the whole file is read either way
+    (void)populate;
+
+    FILE* file = fopen(path, "rb");
+    if (!file) return false;
+
+    bool read_ok = fseek(file, 0, SEEK_END) == 0;
+    const long length = read_ok ? ftell(file) : -1;
+    read_ok = length >= 0 && fseek(file, 0, SEEK_SET) == 0;
+
+    if (read_ok) {
+        m_buffer.resize(static_cast<size_t>(length));
+        read_ok = fread(m_buffer.data(), 1, m_buffer.size(), file) == m_buffer.size();
+    }
+    fclose(file);
+
+    if (!read_ok) {
+        m_buffer.clear();
+        return false;
+    }
+
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+#endif
+
+    m_open = true;
+    return true;
+}
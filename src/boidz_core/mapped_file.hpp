@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <vector>
+
+// read-only view of a whole file. on posix systems the file is mapped into memory, so nothing
+// is read until it is touched (and pages the kernel already has cached are never copied at
+// all). elsewhere it falls back to reading the file into a buffer.
+class MappedFile {
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    bool m_mapped = false;
+    bool m_open = false;
+    std::vector<char> m_buffer;
+
+    void close(void);
+
+public:
+    MappedFile(void) = default;
+    ~MappedFile(void) { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // replaces whatever was open before. returns false if the file can't be opened or read.
+    // populate reads the whole file in up front, which is fastest when all of it is needed
+    // right away. without it pages are only read once touched.
+    bool open(const char* path, bool populate = true);
+
+    inline bool is_open(void) const { return m_open; }
+    inline const char* data(void) const { return m_data; }
+    inline size_t size(void) const { return m_size; }
+};
@@ -0,0 +1,259 @@
+#include "neighbor_list.hpp"
+
+#include "boid_collection.hpp"
+#include "parallel.hpp"
+
+static inline float distance_squared(V2 a, V2 b)
+{
+    const V2 d = a - b;
+    return d.x * d.x + d.y * d.y;
+}
+
+NeighborList::NeighborList(void)
+    : NeighborList(WinProps::boid_span / 128.f, skin_lasting(Rules().values[RT_MAX_VELOCITY], 1.f / 60.f))
+{
+}
+
+bool NeighborList::same_boids(const BoidCollection& boids) const
+{
+    return m_built && m_built_population == boids.population() &&
+           m_built_members == boids.grid_population() &&
+           m_built_order_version == boids.order_version() &&
+           m_built_species_offsets == boids.species_offsets() &&
+           m_built_domain_span == boids.domain_span() &&
+           m_built_reach == std::sqrt(m_radius_squared) + m_skin && m_built_node_cap == m_node_cap;
+}
+
+// every insert copies the members, and the lists are only built again once some boid moved
+// more than half the skin away from where it was at the last rebuild. the aggregates of crowded
+// cells move along with their members, so they are reduced again every time.
+void NeighborList::insert(const BoidCollection& boids, Scheduler& scheduler)
+{
+    const UninitializedVector<V2>& positions = boids.positions();
+    const UninitializedVector<V2>& velocities = boids.velocities();
+    const size_t member_count = boids.grid_population();
+    const size_t thread_count = scheduler.thread_count();
+
+    m_stats.inserts++;
+    m_members.resize(member_count);
+    m_range_displacements.assign(thread_count, 0.f);
+
+    const bool same = same_boids(boids);
+
+    parallel_for_ranges(scheduler, member_count, [&](size_t r, size_t low, size_t high) {
+        float largest = 0.f;
+        for (size_t i = low; i < high; i++) {
+            m_members[i] = {positions[i], velocities[i]};
+            if (same) largest = std::max(largest, distance_squared(positions[i], m_built_pos[i]));
+        }
+        m_range_displacements[r] = largest;
+    });
+
+    bool moved_too_far = false;
+    const float half_skin = 0.5f * m_skin;
+    for (float displacement : m_range_displacements) moved_too_far |= displacement > half_skin * half_skin;
+
+    if (!same || moved_too_far) {
+        if (same) m_stats.displacement_rebuilds++;
+        rebuild(boids, scheduler);
+    }
+
+    reduce_crowds(scheduler);
+}
+
+// the lists are built in two steps:
+//   1. the members are sorted into cells of at least the effect radius plus the skin by a
+//      counting sort, which is cheap next to the lists and runs on the calling thread
+//   2. each thread walks its own range of boids, collecting the members of the 3x3 cells around
+//      each boid that are within reach of it, or the crowded cell when it has too many. the
+//      ranges are then joined into one array, each at the sum of the entries before it
+void NeighborList::rebuild(const BoidCollection& boids, Scheduler& scheduler)
+{
+    const UninitializedVector<V2>& positions = boids.positions();
+    const size_t population = boids.population();
+    const size_t member_count = boids.grid_population();
+    const size_t thread_count = scheduler.thread_count();
+    const std::vector<size_t>& species_offsets = boids.species_offsets();
+    assert(member_count < s_crowded_entry);
+
+    m_species_count = boids.species_count();
+    const size_t species_count = m_species_count;
+    m_species_ends.assign(species_offsets.begin() + 1, species_offsets.end());
+    m_species_ends.back() = SIZE_MAX;
+
+    const float span = boids.domain_span();
+    const float reach = std::sqrt(m_radius_squared) + m_skin;
+    const float reach_squared = reach * reach;
+    m_cells_per_axis = std::max(1, std::min(s_max_cells_per_axis, static_cast<int>(span / reach)));
+    const int cells_per_axis = m_cells_per_axis;
+    const float cell_span = span / static_cast<float>(cells_per_axis);
+    const size_t bucket_count = static_cast<size_t>(cells_per_axis) * cells_per_axis * species_count;
+
+    auto cell_coordinate = [=](float x) {
+        return std::min(cells_per_axis - 1, std::max(0, static_cast<int>(std::floor(x / cell_span))));
+    };
+
+    // ghosts count as the last species, the only one a collection with ghosts has
+    m_member_buckets.resize(member_count);
+    m_bucket_offsets.assign(bucket_count + 1, 0);
+    size_t species = 0;
+    for (size_t i = 0; i < member_count; i++) {
+        while (i >= m_species_ends[species]) species++;
+        const size_t cell = static_cast<size_t>(cells_per_axis) * cell_coordinate(positions[i].y) +
+                            cell_coordinate(positions[i].x);
+        const uint32_t bucket = static_cast<uint32_t>(cell * species_count + species);
+        m_member_buckets[i] = bucket;
+        m_bucket_offsets[bucket + 1]++;
+    }
+
+    m_bucket_crowds.assign(bucket_count, s_not_crowded);
+    m_crowded_buckets.clear();
+    for (size_t b = 0; b < bucket_count; b++) {
+        if (m_node_cap > 0 && m_bucket_offsets[b + 1] > m_node_cap) {
+            m_bucket_crowds[b] = static_cast<uint32_t>(m_crowded_buckets.size());
+            m_crowded_buckets.push_back(static_cast<uint32_t>(b));
+        }
+        m_bucket_offsets[b + 1] += m_bucket_offsets[b];
+    }
+
+    // the cursors are the bucket offsets moved along by one, starting over from the front
+    m_cell_members.resize(member_count);
+    for (size_t i = 0; i < member_count; i++) {
+        m_cell_members[m_bucket_offsets[m_member_buckets[i]]++] = static_cast<uint32_t>(i);
+    }
+    for (size_t b = bucket_count; b > 0; b--) m_bucket_offsets[b] = m_bucket_offsets[b - 1];
+    m_bucket_offsets[0] = 0;
+
+    m_range_entries.resize(thread_count);
+    m_range_totals.assign(thread_count, 0);
+    m_list_offsets.resize(population + 1);
+
+    parallel_for_ranges(scheduler, population, [&](size_t r, size_t low, size_t high) {
+        std::vector<uint32_t>& entries = m_range_entries[r];
+        size_t used = 0;
+
+        for (size_t i = low; i < high; i++) {
+            m_list_offsets[i] = used;
+
+            const V2 pos = positions[i];
+            const int focus_x = cell_coordinate(pos.x);
+            const int focus_y = cell_coordinate(pos.y);
+            const int low_x = std::max(0, focus_x - 1);
+            const int high_x = std::min(cells_per_axis - 1, focus_x + 1);
+            const int low_y = std::max(0, focus_y - 1);
+            const int high_y = std::min(cells_per_axis - 1, focus_y + 1);
+
+            // every candidate is written, and only kept by moving on past it when it is within
+            // reach, which the branch predictor couldn't guess. so there has to be room for all
+            // the candidates of a row, and for its crowded cells.
+            for (size_t s = 0; s < species_count; s++) {
+                for (int y = low_y; y <= high_y; y++) {
+                    const size_t row = static_cast<size_t>(cells_per_axis) * y;
+                    size_t room = used + (high_x - low_x + 1);
+                    for (int x = low_x; x <= high_x; x++) {
+                        const size_t bucket = (row + x) * species_count + s;
+                        room += m_bucket_offsets[bucket + 1] - m_bucket_offsets[bucket];
+                    }
+                    if (entries.size() < room) entries.resize(std::max(2 * entries.size(), room));
+                    uint32_t* out = entries.data();
+
+                    for (int x = low_x; x <= high_x; x++) {
+                        const size_t bucket = (row + x) * species_count + s;
+                        if (m_bucket_crowds[bucket] != s_not_crowded) {
+                            out[used++] = s_crowded_entry | m_bucket_crowds[bucket];
+                            continue;
+                        }
+
+                        const size_t end = m_bucket_offsets[bucket + 1];
+                        for (size_t m = m_bucket_offsets[bucket]; m < end; m++) {
+                            const uint32_t member = m_cell_members[m];
+                            out[used] = member;
+                            used += distance_squared(positions[member], pos) < reach_squared ? 1 : 0;
+                        }
+                    }
+                }
+            }
+        }
+
+        m_range_totals[r] = used;
+    });
+
+    size_t entry_count = 0;
+    for (size_t total : m_range_totals) entry_count += total;
+    m_entries.resize(entry_count);
+    m_list_offsets[population] = entry_count;
+
+    parallel_for_ranges(scheduler, population, [&](size_t r, size_t low, size_t high) {
+        size_t offset = 0;
+        for (size_t i = 0; i < r; i++) {
+            offset += m_range_totals[i];
+        }
+
+        for (size_t i = low; i < high; i++) m_list_offsets[i] += offset;
+        std::copy(m_range_entries[r].begin(), m_range_entries[r].begin() + m_range_totals[r],
+                  m_entries.begin() + offset);
+    });
+
+    m_built_pos.assign(positions.begin(), positions.begin() + member_count);
+    m_built = true;
+    m_built_population = population;
+    m_built_members = member_count;
+    m_built_order_version = boids.order_version();
+    m_built_species_offsets = species_offsets;
+    m_built_domain_span = span;
+    m_built_reach = reach;
+    m_built_node_cap = m_node_cap;
+
+    m_stats.rebuilds++;
+    m_stats.entries_built += entry_count;
+    m_stats.lists_built += population;
+}
+
+// the aggregates of the crowded cells, over the members found in them at the last rebuild
+void NeighborList::reduce_crowds(Scheduler& scheduler)
+{
+    m_crowded_pseudoboids.resize(m_crowded_buckets.size());
+
+    parallel_for_ranges(scheduler, m_crowded_buckets.size(), [&](size_t, size_t low, size_t high) {
+        for (size_t c = low; c < high; c++) {
+            const size_t bucket = m_crowded_buckets[c];
+            const size_t begin = m_bucket_offsets[bucket];
+            const size_t end = m_bucket_offsets[bucket + 1];
+
+            V2 pos_sum = V2::null();
+            V2 vel_sum = V2::null();
+            for (size_t m = begin; m < end; m++) {
+                const Member& member = m_members[m_cell_members[m]];
+                pos_sum += member.pos;
+                vel_sum += member.vel;
+            }
+
+            const float count = static_cast<float>(end - begin);
+            m_crowded_pseudoboids[c] = PseudoBoid(pos_sum / count, vel_sum / count, count);
+        }
+    });
+}
+
+void NeighborList::place_pages(Scheduler& scheduler)
+{
+    ::place_pages(scheduler, m_members);
+    ::place_pages(scheduler, m_list_offsets);
+    ::place_pages(scheduler, m_built_pos);
+}
+
+size_t NeighborList::memory_bytes(void) const
+{
+    size_t bytes = m_members.capacity() * sizeof(Member) + m_built_pos.capacity() * sizeof(V2);
+    bytes += (m_entries.capacity() + m_cell_members.capacity() + m_bucket_crowds.capacity() +
+              m_crowded_buckets.capacity() + m_member_buckets.capacity()) *
+             sizeof(uint32_t);
+    bytes += (m_list_offsets.capacity() + m_bucket_offsets.capacity() + m_species_ends.capacity() +
+              m_range_totals.capacity()) *
+             sizeof(size_t);
+    for (const std::vector<uint32_t>& entries : m_range_entries) {
+        bytes += entries.capacity() * sizeof(uint32_t);
+    }
+    bytes += m_crowded_pseudoboids.capacity() * sizeof(PseudoBoid);
+    bytes += m_range_displacements.capacity() * sizeof(float);
+    return bytes;
+}
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "parallel.hpp"
+#include "quad_tree.hpp"
+#include "scheduler.hpp"
+#include "v2.hpp"
+
+class BoidCollection;
+
+// what the inserts of a NeighborList did, summed since it was made (or since reset_stats)
+struct NeighborListStats {
+    uint64_t inserts = 0;
+    uint64_t rebuilds = 0;               // inserts that built the lists again, for any reason
+    uint64_t displacement_rebuilds = 0;  // of those, because a boid had moved more than half the skin
+    uint64_t entries_built = 0;          // list entries, summed over the rebuilds
+    uint64_t lists_built = 0;            // boids given a list, summed over the rebuilds
+
+    // inserts the lists were reused for on average, the rebuild included
+    inline double steps_per_rebuild(void) const
+    {
+        return rebuilds > 0 ? static_cast<double>(inserts) / rebuilds : 0.0;
+    }
+
+    inline double mean_list_length(void) const
+    {
+        return lists_built > 0 ? static_cast<double>(entries_built) / lists_built : 0.0;
+    }
+};
+
+// verlet lists: every boid's neighbors within the effect radius plus a skin, found once and then
+// reused until some boid has moved more than half the skin since, as no two boids can have come
+// closer than the effect radius without one of them doing so. in the meantime an insert only
+// copies the boids, checking how far they went, and the force pass visits the few neighbors on a
+// boid's list instead of everything in the grid nodes around it.
+//
+// a boid's neighborhood is every boid within reach of it, one by one, where QuadTree's fixed
+// stencil sees the members of the boid's own node and only the aggregates of the nodes around
+// it. so the two can stand in for one another in BoidCollection::update, but don't give the same
+// flock. the grid's Barnes-Hut search sees the same boids once its opening angle is too small to
+// leave any cell closed. the lists are found through cells of at least the effect radius plus the
+// skin, and like the grid's nodes, cells holding more than node_cap boids of a species only count
+// as their aggregate, taken over the boids found in the cell at the last rebuild. there is no
+// Barnes-Hut search and no compact storage mode.
+class NeighborList {
+    // each boid's position and velocity as of the last insert, in boid order, the population
+    // followed by the ghosts. the force pass reads the neighbors from here rather than from the
+    // collection, so that boids can be integrated in place while others still read them
+    struct Member {
+        V2 pos;
+        V2 vel;
+    };
+    UninitializedVector<Member> m_members;
+
+    // the lists in compressed rows: the neighbors of boid i are the entries
+    // [m_list_offsets[i], m_list_offsets[i + 1]), the boid itself included. an entry is the index
+    // of a member, or s_crowded_entry | c for crowded cell c, and a boid's entries are grouped by
+    // species, in species order
+    std::vector<uint32_t> m_entries;
+    UninitializedVector<size_t> m_list_offsets;  // population + 1 entries
+
+    // the cells of the last rebuild: the bucket of each member (cell * m_species_count +
+    // species), the members sorted by bucket, and the buckets with more than node_cap members
+    // along with their aggregates
+    std::vector<uint32_t> m_member_buckets;
+    std::vector<uint32_t> m_cell_members;
+    std::vector<size_t> m_bucket_offsets;   // bucket count + 1 entries
+    std::vector<uint32_t> m_bucket_crowds;  // index of each bucket among the crowded ones, if it is
+    std::vector<uint32_t> m_crowded_buckets;
+    std::vector<PseudoBoid> m_crowded_pseudoboids;
+
+    // species s owns the members below m_species_ends[s], the last one also owning the ghosts
+    std::vector<size_t> m_species_ends;
+    size_t m_species_count = 1;
+
+    // scratch space for insert, kept around to avoid reallocating every frame
+    std::vector<std::vector<uint32_t>> m_range_entries;  // each boid range's lists, before joining
+    std::vector<size_t> m_range_totals;
+    std::vector<float> m_range_displacements;  // largest squared displacement in each boid range
+
+    // the boids the lists were built for, and where they were
+    UninitializedVector<V2> m_built_pos;
+    size_t m_built_population = 0;
+    size_t m_built_members = 0;
+    uint64_t m_built_order_version = 0;
+    std::vector<size_t> m_built_species_offsets;
+    float m_built_domain_span = 0.f;
+    float m_built_reach = 0.f;
+    size_t m_built_node_cap = 0;
+    bool m_built = false;
+
+    float m_skin;
+    float m_radius_squared;
+    size_t m_node_cap = QuadTree::s_default_node_cap;
+    int m_cells_per_axis = 0;
+    NeighborListStats m_stats;
+
+    static constexpr uint32_t s_crowded_entry = 0x80000000u;
+    static constexpr uint32_t s_not_crowded = UINT32_MAX;
+
+    // a dense array of cells, so huge domains get cells larger than needed rather than more of them
+    static constexpr int s_max_cells_per_axis = 2048;
+
+    // neighbors handed to the fine visitor at a time
+    static constexpr size_t s_gather_count = 64;
+
+    bool same_boids(const BoidCollection& boids) const;
+    void rebuild(const BoidCollection& boids, Scheduler& scheduler);
+    void reduce_crowds(Scheduler& scheduler);
+
+public:
+    // a skin lasting s_default_reuse_steps at the default Max_Speed and a 1/60 second step
+    NeighborList(void);
+
+    // the effect radius starts out at half of node_span, that of QuadTree's nodes
+    NeighborList(float node_span, float skin)
+        : m_skin(skin), m_radius_squared(0.25f * node_span * node_span)
+    {
+        assert(node_span > 0.f && skin >= 0.f);
+    }
+
+    static constexpr int s_default_reuse_steps = 2;
+
+    // the skin that lets boids no faster than max_speed reuse the lists for the given number of
+    // steps, none of them having moved more than half of it by then. an eighth of a step more
+    // keeps the rounding of the positions from getting there first. boids that leave the domain
+    // and respawn still have the lists built again.
+    static inline float skin_lasting(float max_speed, float dt, int steps = s_default_reuse_steps)
+    {
+        return 2.f * std::fabs(max_speed * dt) * (static_cast<float>(steps) + 0.125f);
+    }
+
+    // refresh the members, and build the lists again if any boid moved more than half the skin
+    // since the last time, or if the boids were reordered, added or removed, or the settings
+    // changed. the lists are built in parallel over boid ranges, joined in boid order, so they
+    // don't depend on the number of threads.
+    void insert(const BoidCollection& boids, Scheduler& scheduler);
+
+    // see QuadTree::place_pages
+    void place_pages(Scheduler& scheduler);
+
+    // the neighbors on the list of the boid at index, like QuadTree::for_each_species_neighbor
+    // does for a position. fine_visitor is called with NodeSpans of up to s_gather_count
+    // neighbors at a time, and coarse_visitor with the aggregates of crowded cells.
+    template <typename FineVisitor, typename CoarseVisitor>
+    void for_each_species_neighbor_of(size_t index, uint32_t species_mask, FineVisitor&& fine_visitor,
+                                      CoarseVisitor&& coarse_visitor) const;
+
+    float effect_radius_squared(void) const { return m_radius_squared; }
+    void set_effect_radius(float radius) { m_radius_squared = radius * radius; }
+    void set_effect_radius_squared(float radius_squared) { m_radius_squared = radius_squared; }
+
+    void set_node_cap(size_t cap) { m_node_cap = cap; }
+    size_t node_cap(void) const { return m_node_cap; }
+
+    // the aggregate of the crowded cell the boid at index was found in at the last rebuild, the
+    // very PseudoBoid the coarse visitor is called with, or nullptr when the cell isn't crowded
+    inline const PseudoBoid* crowd_of(size_t index) const
+    {
+        const uint32_t crowd = m_bucket_crowds[m_member_buckets[index]];
+        return crowd == s_not_crowded ? nullptr : &m_crowded_pseudoboids[crowd];
+    }
+
+    // how much further than the effect radius the lists reach. a larger skin rebuilds less
+    // often, but makes every list longer.
+    void set_skin(float skin)
+    {
+        assert(skin >= 0.f);
+        m_skin = skin;
+    }
+    float skin(void) const { return m_skin; }
+
+    inline const NeighborListStats& stats(void) const { return m_stats; }
+    inline void reset_stats(void) { m_stats = NeighborListStats(); }
+
+    // entries on all the lists, and the bytes the lists themselves take up
+    size_t entry_count(void) const { return m_entries.size(); }
+    size_t list_bytes(void) const
+    {
+        return m_entries.size() * sizeof(uint32_t) + m_list_offsets.size() * sizeof(size_t);
+    }
+    int cells_per_axis(void) const { return m_cells_per_axis; }
+
+    // cells of the last rebuild that only count as their aggregate
+    size_t crowded_cell_count(void) const { return m_crowded_buckets.size(); }
+
+    // bytes held by all the arrays, scratch space included
+    size_t memory_bytes(void) const;
+
+    // the members are exact copies, neighbors see a boid just where it is
+    inline V2 stored_position(V2 pos) const { return pos; }
+    inline V2 stored_velocity(V2 vel) const { return vel; }
+};
+
+template <typename FineVisitor, typename CoarseVisitor>
+void NeighborList::for_each_species_neighbor_of(size_t index, uint32_t species_mask,
+                                                FineVisitor&& fine_visitor,
+                                                CoarseVisitor&& coarse_visitor) const
+{
+    // the members on a list are scattered over m_members, so they are gathered into a short
+    // slice the node kernels can work through like the members of a grid node
+    float pos_x[s_gather_count];
+    float pos_y[s_gather_count];
+    float vel_x[s_gather_count];
+    float vel_y[s_gather_count];
+    size_t gathered = 0;
+
+    size_t species = 0;
+    bool visited = ((species_mask >> species) & 1) != 0;
+
+    auto flush = [&] {
+        if (gathered == 0) return;
+        fine_visitor(species, NodeSpan{pos_x, pos_y, vel_x, vel_y, gathered});
+        gathered = 0;
+    };
+
+    auto enter_species = [&](size_t next) {
+        if (next == species) return;
+        flush();
+        species = next;
+        visited = ((species_mask >> species) & 1) != 0;
+    };
+
+    for (size_t e = m_list_offsets[index]; e < m_list_offsets[index + 1]; e++) {
+        const uint32_t entry = m_entries[e];
+
+        if (entry & s_crowded_entry) {
+            const size_t crowd = entry & ~s_crowded_entry;
+            enter_species(m_crowded_buckets[crowd] % m_species_count);
+            if (visited) coarse_visitor(species, m_crowded_pseudoboids[crowd]);
+            continue;
+        }
+
+        size_t member_species = species;
+        while (entry >= m_species_ends[member_species]) member_species++;
+        enter_species(member_species);
+        if (!visited) continue;
+
+        const Member& member = m_members[entry];
+        pos_x[gathered] = member.pos.x;
+        pos_y[gathered] = member.pos.y;
+        vel_x[gathered] = member.vel.x;
+        vel_y[gathered] = member.vel.y;
+        if (++gathered == s_gather_count) flush();
+    }
+
+    flush();
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "scheduler.hpp"
+
+// bounds of the chunk_index'th of chunk_count contiguous chunks of [0, object_count),
+// whose sizes differ by at most one
+inline std::pair<size_t, size_t> chunk_bounds(size_t chunk_index, size_t chunk_count, size_t object_count)
+{
+    const size_t base = object_count / chunk_count;
+    const size_t rem = object_count % chunk_count;
+    const size_t low = chunk_index * base + std::min(chunk_index, rem);
+    const size_t high = low + base + (chunk_index < rem ? 1 : 0);
+    return {low, high};
+}
+
+// call fn(low, high) on disjoint pieces of [begin, end), none longer than grain, spread over
+// the scheduler's threads (including the calling one), and return once all of them are done
+template <typename F>
+void parallel_for(Scheduler& scheduler, size_t begin, size_t end, size_t grain, F&& fn)
+{
+    using Fn = std::remove_reference_t<F>;
+
+    RangeJob job;
+    job.fn = [](void* ctx, size_t low, size_t high) { (*static_cast<Fn*>(ctx))(low, high); };
+    job.ctx = const_cast<void*>(static_cast<const void*>(&fn));
+    job.grain = grain > 0 ? grain : 1;
+
+    scheduler.run(job, begin, end);
+}
+
+// call fn(chunk_index, low, high) for each of the thread_count chunk_bounds chunks of
+// [0, object_count) and wait for all of them to finish. the chunks are fixed, so passes
+// that keep per chunk state (like the grid's per chunk node counts) can rely on them.
+template <typename F>
+void parallel_for_ranges(Scheduler& scheduler, size_t object_count, F&& fn)
+{
+    const size_t chunk_count = scheduler.thread_count();
+
+    parallel_for(scheduler, 0, chunk_count, 1, [&](size_t low, size_t high) {
+        for (size_t c = low; c < high; c++) {
+            const auto bounds = chunk_bounds(c, chunk_count, object_count);
+            fn(c, bounds.first, bounds.second);
+        }
+    });
+}
+
+// an allocator whose containers leave the elements they add uninitialised unless given a value,
+// for arrays of plain data that are always written before they are read
+template <typename T>
+struct UninitializedAllocator : std::allocator<T> {
+    static_assert(std::is_trivially_copyable<T>::value && std::is_trivially_destructible<T>::value,
+                  "elements are left as they come from the allocator");
+
+    template <typename U>
+    struct rebind {
+        using other = UninitializedAllocator<U>;
+    };
+
+    UninitializedAllocator(void) = default;
+    template <typename U>
+    UninitializedAllocator(const UninitializedAllocator<U>&) noexcept
+    {}
+
+    template <typename U>
+    void construct(U*) noexcept
+    {}
+
+    template <typename U, typename... Args>
+    void construct(U* ptr, Args&&... args)
+    {
+        ::new (static_cast<void*>(ptr)) U(std::forward<Args>(args)...);
+    }
+};
+
+// the arrays place_pages can move: resizing one touches none of the new pages
+template <typename T>
+using UninitializedVector = std::vector<T, UninitializedAllocator<T>>;
+
+// move the storage of vec to fresh pages that are first touched by the threads of the
+// parallel_for_ranges chunks covering them, so that with pinned threads each chunk's share of
+// the array ends up on the numa node of the thread that usually works on it
+template <typename T>
+void place_pages(Scheduler& scheduler, UninitializedVector<T>& vec)
+{
+    // large allocations come straight from the kernel, and the resize touches none of their
+    // pages, so each chunk's pages are first touched by the copy into them
+    UninitializedVector<T> placed;
+    placed.resize(vec.size());
+
+    parallel_for_ranges(scheduler, vec.size(), [&](size_t, size_t low, size_t high) {
+        std::copy(vec.begin() + low, vec.begin() + high, placed.begin() + low);
+    });
+
+    vec.swap(placed);
+}
@@ -7,14 +7,14 @@ class WinProps {
 
     void update_(size_t new_width, size_t new_height);
 
-    inline V2 boid_to_window_coordinates_(V2 boid_pos) const
+    inline V2 boid_to_window_coordinates_(V2 boid_pos, float span) const
     {
-        assert(is_boid_onscreen(boid_pos));
+        assert(is_boid_onscreen(boid_pos, span));
 
         auto f = [](size_t x) { return static_cast<float>(x); };
 
-        const float rx = f(_sim_region_width) * (boid_pos.x * one_over_boid_span);
-        const float ry = f(_sim_region_height) * (boid_pos.y * one_over_boid_span);
+        const float rx = f(_sim_region_width) * (boid_pos.x / span);
+        const float ry = f(_sim_region_height) * (boid_pos.y / span);
 
         return {f(_sim_region_upper_left_x) + rx, f(_sim_region_upper_left_y) + ry};
     }
@@ -56,12 +56,15 @@ public:
     static int sim_region_width(void) { return s_instance._sim_region_width; }
     static int sim_region_height(void) { return s_instance._sim_region_height; }
 
+    // the default side length of the square domain the boids live in, [0, span) on both axes.
+    // simulations can run in a domain of any size (see BoidCollection::set_domain_span), the
+    // window always shows the whole of it.
     static constexpr float boid_span = 256.f;
     static constexpr float one_over_boid_span = 1.f / boid_span;
 
-    static constexpr bool is_boid_onscreen(V2 pos)
+    static constexpr bool is_boid_onscreen(V2 pos, float span = boid_span)
     {
-        return (pos.x > 0.f && pos.x < boid_span) && (pos.y > 0.f && pos.y < boid_span);
+        return (pos.x > 0.f && pos.x < span) && (pos.y > 0.f && pos.y < span);
     }
 
     static inline void update(size_t new_width, size_t new_height)
@@ -69,9 +72,9 @@ public:
         return s_instance.update_(new_width, new_height);
     }
 
-    static inline V2 boid_to_window_coordinates(V2 boid_pos)
+    static inline V2 boid_to_window_coordinates(V2 boid_pos, float span = boid_span)
     {
-        return s_instance.boid_to_window_coordinates_(boid_pos);
+        return s_instance.boid_to_window_coordinates_(boid_pos, span);
     }
 };
 
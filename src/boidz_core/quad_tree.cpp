@@ -0,0 +1,235 @@
+#include "quad_tree.hpp"
+
+#include "boid_collection.hpp"
+#include "parallel.hpp"
+
+void QuadTree::get_pseudoboid_neighbors(V2 pos, std::vector<PseudoBoid>& neighbors) const
+{
+    neighbors.clear();
+
+    for_each_neighbor(pos,
+                      [&](const auto& node) {
+                          for (size_t bid = 0; bid < node.count; bid++) {
+                              neighbors.emplace_back(V2{node.x(bid), node.y(bid)},
+                                                     V2{node.vx(bid), node.vy(bid)}, 1.f);
+                          }
+                      },
+                      [&](const PseudoBoid& pb) { neighbors.emplace_back(pb); });
+}
+
+// rebuilds the node-sorted boid arrays with a parallel counting sort:
+//   1. each thread counts the members of each bucket in its own contiguous range of boids
+//   2. the per-thread counts are prefix-summed (bucket-major, then thread) into bucket offsets
+//      and a private write cursor for every (thread, bucket) pair
+//   3. each thread scatters its boids through its own cursors, no synchronization needed
+//   4. the pseudoboids are reduced from the now dense bucket slices, split over bucket ranges
+//   5. each coarser level of the hierarchy is reduced from the level below it
+// because thread t's boids land after those of threads < t in every bucket, members keep their
+// original order inside a bucket and the result doesn't depend on the number of threads.
+//
+// the arrays are rebuilt even when few boids changed nodes. the grid holds a copy of every boid,
+// so every member is written each step either way, and keeping the buckets between steps only
+// saves the prefix sum while the slack they need makes the copies slower to write.
+void QuadTree::insert(const BoidCollection& boids, Scheduler& scheduler)
+{
+    const UninitializedVector<V2>& positions = boids.positions();
+    const UninitializedVector<V2>& velocities = boids.velocities();
+    const size_t boid_count = boids.grid_population();
+    const size_t thread_count = scheduler.thread_count();
+    m_domain_span = boids.domain_span();
+
+    // ghosts count as the last species, the only one a collection with ghosts has
+    const std::vector<size_t>& species_offsets = boids.species_offsets();
+    if (m_species_count != boids.species_count()) {
+        m_species_count = boids.species_count();
+        m_node_offsets.resize(m_node_count * m_species_count + 1);
+        m_pseudoboids.resize(m_node_count * m_species_count);
+        for (size_t level = 1; level < m_cells_per_axis.size(); level++) {
+            m_levels[level - 1].resize(m_cells_per_axis[level] * m_cells_per_axis[level] * m_species_count);
+        }
+    }
+    const size_t species_count = m_species_count;
+    const size_t bucket_count = m_node_count * species_count;
+
+    // only the arrays of the current storage mode are kept around
+    const size_t float_count = m_compact ? 0 : boid_count;
+    const size_t compact_count = m_compact ? boid_count : 0;
+    for (UninitializedVector<float>* vec : {&m_pos_x, &m_pos_y, &m_vel_x, &m_vel_y}) {
+        vec->resize(float_count);
+        if (m_compact) vec->shrink_to_fit();
+    }
+    m_compact_pos_x.resize(compact_count);
+    m_compact_pos_y.resize(compact_count);
+    m_compact_vel_x.resize(compact_count);
+    m_compact_vel_y.resize(compact_count);
+    if (!m_compact) {
+        m_compact_pos_x.shrink_to_fit();
+        m_compact_pos_y.shrink_to_fit();
+        m_compact_vel_x.shrink_to_fit();
+        m_compact_vel_y.shrink_to_fit();
+    }
+    m_boid_nodes.resize(boid_count);
+    m_node_cursors.assign(thread_count * bucket_count, 0);
+
+    parallel_for_ranges(scheduler, boid_count, [&](size_t t, size_t low, size_t high) {
+        size_t* counts = &m_node_cursors[t * bucket_count];
+        size_t species = boids.species_of(low);
+        size_t species_end = species + 1 < species_count ? species_offsets[species + 1] : SIZE_MAX;
+
+        for (size_t i = low; i < high; i++) {
+            while (i >= species_end) {
+                species++;
+                species_end = species + 1 < species_count ? species_offsets[species + 1] : SIZE_MAX;
+            }
+
+            const size_t node_index = position_to_node_index(positions[i]);
+            const int bucket = static_cast<int>(node_index * species_count + species);
+            m_boid_nodes[i] = bucket;
+            counts[bucket]++;
+        }
+    });
+
+    // bucket totals per bucket range, so that the prefix sum itself can also be split up
+    std::vector<size_t>& range_totals = m_range_totals;
+    range_totals.assign(thread_count, 0);
+
+    parallel_for_ranges(scheduler, bucket_count, [&](size_t r, size_t low, size_t high) {
+        size_t total = 0;
+        for (size_t n = low; n < high; n++) {
+            for (size_t t = 0; t < thread_count; t++) {
+                total += m_node_cursors[t * bucket_count + n];
+            }
+        }
+        range_totals[r] = total;
+    });
+
+    parallel_for_ranges(scheduler, bucket_count, [&](size_t r, size_t low, size_t high) {
+        size_t offset = 0;
+        for (size_t i = 0; i < r; i++) {
+            offset += range_totals[i];
+        }
+
+        for (size_t n = low; n < high; n++) {
+            m_node_offsets[n] = offset;
+            for (size_t t = 0; t < thread_count; t++) {
+                size_t& cursor = m_node_cursors[t * bucket_count + n];
+                const size_t count = cursor;
+                cursor = offset;
+                offset += count;
+            }
+        }
+    });
+    m_node_offsets[bucket_count] = boid_count;
+
+    parallel_for_ranges(scheduler, boid_count, [&](size_t t, size_t low, size_t high) {
+        size_t* cursors = &m_node_cursors[t * bucket_count];
+        if (m_compact) {
+            const float pos_step = CompactEncoding::pos_step(m_domain_span);
+            for (size_t i = low; i < high; i++) {
+                const size_t slot = cursors[m_boid_nodes[i]]++;
+                m_compact_pos_x[slot] = CompactEncoding::encode_pos(positions[i].x, pos_step);
+                m_compact_pos_y[slot] = CompactEncoding::encode_pos(positions[i].y, pos_step);
+                m_compact_vel_x[slot] = CompactEncoding::encode_vel(velocities[i].x);
+                m_compact_vel_y[slot] = CompactEncoding::encode_vel(velocities[i].y);
+            }
+            return;
+        }
+
+        for (size_t i = low; i < high; i++) {
+            const size_t slot = cursors[m_boid_nodes[i]]++;
+            m_pos_x[slot] = positions[i].x;
+            m_pos_y[slot] = positions[i].y;
+            m_vel_x[slot] = velocities[i].x;
+            m_vel_y[slot] = velocities[i].y;
+        }
+    });
+
+    parallel_for_ranges(scheduler, bucket_count, [&](size_t, size_t low, size_t high) {
+        for (size_t n = low; n < high; n++) {
+            const size_t begin = m_node_offsets[n];
+            const size_t end = m_node_offsets[n + 1];
+
+            if (begin == end) {
+                m_pseudoboids[n] = PseudoBoid();
+                continue;
+            }
+
+            // in compact mode from the decoded values, like everything else reading the grid
+            V2 pos_sum = V2::null();
+            V2 vel_sum = V2::null();
+            if (m_compact) {
+                const CompactNodeSpan node = compact_node_span(n);
+                for (size_t i = 0; i < node.count; i++) {
+                    pos_sum += {node.x(i), node.y(i)};
+                    vel_sum += {node.vx(i), node.vy(i)};
+                }
+            }
+            else {
+                for (size_t i = begin; i < end; i++) {
+                    pos_sum += {m_pos_x[i], m_pos_y[i]};
+                    vel_sum += {m_vel_x[i], m_vel_y[i]};
+                }
+            }
+
+            const float count = static_cast<float>(end - begin);
+            m_pseudoboids[n] = PseudoBoid(pos_sum / count, vel_sum / count, count);
+        }
+    });
+
+    for (size_t level = 1; level < m_cells_per_axis.size(); level++) {
+        const int cells = m_cells_per_axis[level];
+        const int child_cells = m_cells_per_axis[level - 1];
+
+        parallel_for_ranges(scheduler, cells * cells * species_count, [&](size_t, size_t low, size_t high) {
+            for (size_t c = low; c < high; c++) {
+                const int x = static_cast<int>(c / species_count) % cells;
+                const int y = static_cast<int>(c / species_count) / cells;
+                const size_t species = c % species_count;
+
+                V2 pos_sum = V2::null();
+                V2 vel_sum = V2::null();
+                float weight = 0.f;
+
+                for (int j = 2 * y; j < std::min(2 * y + 2, child_cells); j++) {
+                    for (int i = 2 * x; i < std::min(2 * x + 2, child_cells); i++) {
+                        const PseudoBoid& child = level_cell(level - 1, i, j, species);
+                        pos_sum += child.weight * child.pos;
+                        vel_sum += child.weight * child.vel;
+                        weight += child.weight;
+                    }
+                }
+
+                m_levels[level - 1][c] =
+                    weight > 0.f ? PseudoBoid(pos_sum / weight, vel_sum / weight, weight) : PseudoBoid();
+            }
+        });
+    }
+}
+
+void QuadTree::place_pages(Scheduler& scheduler)
+{
+    for (UninitializedVector<float>* vec : {&m_pos_x, &m_pos_y, &m_vel_x, &m_vel_y}) {
+        ::place_pages(scheduler, *vec);
+    }
+    ::place_pages(scheduler, m_compact_pos_x);
+    ::place_pages(scheduler, m_compact_pos_y);
+    ::place_pages(scheduler, m_compact_vel_x);
+    ::place_pages(scheduler, m_compact_vel_y);
+    ::place_pages(scheduler, m_boid_nodes);
+    ::place_pages(scheduler, m_node_offsets);
+    ::place_pages(scheduler, m_pseudoboids);
+}
+
+size_t QuadTree::memory_bytes(void) const
+{
+    size_t bytes = (m_pos_x.capacity() + m_pos_y.capacity() + m_vel_x.capacity() + m_vel_y.capacity()) *
+                   sizeof(float);
+    bytes += (m_compact_pos_x.capacity() + m_compact_pos_y.capacity()) * sizeof(uint16_t);
+    bytes += (m_compact_vel_x.capacity() + m_compact_vel_y.capacity()) * sizeof(int16_t);
+    bytes += (m_node_offsets.capacity() + m_node_cursors.capacity() + m_range_totals.capacity()) *
+             sizeof(size_t);
+    bytes += m_pseudoboids.capacity() * sizeof(PseudoBoid);
+    bytes += m_boid_nodes.capacity() * sizeof(int);
+    for (const std::vector<PseudoBoid>& level : m_levels) bytes += level.capacity() * sizeof(PseudoBoid);
+    return bytes;
+}
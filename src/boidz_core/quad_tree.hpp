@@ -0,0 +1,445 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "parallel.hpp"
+#include "props.hpp"
+#include "scheduler.hpp"
+#include "v2.hpp"
+
+class BoidCollection;
+
+struct PseudoBoid {
+    V2 pos = V2::null();
+    V2 vel = V2::null();
+    float weight = 0.f;
+
+    PseudoBoid(void) = default;
+    PseudoBoid(V2 _pos, V2 _vel, float _weight) : pos(_pos), vel(_vel), weight(_weight) {}
+};
+
+// the members of one grid node, as a structure of arrays pointing into the grid's storage
+struct NodeSpan {
+    const float* pos_x;
+    const float* pos_y;
+    const float* vel_x;
+    const float* vel_y;
+    size_t count;
+
+    inline float x(size_t i) const { return pos_x[i]; }
+    inline float y(size_t i) const { return pos_y[i]; }
+    inline float vx(size_t i) const { return vel_x[i]; }
+    inline float vy(size_t i) const { return vel_y[i]; }
+};
+
+// fixed point encoding of the grid's compact storage mode. positions cover the domain with
+// 16 bits per axis, so a decoded position is off by at most half a step, domain_span / 2^17
+// (0.002 with the default 256 wide domain). velocities are stored in 1/64ths in an int16, which
+// holds +-512 (above any allowed maximum speed) and is off by at most 1/128.
+struct CompactEncoding {
+    static constexpr float vel_step = 1.f / 64.f;
+    static constexpr float max_vel_error = 0.5f * vel_step;
+
+    static constexpr float pos_step(float domain_span) { return domain_span / 65536.f; }
+    static constexpr float max_pos_error(float domain_span) { return 0.5f * pos_step(domain_span); }
+
+    static inline uint16_t encode_pos(float x, float pos_step)
+    {
+        const float q = std::floor(x * (1.f / pos_step) + 0.5f);
+        return static_cast<uint16_t>(std::min(65535.f, std::max(0.f, q)));
+    }
+
+    static inline int16_t encode_vel(float v)
+    {
+        const float q = std::floor(v * (1.f / vel_step) + 0.5f);
+        return static_cast<int16_t>(std::min(32767.f, std::max(-32768.f, q)));
+    }
+
+    static inline float decode_pos(uint16_t q, float pos_step) { return pos_step * static_cast<float>(q); }
+    static inline float decode_vel(int16_t q) { return vel_step * static_cast<float>(q); }
+};
+
+// NodeSpan for the compact storage mode, decoded by the accessors or the compact force kernels
+struct CompactNodeSpan {
+    const uint16_t* pos_x;
+    const uint16_t* pos_y;
+    const int16_t* vel_x;
+    const int16_t* vel_y;
+    size_t count;
+    float pos_step;  // CompactEncoding::pos_step of the grid's domain
+
+    inline float x(size_t i) const { return CompactEncoding::decode_pos(pos_x[i], pos_step); }
+    inline float y(size_t i) const { return CompactEncoding::decode_pos(pos_y[i], pos_step); }
+    inline float vx(size_t i) const { return CompactEncoding::decode_vel(vel_x[i]); }
+    inline float vy(size_t i) const { return CompactEncoding::decode_vel(vel_y[i]); }
+};
+
+class QuadTree {
+    // boid positions/velocities sorted by node, and within each node by species, so that the
+    // members of one species in a node form one dense slice, its bucket: bucket b = node *
+    // m_species_count + species owns [m_node_offsets[b], m_node_offsets[b + 1]).
+    // stored as separate x/y arrays so the force kernel can process several members at once
+    UninitializedVector<float> m_pos_x;
+    UninitializedVector<float> m_pos_y;
+    UninitializedVector<float> m_vel_x;
+    UninitializedVector<float> m_vel_y;
+    UninitializedVector<size_t> m_node_offsets;  // m_node_count * m_species_count + 1 entries
+
+    // the same, in CompactEncoding instead, when compact storage is on. only one of the two
+    // sets of arrays is filled at a time.
+    UninitializedVector<uint16_t> m_compact_pos_x;
+    UninitializedVector<uint16_t> m_compact_pos_y;
+    UninitializedVector<int16_t> m_compact_vel_x;
+    UninitializedVector<int16_t> m_compact_vel_y;
+    bool m_compact = false;
+
+    // pseudo boid computed via the average position/velocity of each bucket's members.
+    // we cache these to avoid computing them multiple times (for each neighbor request)
+    UninitializedVector<PseudoBoid> m_pseudoboids;
+
+    // scratch space for insert, kept around to avoid reallocating every frame
+    UninitializedVector<int> m_boid_nodes;  // bucket index of each inserted boid
+    std::vector<size_t> m_node_cursors;  // per thread bucket counts, then next free slots
+    std::vector<size_t> m_range_totals;  // members per bucket range
+
+    // the coarser levels of the hierarchy: level l (from 1) has ceil(nodes_per_axis / 2^l) cells
+    // per axis, each aggregating up to 2x2 cells of level l - 1 into one pseudoboid per species.
+    // level 0 is m_pseudoboids and the last level is a single cell covering the whole domain.
+    std::vector<std::vector<PseudoBoid>> m_levels;
+    std::vector<int> m_cells_per_axis;  // per level, including level 0
+
+    int m_nodes_per_axis;
+    int m_node_count;  // m_nodes_per_axis ^ 2
+    size_t m_species_count = 1;  // of the boids of the last insert
+
+    // side length of the domain the nodes divide up, taken from the boids on every insert
+    float m_domain_span = WinProps::boid_span;
+
+    float m_radius_squared;
+    float m_opening_angle = 0.f;
+    size_t m_node_cap = s_default_node_cap;
+
+    static constexpr int s_max_levels = 32;
+
+    inline const PseudoBoid& level_cell(int level, int x, int y, size_t species) const
+    {
+        const size_t index = (m_cells_per_axis[level] * y + x) * m_species_count + species;
+        return level == 0 ? m_pseudoboids[index] : m_levels[level - 1][index];
+    }
+
+    inline NodeSpan node_span(size_t bucket) const
+    {
+        const size_t begin = m_node_offsets[bucket];
+        const size_t end = m_node_offsets[bucket + 1];
+        return {&m_pos_x[begin], &m_pos_y[begin], &m_vel_x[begin], &m_vel_y[begin], end - begin};
+    }
+
+    inline CompactNodeSpan compact_node_span(size_t bucket) const
+    {
+        const size_t begin = m_node_offsets[bucket];
+        const size_t end = m_node_offsets[bucket + 1];
+        return {&m_compact_pos_x[begin], &m_compact_pos_y[begin], &m_compact_vel_x[begin],
+                &m_compact_vel_y[begin], end - begin, CompactEncoding::pos_step(m_domain_span)};
+    }
+
+    // members of a bucket one by one, or just its pseudoboid when it is more crowded than the cap
+    template <typename FineVisitor, typename CoarseVisitor>
+    inline void visit_bucket(int node_index, size_t species, FineVisitor&& fine_visitor,
+                             CoarseVisitor&& coarse_visitor) const
+    {
+        const size_t bucket = node_index * m_species_count + species;
+        const size_t population = bucket_population(bucket);
+        if (population == 0) return;
+
+        if (m_node_cap > 0 && population > m_node_cap) {
+            coarse_visitor(species, m_pseudoboids[bucket]);
+        }
+        else if (m_compact) {
+            fine_visitor(species, compact_node_span(bucket));
+        }
+        else {
+            fine_visitor(species, node_span(bucket));
+        }
+    }
+
+    template <typename FineVisitor, typename CoarseVisitor>
+    void for_each_neighbor_hierarchical(V2 pos, size_t species, FineVisitor&& fine_visitor,
+                                        CoarseVisitor&& coarse_visitor) const;
+
+    // @OPTIMIZE: there is a bit hack for doing this in ~1 cpu cycle for square grid with width 256.
+    inline int position_to_node_index(V2 pos) const
+    {
+        assert(WinProps::is_boid_onscreen(pos, m_domain_span));
+        const float node_span = m_domain_span / static_cast<float>(m_nodes_per_axis);
+        const int node_x = static_cast<int>(std::floor(pos.x / node_span));
+        const int node_y = static_cast<int>(std::floor(pos.y / node_span));
+        const int node_index = m_nodes_per_axis * node_y + node_x;
+
+        assert(node_index < m_node_count);
+
+        return node_index;
+    }
+
+    inline size_t bucket_population(size_t bucket) const
+    {
+        return m_node_offsets[bucket + 1] - m_node_offsets[bucket];
+    }
+
+    // in 'fine grain' cells we treat each boid as a separate PseudoBoid neighbor
+    static constexpr int s_fine_grain_node_limit = 0;
+    // in 'coarse grain' cells we group together all boids into a single PseudoBoids
+    static constexpr int s_coarse_grain_node_limit = 1;
+
+public:
+    // far above the average occupancy of any sensible grid, only reached when the flock
+    // collapses into a handful of nodes
+    static constexpr size_t s_default_node_cap = 512;
+
+    QuadTree(void) : QuadTree(128) {}
+
+    QuadTree(int nodes_per_axis)
+        : m_node_offsets(nodes_per_axis * nodes_per_axis + 1, 0),
+          m_pseudoboids(nodes_per_axis * nodes_per_axis),
+          m_nodes_per_axis(nodes_per_axis),
+          m_node_count(nodes_per_axis * nodes_per_axis),
+          m_radius_squared(4.0 * std::pow(nodes_per_axis / WinProps::boid_span, 2.f))
+    {
+        assert(nodes_per_axis > 1);
+
+        m_cells_per_axis.push_back(nodes_per_axis);
+        while (m_cells_per_axis.back() > 1) {
+            const int cells = (m_cells_per_axis.back() + 1) / 2;
+            m_cells_per_axis.push_back(cells);
+            m_levels.emplace_back(cells * cells);
+        }
+
+        assert(m_cells_per_axis.size() <= s_max_levels);
+    }
+
+    // TODO: just pass vector<V2>'s
+    void insert(const BoidCollection& boids, Scheduler& scheduler);
+
+    // move the grid's arrays to pages first touched by the scheduler's threads, see place_pages
+    void place_pages(Scheduler& scheduler);
+
+    // visit the neighborhood of pos without copying anything: fine_visitor is called as
+    // fine_visitor(const NodeSpan&) with the members of each non-empty fine grain node, straight
+    // out of the grid's storage (or with a CompactNodeSpan in compact mode, so it has to take
+    // both), and coarse_visitor is called as coarse_visitor(const PseudoBoid&) for each non-empty
+    // coarse grain node.
+    template <typename FineVisitor, typename CoarseVisitor>
+    void for_each_neighbor(V2 pos, FineVisitor&& fine_visitor, CoarseVisitor&& coarse_visitor) const
+    {
+        for_each_species_neighbor(
+            pos, UINT32_MAX, [&](size_t, const auto& node) { fine_visitor(node); },
+            [&](size_t, const PseudoBoid& pb) { coarse_visitor(pb); });
+    }
+
+    // the same, for the species whose bit is set in species_mask only. the members of the other
+    // species are never looked at, every node keeping each species' members and pseudoboid apart.
+    // the visitors take the species as their first argument, fine_visitor(species, node) and
+    // coarse_visitor(species, pb).
+    template <typename FineVisitor, typename CoarseVisitor>
+    void for_each_species_neighbor(V2 pos, uint32_t species_mask, FineVisitor&& fine_visitor,
+                                   CoarseVisitor&& coarse_visitor) const;
+
+    // same neighborhood as for_each_neighbor, copied out as one PseudoBoid per neighbor
+    void get_pseudoboid_neighbors(V2 pos, std::vector<PseudoBoid>& neighbors) const;
+
+    // boids further apart than this don't interact. the fixed stencil only reaches the
+    // adjacent nodes no matter how large the radius is, the hierarchical search doesn't care.
+    float effect_radius_squared(void) const { return m_radius_squared; }
+    void set_effect_radius(float radius) { m_radius_squared = radius * radius; }
+    void set_effect_radius_squared(float radius_squared) { m_radius_squared = radius_squared; }
+
+    int nodes_per_axis(void) const { return m_nodes_per_axis; }
+    size_t species_count(void) const { return m_species_count; }
+
+    // the domain of the last insert
+    float domain_span(void) const { return m_domain_span; }
+
+    // bytes held by the grid's arrays, scratch space included
+    size_t memory_bytes(void) const;
+
+    // 0 (the default) searches the fixed stencil of nodes around the boid's own node. anything
+    // larger walks the cell hierarchy Barnes-Hut style instead: every cell within the effect
+    // radius is visited, as a single aggregate pseudoboid when its span is less than
+    // opening_angle times its distance to the boid, and otherwise through its children down to
+    // the individual boids of the nodes.
+    void set_opening_angle(float opening_angle)
+    {
+        assert(opening_angle >= 0.f);
+        m_opening_angle = opening_angle;
+    }
+    float opening_angle(void) const { return m_opening_angle; }
+
+    // store the grid's copy of the boids in CompactEncoding, half the footprint of the float
+    // arrays. takes effect on the next insert.
+    void set_compact_storage(bool compact) { m_compact = compact; }
+    bool compact_storage(void) const { return m_compact; }
+
+    // a boid's position and velocity the way neighbors see them in the grid: decoded from
+    // CompactEncoding in compact mode, unchanged otherwise
+    inline V2 stored_position(V2 pos) const
+    {
+        if (!m_compact) return pos;
+        const float step = CompactEncoding::pos_step(m_domain_span);
+        return {CompactEncoding::decode_pos(CompactEncoding::encode_pos(pos.x, step), step),
+                CompactEncoding::decode_pos(CompactEncoding::encode_pos(pos.y, step), step)};
+    }
+
+    inline V2 stored_velocity(V2 vel) const
+    {
+        if (!m_compact) return vel;
+        return {CompactEncoding::decode_vel(CompactEncoding::encode_vel(vel.x)),
+                CompactEncoding::decode_vel(CompactEncoding::encode_vel(vel.y))};
+    }
+
+    // nodes holding more boids (of one species) than this are never handed out member by member,
+    // only as their aggregate pseudoboid, which bounds the work per neighbor search when the flock
+    // piles up in a few nodes. 0 removes the cap.
+    void set_node_cap(size_t cap) { m_node_cap = cap; }
+    size_t node_cap(void) const { return m_node_cap; }
+
+    // the aggregate the members of species in pos's node are handed out as, the very PseudoBoid
+    // the coarse visitor is called with, when the node is over the cap. nullptr when they are
+    // handed out one by one.
+    inline const PseudoBoid* crowd_at(V2 pos, size_t species) const
+    {
+        const size_t bucket = position_to_node_index(pos) * m_species_count + species;
+        return m_node_cap > 0 && bucket_population(bucket) > m_node_cap ? &m_pseudoboids[bucket] : nullptr;
+    }
+};
+
+// TODO: Try adding a radius parameter and only include other boids closer than radius
+template <typename FineVisitor, typename CoarseVisitor>
+void QuadTree::for_each_species_neighbor(V2 pos, uint32_t species_mask, FineVisitor&& fine_visitor,
+                                         CoarseVisitor&& coarse_visitor) const
+{
+    auto in_mask = [=](size_t species) { return ((species_mask >> species) & 1) != 0; };
+
+    if (m_opening_angle > 0.f) {
+        for (size_t species = 0; species < m_species_count; species++) {
+            if (in_mask(species)) for_each_neighbor_hierarchical(pos, species, fine_visitor, coarse_visitor);
+        }
+        return;
+    }
+
+    // node index of the boid we're interested in
+    const int focus_node_index = position_to_node_index(pos);
+
+    // check if node index is actually part of the grid
+    // matters when looking for neighboring nodes at a corner node
+    auto is_valid_node_index = [&](int idx) { return idx >= 0 && idx < m_node_count; };
+
+    // loop over the fine grain nodes directly adjacent to the node of interest,
+    // handing out each nearby boid individually
+    for (int i = -s_fine_grain_node_limit; i <= s_fine_grain_node_limit; i++) {
+        for (int j = -s_fine_grain_node_limit; j <= s_fine_grain_node_limit; j++) {
+            const int node_index = focus_node_index + m_nodes_per_axis * j + i;
+            if (is_valid_node_index(node_index)) {
+                for (size_t species = 0; species < m_species_count; species++) {
+                    if (in_mask(species)) visit_bucket(node_index, species, fine_visitor, coarse_visitor);
+                }
+            }
+        }
+    }
+
+    // helper lambda for looping over the proceeding coarse grain cells,
+    // while skipping over the fine grain cells we just looped over above.
+    auto advance_coarse_cell_index = [](int idx) -> int {
+        if (idx == -s_fine_grain_node_limit - 1) {
+            return s_fine_grain_node_limit + 1;
+        }
+        else {
+            return idx + 1;
+        }
+    };
+
+    // loop over the coarse grain nodes surrounding the fine grain ones,
+    // handing out a single PseudoBoid for each of them
+    for (int i = -s_coarse_grain_node_limit; i <= s_coarse_grain_node_limit;
+         i = advance_coarse_cell_index(i)) {
+        for (int j = -s_coarse_grain_node_limit; j <= s_coarse_grain_node_limit;
+             j = advance_coarse_cell_index(j)) {
+            const int node_index = focus_node_index + m_nodes_per_axis * j + i;
+            if (is_valid_node_index(node_index)) {
+                for (size_t species = 0; species < m_species_count; species++) {
+                    const size_t bucket = node_index * m_species_count + species;
+                    // don't hand out zero-weight pseudoboids for empty buckets
+                    if (in_mask(species) && bucket_population(bucket) > 0) {
+                        coarse_visitor(species, m_pseudoboids[bucket]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <typename FineVisitor, typename CoarseVisitor>
+void QuadTree::for_each_neighbor_hierarchical(V2 pos, size_t species, FineVisitor&& fine_visitor,
+                                              CoarseVisitor&& coarse_visitor) const
+{
+    assert(WinProps::is_boid_onscreen(pos, m_domain_span));
+
+    const float node_span_length = m_domain_span / static_cast<float>(m_nodes_per_axis);
+    const int focus_x = static_cast<int>(std::floor(pos.x / node_span_length));
+    const int focus_y = static_cast<int>(std::floor(pos.y / node_span_length));
+    const float opening_angle_squared = m_opening_angle * m_opening_angle;
+
+    struct Cell {
+        int level, x, y;
+    };
+
+    // depth first, every opened cell replaces itself with at most four children
+    Cell stack[3 * s_max_levels + 1];
+    int stack_size = 0;
+    stack[stack_size++] = {static_cast<int>(m_cells_per_axis.size()) - 1, 0, 0};
+
+    while (stack_size > 0) {
+        const Cell cell = stack[--stack_size];
+        const PseudoBoid& aggregate = level_cell(cell.level, cell.x, cell.y, species);
+
+        if (aggregate.weight == 0.f) continue;
+
+        // skip cells whose closest point is already out of reach
+        const float span = node_span_length * static_cast<float>(1 << cell.level);
+        const float low_x = span * cell.x;
+        const float low_y = span * cell.y;
+        const float gap_x = std::max(0.f, std::max(low_x - pos.x, pos.x - (low_x + span)));
+        const float gap_y = std::max(0.f, std::max(low_y - pos.y, pos.y - (low_y + span)));
+        if (gap_x * gap_x + gap_y * gap_y >= m_radius_squared) continue;
+
+        // the cell holding the boid itself is always opened, so the boid is handed out individually
+        const bool holds_focus = (focus_x >> cell.level) == cell.x && (focus_y >> cell.level) == cell.y;
+
+        if (!holds_focus) {
+            const V2 offset = aggregate.pos - pos;
+            const float distance_squared = offset.x * offset.x + offset.y * offset.y;
+            if (span * span < opening_angle_squared * distance_squared) {
+                coarse_visitor(species, aggregate);
+                continue;
+            }
+        }
+
+        if (cell.level == 0) {
+            visit_bucket(m_nodes_per_axis * cell.y + cell.x, species, fine_visitor, coarse_visitor);
+            continue;
+        }
+
+        const int child_level = cell.level - 1;
+        const int child_cells = m_cells_per_axis[child_level];
+        for (int j = 0; j < 2; j++) {
+            for (int i = 0; i < 2; i++) {
+                const int x = 2 * cell.x + i;
+                const int y = 2 * cell.y + j;
+                if (x < child_cells && y < child_cells) {
+                    stack[stack_size++] = {child_level, x, y};
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <cmath>
+
+#include "v2.hpp"
+
+// independent random streams drawn from one simulation seed: the stream id is mixed into the
+// CounterRng key, and the ids are kept distinct from the seeds the initial distributions draw from
+enum RandomStream { RS_RESPAWN = 2, RS_NOISE = 3 };
+
+// splitmix64 finalizer, a cheap stateless hash with well mixed output bits
+inline uint64_t mix_bits(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// counter based generator after Widynski's "Squares" (2020): every draw is a pure function of
+// the key and a 64 bit counter, so there is no state to share or advance and any thread can
+// draw any number in any order with the same result. the counter is built from a step and a
+// boid id, which makes draws reproducible regardless of thread count or boid order.
+class CounterRng {
+    uint64_t m_key;
+
+public:
+    // keys should be odd with well mixed digits, which hashing the seed and stream provides
+    CounterRng(uint64_t seed, uint64_t stream = 0)
+        : m_key(mix_bits(mix_bits(seed) ^ (0x9e3779b97f4a7c15ull * (stream + 1))) | 1ull)
+    {
+    }
+
+    inline uint64_t bits(uint64_t counter) const
+    {
+        uint64_t x = counter * m_key;
+        const uint64_t y = x;
+        const uint64_t z = y + m_key;
+
+        x = x * x + y;
+        x = (x >> 32) | (x << 32);
+        x = x * x + z;
+        x = (x >> 32) | (x << 32);
+        x = x * x + y;
+        x = (x >> 32) | (x << 32);
+        const uint64_t t = x = x * x + z;
+        x = (x >> 32) | (x << 32);
+        return t ^ ((x * x + y) >> 32);
+    }
+
+    // steps below 2^32 and 32 bit ids map to distinct counters
+    inline uint64_t bits(uint64_t step, uint32_t id) const { return bits((step << 32) | id); }
+
+    // the shapes below each turn one 64 bit draw into a pair of floats
+
+    // two independent uniform floats in [0, 1), from the top 24 bits of each half
+    static inline V2 unit_square(uint64_t draw)
+    {
+        return {static_cast<float>(draw >> 40) * (1.f / 16777216.f),
+                static_cast<float>((draw >> 8) & 0xffffff) * (1.f / 16777216.f)};
+    }
+
+    // uniform over the disc of radius one
+    static inline V2 unit_disc(uint64_t draw)
+    {
+        const V2 u = unit_square(draw);
+        const float radius = std::sqrt(u.x);
+        const float angle = 6.28318530718f * u.y;
+        return {radius * std::cos(angle), radius * std::sin(angle)};
+    }
+
+    // two independent standard normal floats (Box-Muller)
+    static inline V2 normal_pair(uint64_t draw)
+    {
+        const V2 u = unit_square(draw);
+        const float radius = std::sqrt(-2.f * std::log(1.f - u.x));
+        const float angle = 6.28318530718f * u.y;
+        return {radius * std::cos(angle), radius * std::sin(angle)};
+    }
+};
@@ -0,0 +1,240 @@
+#include "recorder.hpp"
+
+#include <string.h>
+
+#include <chrono>
+using namespace std::chrono;
+
+// nearest integer, halves rounded away from zero. unlike std::lrint it is a few instructions
+// inline rather than a library call. values beyond what an int32_t holds (a boid that left the
+// domain for good) are clamped to the largest float below 2^31, nan to the lowest
+static inline int32_t quantize(float value)
+{
+    constexpr float limit = 2147483520.f;
+    value = std::min(limit, std::max(-limit, value));
+    return static_cast<int32_t>(value + (value < 0.f ? -0.5f : 0.5f));
+}
+
+static double seconds_between(steady_clock::time_point start, steady_clock::time_point end)
+{
+    return duration_cast<duration<double>>(end - start).count();
+}
+
+bool Recorder::open(const char* path, const BoidCollection& boids, float dt)
+{
+    close();
+
+    m_file = fopen(path, "wb");
+    if (!m_file) return false;
+
+    m_population = boids.population();
+    m_have_order = false;
+    m_quantum = m_quantum_setting > 0.f ? m_quantum_setting : boids.domain_span() / 65536.f;
+
+    // every buffer is allocated up front, recording never allocates
+    m_frames.assign(m_buffer_count, Frame());
+    for (Frame& frame : m_frames) {
+        frame.pos.resize(m_population);
+        frame.ids.resize(m_population);
+    }
+    m_oldest = 0;
+    m_queued = 0;
+    m_closing = false;
+    m_stats = RecorderStats();
+
+    m_ids.resize(m_population);
+    for (std::vector<int32_t>& quantized : m_quantized) quantized.resize(2 * m_population);
+    m_coded.resize(max_coded_frame_bytes(2 * m_population));
+    m_index.clear();
+    m_chunk.frame_count = 0;
+    m_frame_count = 0;
+    m_file_bytes = 0;
+    m_failed = false;
+
+    TrajectoryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic));
+    header.version = s_trajectory_version;
+    header.frames_per_chunk = m_frames_per_chunk;
+    header.population = m_population;
+    header.seed = boids.seed();
+    header.quantum = m_quantum;
+    header.dt = dt;
+    header.domain_span = boids.domain_span();
+    write(&header, sizeof(header));
+
+    m_writer = std::thread(&Recorder::writer_loop, this);
+    return true;
+}
+
+bool Recorder::record(const BoidCollection& boids)
+{
+    assert(m_file && boids.population() == m_population);
+
+    const auto start = steady_clock::now();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_queued == m_frames.size()) {
+        if (m_drop_frames) {
+            m_stats.frames_dropped++;
+            return false;
+        }
+        m_frame_written.wait(lock, [&] { return m_queued < m_frames.size(); });
+    }
+
+    // the writer only touches queued frames, so the next one is ours until it is queued
+    Frame& frame = m_frames[(m_oldest + m_queued) % m_frames.size()];
+    lock.unlock();
+
+    const auto copy_start = steady_clock::now();
+
+    frame.step = boids.step();
+    memcpy(frame.pos.data(), boids.positions().data(), m_population * sizeof(V2));
+    frame.new_ids = !m_have_order || boids.order_version() != m_order_version;
+    if (frame.new_ids) {
+        memcpy(frame.ids.data(), boids.ids().data(), m_population * sizeof(uint32_t));
+        m_order_version = boids.order_version();
+        m_have_order = true;
+    }
+
+    const auto copy_end = steady_clock::now();
+
+    lock.lock();
+    m_stats.blocked_seconds += seconds_between(start, copy_start);
+    m_stats.copy_seconds += seconds_between(copy_start, copy_end);
+    m_stats.frames_recorded++;
+    m_queued++;
+    m_stats.max_queued = std::max(m_stats.max_queued, m_queued);
+    lock.unlock();
+
+    m_frame_queued.notify_one();
+    return true;
+}
+
+void Recorder::writer_loop(void)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true) {
+        m_frame_queued.wait(lock, [&] { return m_queued > 0 || m_closing; });
+        if (m_queued == 0) break;
+
+        Frame& frame = m_frames[m_oldest];
+        lock.unlock();
+
+        const auto encode_start = steady_clock::now();
+        const size_t coded_bytes = encode(frame);
+        const auto write_start = steady_clock::now();
+        write_frame(frame.step, coded_bytes);
+        const auto write_end = steady_clock::now();
+
+        lock.lock();
+        m_stats.encode_seconds += seconds_between(encode_start, write_start);
+        m_stats.write_seconds += seconds_between(write_start, write_end);
+        m_stats.frames_written++;
+        m_stats.raw_bytes += m_population * sizeof(V2);
+        m_stats.file_bytes = m_file_bytes;
+        m_oldest = (m_oldest + 1) % m_frames.size();
+        m_queued--;
+        m_frame_written.notify_one();
+    }
+}
+
+size_t Recorder::encode(Frame& frame)
+{
+    // the frame's buffer gets the old ids, to be overwritten the next time it carries new ones
+    if (frame.new_ids) m_ids.swap(frame.ids);
+
+    // positions go in id order, so a boid's difference is taken against its own last position
+    // no matter how often the collection was reordered in between
+    const float scale = 1.f / m_quantum;
+    int32_t* quantized = m_quantized[0].data();
+    for (size_t i = 0; i < m_population; i++) {
+        const int32_t pair[2] = {quantize(frame.pos[i].x * scale), quantize(frame.pos[i].y * scale)};
+        memcpy(&quantized[2 * m_ids[i]], pair, sizeof(pair));
+    }
+
+    // the first frame of a chunk is coded on its own
+    const int32_t* previous = m_chunk.frame_count > 0 ? m_quantized[1].data() : nullptr;
+    const size_t coded_bytes =
+        encode_frame(frame.step, quantized, previous, 2 * m_population, m_coded.data());
+
+    m_quantized[0].swap(m_quantized[1]);
+    return coded_bytes;
+}
+
+void Recorder::write_frame(uint64_t step, size_t coded_bytes)
+{
+    if (m_chunk.frame_count == 0) {
+        // the header is written again with the real frame count once the chunk is complete
+        memcpy(m_chunk.tag, TRAJECTORY_CHUNK_TAG, sizeof(m_chunk.tag));
+        m_chunk.first_frame = m_frame_count;
+        m_chunk.payload_bytes = 0;
+        m_chunk_offset = m_file_bytes;
+        m_index.push_back({m_chunk_offset, m_frame_count, step});
+        write(&m_chunk, sizeof(m_chunk));
+    }
+
+    write(m_coded.data(), coded_bytes);
+    m_chunk.frame_count++;
+    m_chunk.payload_bytes += coded_bytes;
+    m_frame_count++;
+
+    if (m_chunk.frame_count == m_frames_per_chunk) finish_chunk();
+}
+
+void Recorder::finish_chunk(void)
+{
+    const bool patched = fseek(m_file, static_cast<long>(m_chunk_offset), SEEK_SET) == 0 &&
+                         fwrite(&m_chunk, sizeof(m_chunk), 1, m_file) == 1 && fseek(m_file, 0, SEEK_END) == 0;
+    m_failed = m_failed || !patched;
+    m_chunk.frame_count = 0;
+}
+
+void Recorder::write(const void* data, size_t size)
+{
+    if (!m_failed && fwrite(data, 1, size, m_file) != size) m_failed = true;
+    m_file_bytes += size;
+}
+
+bool Recorder::close(void)
+{
+    if (!m_file) return true;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closing = true;
+    }
+    m_frame_queued.notify_one();
+    m_writer.join();
+
+    if (m_chunk.frame_count > 0) finish_chunk();
+
+    TrajectoryFooter footer;
+    memset(&footer, 0, sizeof(footer));
+    footer.index_offset = m_file_bytes;
+    footer.chunk_count = m_index.size();
+    footer.frame_count = m_frame_count;
+    memcpy(footer.magic, TRAJECTORY_FOOTER_MAGIC, sizeof(footer.magic));
+    write(m_index.data(), m_index.size() * sizeof(TrajectoryChunkEntry));
+    write(&footer, sizeof(footer));
+
+    const bool closed = fclose(m_file) == 0 && !m_failed;
+    m_file = nullptr;
+    m_stats.file_bytes = m_file_bytes;
+
+    // the buffers are only needed while recording
+    m_frames.clear();
+    m_frames.shrink_to_fit();
+    for (std::vector<int32_t>& quantized : m_quantized) std::vector<int32_t>().swap(quantized);
+    std::vector<uint8_t>().swap(m_coded);
+    std::vector<uint32_t>().swap(m_ids);
+
+    return closed;
+}
+
+RecorderStats Recorder::stats(void)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
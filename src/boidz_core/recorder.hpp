@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "boid_collection.hpp"
+#include "trajectory.hpp"
+
+// what recording cost the simulation thread, and what the writer thread made of it
+struct RecorderStats {
+    size_t frames_recorded = 0;  // copied and handed to the writer
+    size_t frames_dropped = 0;   // skipped because every buffer was still waiting to be written
+    size_t frames_written = 0;
+    size_t max_queued = 0;  // most frames waiting for the writer at once
+
+    double copy_seconds = 0.0;     // simulation thread, copying frames into buffers
+    double blocked_seconds = 0.0;  // simulation thread, waiting for a free buffer (backpressure)
+    double encode_seconds = 0.0;   // writer thread
+    double write_seconds = 0.0;    // writer thread
+
+    uint64_t raw_bytes = 0;  // the positions of every written frame, as floats
+    uint64_t file_bytes = 0;
+
+    inline double compression_ratio(void) const
+    {
+        return file_bytes > 0 ? static_cast<double>(raw_bytes) / file_bytes : 0.0;
+    }
+};
+
+// records boid positions to a trajectory file (see trajectory.hpp) without holding up the
+// simulation: record copies the positions into one of a ring of preallocated buffers and
+// returns, and a background thread quantizes, codes and writes the buffers in order. when the
+// writer falls behind and every buffer is taken, record either waits for one to come free
+// (the default) or drops the frame, and the stats say how often and for how long.
+class Recorder {
+    struct Frame {
+        uint64_t step = 0;
+        std::vector<V2> pos;
+        std::vector<uint32_t> ids;  // only copied when the boids moved to different indices
+        bool new_ids = false;
+    };
+
+    // settings, fixed while a file is open
+    size_t m_buffer_count = 4;
+    uint32_t m_frames_per_chunk = 32;
+    float m_quantum_setting = 0.f;  // 0 for a 65536th of the domain span
+    bool m_drop_frames = false;
+
+    FILE* m_file = nullptr;
+    size_t m_population = 0;
+    float m_quantum = 0.f;  // that of the open file
+    uint64_t m_order_version = 0;
+    bool m_have_order = false;
+
+    // m_queued frames starting at m_oldest wait for (or are being coded by) the writer
+    std::vector<Frame> m_frames;
+    size_t m_oldest = 0;
+    size_t m_queued = 0;
+    bool m_closing = false;
+    RecorderStats m_stats;
+    std::mutex m_mutex;
+    std::condition_variable m_frame_queued;
+    std::condition_variable m_frame_written;
+    std::thread m_writer;
+
+    // writer thread state. m_quantized holds the frame being coded and the one before it
+    std::vector<uint32_t> m_ids;
+    std::vector<int32_t> m_quantized[2];
+    std::vector<uint8_t> m_coded;
+    std::vector<TrajectoryChunkEntry> m_index;
+    TrajectoryChunkHeader m_chunk;  // the chunk being written, none while its frame_count is 0
+    uint64_t m_chunk_offset = 0;
+    uint64_t m_frame_count = 0;
+    uint64_t m_file_bytes = 0;
+    bool m_failed = false;
+
+    void writer_loop(void);
+    size_t encode(Frame& frame);
+    void write_frame(uint64_t step, size_t coded_bytes);
+    void finish_chunk(void);
+    void write(const void* data, size_t size);
+
+public:
+    Recorder(void) = default;
+    ~Recorder(void) { close(); }
+
+    Recorder(const Recorder&) = delete;
+    Recorder& operator=(const Recorder&) = delete;
+
+    // number of frame buffers, at least 1. more buffers ride out longer writer hiccups
+    inline void set_buffer_count(size_t count) { m_buffer_count = std::max<size_t>(count, 1); }
+    inline size_t buffer_count(void) const { return m_buffer_count; }
+
+    // frames per chunk, the longest run of frames to decode to reach any one of them
+    inline void set_frames_per_chunk(uint32_t count) { m_frames_per_chunk = std::max<uint32_t>(count, 1); }
+    inline uint32_t frames_per_chunk(void) const { return m_frames_per_chunk; }
+
+    // positions are rounded to multiples of quantum. 0, the default, picks a 65536th of the
+    // recorded collection's domain span when a file is opened, within 1/512 for the default
+    // domain. quantum() is the one of the file opened last
+    inline void set_quantum(float quantum)
+    {
+        assert(quantum >= 0.f && std::isfinite(quantum));
+        m_quantum_setting = quantum;
+    }
+    inline float quantum(void) const { return m_quantum; }
+
+    // drop frames while the writer is behind, instead of waiting for it
+    inline void set_drop_frames(bool drop) { m_drop_frames = drop; }
+    inline bool drop_frames(void) const { return m_drop_frames; }
+
+    // starts a recording of boids to path (replacing any earlier file), dt being the time step
+    // the simulation runs at. returns false if the file can't be created.
+    bool open(const char* path, const BoidCollection& boids, float dt);
+
+    // copies the current positions of boids, which must be the collection open was called
+    // with, to the writer. returns false if the frame was dropped.
+    bool record(const BoidCollection& boids);
+
+    // writes the frames still waiting, the index and the footer. returns false if anything
+    // failed to write since open.
+    bool close(void);
+
+    inline bool is_open(void) const { return m_file != nullptr; }
+    RecorderStats stats(void);
+};
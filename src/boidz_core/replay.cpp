@@ -0,0 +1,218 @@
+#include "replay.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+
+ReplayStatus Replay::open(const char* path)
+{
+    m_chunks.clear();
+    m_frame_count = 0;
+    m_frame = s_no_frame;
+    m_step = 0;
+    for (CachedFrame& cached : m_cache) cached.valid = false;
+
+    // recordings can be far larger than memory, so pages are only read as frames need them
+    if (!m_file.open(path, false)) return RP_OPEN_FAILED;
+
+    if (m_file.size() < sizeof(m_header)) return RP_NOT_A_TRAJECTORY;
+    memcpy(&m_header, m_file.data(), sizeof(m_header));
+
+    if (memcmp(m_header.magic, TRAJECTORY_MAGIC, sizeof(m_header.magic)) != 0) return RP_NOT_A_TRAJECTORY;
+    if (m_header.version != s_trajectory_version) return RP_WRONG_VERSION;
+    if (m_header.population > UINT32_MAX || !(m_header.quantum > 0.f) || !(m_header.domain_span > 0.f) ||
+        m_header.frames_per_chunk == 0) {
+        return RP_CORRUPT;
+    }
+
+    m_indexed = read_index();
+    if (!m_indexed) walk_chunks();
+
+    const size_t population = m_header.population;
+    m_quantized.resize(2 * population);
+    m_scratch.resize(2 * population);
+    m_positions.resize(population);
+
+    // with the cache full of whole frames, going back never decodes more than stride - 1 frames
+    const size_t frame_bytes = std::max<size_t>(2 * population * sizeof(int32_t), 1);
+    const size_t cache_frames = std::max<size_t>(s_cache_bytes / frame_bytes, 1);
+    m_cache_stride = (m_header.frames_per_chunk + cache_frames - 1) / cache_frames;
+    m_cache.resize((m_header.frames_per_chunk + m_cache_stride - 1) / m_cache_stride);
+
+    return RP_OK;
+}
+
+bool Replay::read_index(void)
+{
+    TrajectoryFooter footer;
+    const size_t size = m_file.size();
+    if (size < sizeof(m_header) + sizeof(footer)) return false;
+    memcpy(&footer, m_file.data() + size - sizeof(footer), sizeof(footer));
+
+    const size_t index_end = size - sizeof(footer);
+    if (memcmp(footer.magic, TRAJECTORY_FOOTER_MAGIC, sizeof(footer.magic)) != 0 ||
+        footer.index_offset > index_end ||
+        footer.chunk_count != (index_end - footer.index_offset) / sizeof(TrajectoryChunkEntry)) {
+        return false;
+    }
+
+    if (footer.chunk_count == 0 && footer.frame_count > 0) return false;
+
+    m_chunks.resize(footer.chunk_count);
+    memcpy(m_chunks.data(), m_file.data() + footer.index_offset,
+           footer.chunk_count * sizeof(TrajectoryChunkEntry));
+
+    // chunks have to tile the frames in order, starting at the first one
+    for (size_t c = 0; c < m_chunks.size(); c++) {
+        const uint64_t first = m_chunks[c].first_frame;
+        const bool last = c + 1 == m_chunks.size();
+        const uint64_t next_first = last ? footer.frame_count : m_chunks[c + 1].first_frame;
+        const bool valid =
+            first < next_first && m_chunks[c].offset < footer.index_offset && (c > 0 || first == 0);
+        if (!valid) {
+            m_chunks.clear();
+            return false;
+        }
+    }
+
+    m_frame_count = footer.frame_count;
+    return true;
+}
+
+void Replay::walk_chunks(void)
+{
+    const size_t size = m_file.size();
+    size_t offset = sizeof(m_header);
+
+    while (size - offset >= sizeof(TrajectoryChunkHeader)) {
+        TrajectoryChunkHeader chunk;
+        memcpy(&chunk, m_file.data() + offset, sizeof(chunk));
+
+        // a chunk whose frame count was never filled in was cut short
+        const size_t payload_offset = offset + sizeof(chunk);
+        if (memcmp(chunk.tag, TRAJECTORY_CHUNK_TAG, sizeof(chunk.tag)) != 0 || chunk.frame_count == 0 ||
+            chunk.first_frame != m_frame_count || chunk.payload_bytes < sizeof(uint64_t) ||
+            chunk.payload_bytes > size - payload_offset) {
+            break;
+        }
+
+        uint64_t first_step;
+        memcpy(&first_step, m_file.data() + payload_offset, sizeof(first_step));
+        m_chunks.push_back({offset, chunk.first_frame, first_step});
+
+        m_frame_count += chunk.frame_count;
+        offset = payload_offset + chunk.payload_bytes;
+    }
+}
+
+size_t Replay::chunk_of(uint64_t frame) const
+{
+    // the first chunk starts at frame 0, so some chunk always starts at or before frame
+    auto starts_after = [](uint64_t f, const TrajectoryChunkEntry& entry) { return f < entry.first_frame; };
+    auto after = std::upper_bound(m_chunks.begin(), m_chunks.end(), frame, starts_after);
+    return static_cast<size_t>(after - m_chunks.begin()) - 1;
+}
+
+uint64_t Replay::key_frame(uint64_t frame) const
+{
+    return m_chunks.empty() ? 0 : m_chunks[chunk_of(frame)].first_frame;
+}
+
+bool Replay::enter_chunk(size_t chunk)
+{
+    const size_t offset = m_chunks[chunk].offset;
+    const size_t size = m_file.size();
+    if (size - std::min(size, offset) < sizeof(TrajectoryChunkHeader)) return false;
+
+    TrajectoryChunkHeader header;
+    memcpy(&header, m_file.data() + offset, sizeof(header));
+    if (memcmp(header.tag, TRAJECTORY_CHUNK_TAG, sizeof(header.tag)) != 0 ||
+        header.payload_bytes > size - offset - sizeof(header)) {
+        return false;
+    }
+
+    m_chunk = chunk;
+    m_payload_begin = offset + sizeof(header);
+    m_payload_end = m_payload_begin + header.payload_bytes;
+    m_frame = s_no_frame;
+    for (CachedFrame& cached : m_cache) cached.valid = false;
+    return true;
+}
+
+bool Replay::decode_next(void)
+{
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(m_file.data());
+    const size_t offset = m_frame == s_no_frame ? m_payload_begin : m_next_offset;
+
+    // the chunk's first frame stands on its own, the others are differences to the one before
+    const int32_t* previous = m_frame == s_no_frame ? nullptr : m_quantized.data();
+    const size_t used = decode_frame(data + offset, m_payload_end - offset, previous, m_scratch.size(),
+                                     m_scratch.data(), m_step);
+    if (used == 0) return false;
+
+    m_quantized.swap(m_scratch);
+    m_next_offset = offset + used;
+    m_frame = m_frame == s_no_frame ? m_chunks[m_chunk].first_frame : m_frame + 1;
+
+    const uint64_t in_chunk = m_frame - m_chunks[m_chunk].first_frame;
+    if (in_chunk % m_cache_stride == 0 && in_chunk / m_cache_stride < m_cache.size()) {
+        CachedFrame& cached = m_cache[in_chunk / m_cache_stride];
+        if (!cached.valid) {
+            cached.quantized = m_quantized;
+            cached.step = m_step;
+            cached.next_offset = m_next_offset;
+            cached.valid = true;
+        }
+    }
+
+    return true;
+}
+
+bool Replay::seek(uint64_t frame)
+{
+    if (frame >= m_frame_count) {
+        m_frame = s_no_frame;
+        return false;
+    }
+    if (frame == m_frame) return true;
+
+    const size_t chunk = chunk_of(frame);
+    const uint64_t first = m_chunks[chunk].first_frame;
+
+    const bool same_chunk = m_frame != s_no_frame && chunk == m_chunk;
+    if (!same_chunk && !enter_chunk(chunk)) {
+        m_frame = s_no_frame;
+        return false;
+    }
+
+    // continue from the current frame or the closest cached one before frame, whichever is
+    // closer, and from the start of the chunk when there is neither
+    const bool behind = m_frame != s_no_frame && m_frame < frame;
+    for (size_t slot = std::min<size_t>((frame - first) / m_cache_stride, m_cache.size() - 1);
+         slot != SIZE_MAX; slot--) {
+        const uint64_t cached_frame = first + slot * m_cache_stride;
+        if (behind && cached_frame <= m_frame) break;
+        if (!m_cache[slot].valid) continue;
+
+        std::copy(m_cache[slot].quantized.begin(), m_cache[slot].quantized.end(), m_quantized.begin());
+        m_step = m_cache[slot].step;
+        m_next_offset = m_cache[slot].next_offset;
+        m_frame = cached_frame;
+        break;
+    }
+    if (m_frame != s_no_frame && m_frame > frame) m_frame = s_no_frame;
+
+    while (m_frame == s_no_frame || m_frame < frame) {
+        if (!decode_next()) {
+            m_frame = s_no_frame;
+            return false;
+        }
+    }
+
+    const float quantum = m_header.quantum;
+    for (size_t i = 0; i < m_positions.size(); i++) {
+        m_positions[i] = {quantum * m_quantized[2 * i], quantum * m_quantized[2 * i + 1]};
+    }
+
+    return true;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "frame_source.hpp"
+#include "mapped_file.hpp"
+#include "trajectory.hpp"
+
+enum ReplayStatus { RP_OK, RP_OPEN_FAILED, RP_NOT_A_TRAJECTORY, RP_WRONG_VERSION, RP_CORRUPT, RP_COUNT };
+
+static constexpr const char* REPLAY_STATUS_NAMES[RP_COUNT] = {"ok", "can't open file", "not a trajectory",
+                                                              "unsupported version", "corrupt"};
+
+// plays back a trajectory file (see trajectory.hpp) as a frame source. the file is mapped
+// without reading it, so opening a recording of any length is instant and only the chunks
+// that get played are ever read from disk. frames are decoded when seek asks for them, from
+// the closest earlier frame already decoded in the same chunk: playing forward decodes one
+// frame per frame, and scrubbing or playing backward decodes at most a few.
+class Replay final : public FrameSource {
+    // a decoded frame to resume decoding from, and where its chunk's next frame starts
+    struct CachedFrame {
+        bool valid = false;
+        uint64_t step = 0;
+        size_t next_offset = 0;
+        std::vector<int32_t> quantized;
+    };
+
+    MappedFile m_file;
+    TrajectoryHeader m_header;
+    std::vector<TrajectoryChunkEntry> m_chunks;
+    uint64_t m_frame_count = 0;
+    bool m_indexed = false;
+
+    // the chunk being decoded, its payload, and the frame decoded last (s_no_frame if none)
+    size_t m_chunk = 0;
+    size_t m_payload_begin = 0;
+    size_t m_payload_end = 0;
+    size_t m_next_offset = 0;
+    uint64_t m_frame = s_no_frame;
+    uint64_t m_step = 0;
+    std::vector<int32_t> m_quantized;
+    std::vector<int32_t> m_scratch;
+    std::vector<V2> m_positions;
+
+    // every m_cache_stride'th frame of the current chunk, counting from its first
+    size_t m_cache_stride = 1;
+    std::vector<CachedFrame> m_cache;
+
+    static constexpr uint64_t s_no_frame = UINT64_MAX;
+
+    size_t chunk_of(uint64_t frame) const;
+    bool read_index(void);
+    void walk_chunks(void);
+    bool enter_chunk(size_t chunk);
+    bool decode_next(void);
+
+public:
+    // memory spent on decoded frames kept for seeking backward, per replay
+    static constexpr size_t s_cache_bytes = size_t(64) << 20;
+
+    Replay(void) = default;
+
+    // maps the file at path and reads its index, or if it has none (its recorder never
+    // finished) finds its complete chunks by walking them. decodes no frame yet.
+    ReplayStatus open(const char* path);
+
+    inline const TrajectoryHeader& header(void) const { return m_header; }
+    inline uint64_t frame_count(void) const { return m_frame_count; }
+
+    // false if the chunks had to be found without the file's index
+    inline bool indexed(void) const { return m_indexed; }
+
+    // index of the current frame, until the first seek there is none
+    inline uint64_t frame(void) const { return m_frame; }
+
+    // first frame of the chunk holding frame, the cheapest frame near it to seek to
+    uint64_t key_frame(uint64_t frame) const;
+
+    // makes frame the current one. returns false, leaving no current frame, if it is out of
+    // range or its chunk is corrupt.
+    bool seek(uint64_t frame);
+
+    size_t population(void) const override { return m_header.population; }
+    uint64_t step(void) const override { return m_step; }
+
+    // in id order, the index of a position is the id of its boid
+    const V2* positions(void) const override { return m_positions.data(); }
+
+    float domain_span(void) const override { return m_header.domain_span; }
+};
@@ -0,0 +1,265 @@
+#include "scheduler.hpp"
+
+#include <assert.h>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+static inline void cpu_relax(void) { _mm_pause(); }
+#else
+static inline void cpu_relax(void) {}
+#endif
+
+// which scheduler (if any) owns the current thread, and the index of its queue there
+static thread_local const Scheduler* s_owner = nullptr;
+static thread_local size_t s_queue_index = 0;
+
+// rounds of failed stealing an idle worker spends before going to sleep, yielding in between so
+// oversubscribed machines still make progress
+static constexpr int s_idle_rounds = 256;
+
+size_t Scheduler::current_thread_index(void) { return s_queue_index; }
+
+void Scheduler::WorkQueue::lock(void)
+{
+    while (locked.exchange(true, std::memory_order_acquire)) {
+        while (locked.load(std::memory_order_relaxed)) cpu_relax();
+    }
+}
+
+bool Scheduler::WorkQueue::push(const Task& task)
+{
+    lock();
+    const size_t b = bottom.load(std::memory_order_relaxed);
+    const bool has_room = b - top.load(std::memory_order_relaxed) < capacity;
+    if (has_room) {
+        tasks[b % capacity] = task;
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    unlock();
+    return has_room;
+}
+
+bool Scheduler::WorkQueue::pop(Task& task)
+{
+    if (empty()) return false;
+
+    lock();
+    const size_t b = bottom.load(std::memory_order_relaxed);
+    const bool found = b != top.load(std::memory_order_relaxed);
+    if (found) {
+        task = tasks[(b - 1) % capacity];
+        bottom.store(b - 1, std::memory_order_relaxed);
+    }
+    unlock();
+    return found;
+}
+
+bool Scheduler::WorkQueue::steal(Task& task)
+{
+    if (empty()) return false;
+
+    lock();
+    const size_t t = top.load(std::memory_order_relaxed);
+    const bool found = t != bottom.load(std::memory_order_relaxed);
+    if (found) {
+        task = tasks[t % capacity];
+        top.store(t + 1, std::memory_order_relaxed);
+    }
+    unlock();
+    return found;
+}
+
+Scheduler::Scheduler(size_t thread_count)
+    : m_queues(new WorkQueue[thread_count > 0 ? thread_count : 1]),
+      m_thread_count(thread_count > 0 ? thread_count : 1)
+{
+    m_workers.reserve(m_thread_count - 1);
+    for (size_t i = 1; i < m_thread_count; i++) {
+        m_workers.emplace_back([this, i] { this->worker_loop(i); });
+    }
+}
+
+Scheduler::~Scheduler(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+
+    for (std::thread& worker : m_workers) worker.join();
+}
+
+bool Scheduler::pin_threads(const std::vector<int>& cpus)
+{
+    assert(cpus.size() >= m_thread_count);
+
+#if defined(__linux__)
+    auto pin = [](pthread_t thread, int cpu) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+    };
+
+    bool pinned = pin(pthread_self(), cpus[0]);
+    for (size_t t = 1; t < m_thread_count && pinned; t++) {
+        pinned = pin(m_workers[t - 1].native_handle(), cpus[t]);
+    }
+
+    if (pinned) {
+        m_pinned_cpus.assign(cpus.begin(), cpus.begin() + m_thread_count);
+    }
+    return pinned;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+// own deque first (newest piece, still warm in cache), then the other deques in turn
+bool Scheduler::find_task(size_t queue_index, Task& task)
+{
+    if (m_queues[queue_index].pop(task)) return true;
+
+    for (size_t i = 1; i < m_thread_count; i++) {
+        const size_t victim = (queue_index + i) % m_thread_count;
+        if (m_queues[victim].steal(task)) return true;
+    }
+
+    return false;
+}
+
+void Scheduler::run_range(size_t queue_index, RangeJob* job, size_t low, size_t high)
+{
+    // keep the lower half and offer the upper one, until the piece is small enough or the
+    // deque is full
+    while (high - low > job->grain) {
+        const size_t mid = low + (high - low) / 2;
+        if (!m_queues[queue_index].push({job, mid, high})) break;
+        high = mid;
+    }
+
+    job->fn(job->ctx, low, high);
+
+    // the last access to the job, the caller may return as soon as this reaches zero
+    job->remaining.fetch_sub(high - low, std::memory_order_acq_rel);
+}
+
+void Scheduler::worker_loop(size_t queue_index)
+{
+    s_owner = this;
+    s_queue_index = queue_index;
+
+    int idle_rounds = 0;
+
+    while (true) {
+        const uint64_t epoch = m_epoch.load(std::memory_order_acquire);
+
+        Task task;
+        if (find_task(queue_index, task)) {
+            run_range(queue_index, task.job, task.low, task.high);
+            idle_rounds = 0;
+            continue;
+        }
+
+        if (m_stop.load(std::memory_order_relaxed)) return;
+
+        // while a job is running more pieces can show up at any time
+        if (m_active_jobs.load(std::memory_order_acquire) > 0 || idle_rounds < s_idle_rounds) {
+            idle_rounds++;
+            cpu_relax();
+            std::this_thread::yield();
+            continue;
+        }
+
+        // the epoch was read before looking for work, so a job started since then can't be missed
+        m_sleepers.fetch_add(1);
+        {
+            std::unique_lock<std::mutex> lock(m_sleep_mutex);
+            m_wake.wait(lock, [&] { return m_stop || m_epoch.load() != epoch; });
+        }
+        m_sleepers.fetch_sub(1);
+        idle_rounds = 0;
+    }
+}
+
+void Scheduler::run(RangeJob& job, size_t begin, size_t end)
+{
+    if (begin >= end) return;
+
+    const bool nested = s_owner == this;
+    const size_t queue_index = nested ? s_queue_index : 0;
+
+    // an outside caller borrows queue 0 for the duration, which also makes any run calls
+    // from inside its own pieces nested ones
+    const Scheduler* const outer_owner = s_owner;
+    const size_t outer_queue_index = s_queue_index;
+
+    if (!nested) {
+        const bool was_busy = m_external_busy.exchange(true);
+        assert(!was_busy && "only one outside thread may run jobs on a scheduler at a time");
+        (void)was_busy;
+
+        s_owner = this;
+        s_queue_index = 0;
+    }
+
+    job.remaining.store(end - begin, std::memory_order_relaxed);
+
+    m_active_jobs.fetch_add(1);
+    m_epoch.fetch_add(1);
+    if (m_sleepers.load() > 0) {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        m_wake.notify_all();
+    }
+
+    // an outside call hands every thread its own share up front. a nested one only splits
+    // locally, the other threads are busy with the outer job anyway
+    if (!nested && m_thread_count > 1 && end - begin > job.grain) {
+        const size_t count = end - begin;
+        const size_t base = count / m_thread_count;
+        const size_t rem = count % m_thread_count;
+
+        size_t low = begin + base + (rem > 0 ? 1 : 0);
+        for (size_t t = 1; t < m_thread_count; t++) {
+            const size_t high = low + base + (t < rem ? 1 : 0);
+            if (high > low && !m_queues[t].push({&job, low, high})) {
+                // can't happen right at the start of a job, but don't lose the share if it does
+                run_range(queue_index, &job, low, high);
+            }
+            low = high;
+        }
+
+        run_range(queue_index, &job, begin, begin + base + (rem > 0 ? 1 : 0));
+    }
+    else {
+        run_range(queue_index, &job, begin, end);
+    }
+
+    // help with whatever is left (of this job or any other) until every piece of this one is done
+    while (job.remaining.load(std::memory_order_acquire) > 0) {
+        Task task;
+        if (find_task(queue_index, task)) {
+            run_range(queue_index, task.job, task.low, task.high);
+        }
+        else {
+            cpu_relax();
+            std::this_thread::yield();
+        }
+    }
+
+    m_active_jobs.fetch_sub(1, std::memory_order_release);
+
+    if (!nested) {
+        s_owner = outer_owner;
+        s_queue_index = outer_queue_index;
+        m_external_busy.store(false);
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// a range of work handed to the scheduler: fn(ctx, low, high) is called on disjoint pieces of the
+// range, none longer than grain, until all of it has been processed. lives on the caller's stack.
+struct RangeJob {
+    void (*fn)(void* ctx, size_t low, size_t high) = nullptr;
+    void* ctx = nullptr;
+    size_t grain = 1;
+    std::atomic<size_t> remaining{0};  // elements not processed yet
+};
+
+// fork/join scheduler with one work deque per thread. a range starts out as one equal share
+// per thread, pushed onto that thread's deque (so a given share keeps landing on the same thread,
+// and in the same cache and numa node, from one job to the next). each share is split in half
+// repeatedly, the upper halves pushed onto the splitting thread's own deque, and idle threads
+// steal the oldest (largest) pieces from the other deques. the calling thread takes part in the work, so a
+// scheduler for N threads only starts N - 1 workers. nothing is allocated after construction.
+class Scheduler final {
+    struct Task {
+        RangeJob* job;
+        size_t low;
+        size_t high;
+    };
+
+    // owner pushes and pops at the bottom, thieves take from the top. the lock is only ever
+    // contended by a thief, and the splitting depth keeps the deques short.
+    struct alignas(64) WorkQueue {
+        static constexpr size_t capacity = 256;
+
+        std::atomic<bool> locked{false};
+        std::atomic<size_t> top{0};
+        std::atomic<size_t> bottom{0};
+        Task tasks[capacity];
+
+        bool push(const Task& task);
+        bool pop(Task& task);
+        bool steal(Task& task);
+
+        bool empty(void) const
+        {
+            return top.load(std::memory_order_relaxed) == bottom.load(std::memory_order_relaxed);
+        }
+
+    private:
+        void lock(void);
+        void unlock(void) { locked.store(false, std::memory_order_release); }
+    };
+
+    // queue 0 belongs to whichever outside thread calls run, 1..N-1 to the workers
+    std::unique_ptr<WorkQueue[]> m_queues;
+    std::vector<std::thread> m_workers;
+    size_t m_thread_count;
+    std::vector<int> m_pinned_cpus;  // cpu of each thread, empty while unpinned
+
+    std::atomic<size_t> m_active_jobs{0};
+    std::atomic<bool> m_external_busy{false};
+
+    // workers that find nothing to do sleep until the epoch moves on, i.e. a new job starts
+    std::atomic<uint64_t> m_epoch{0};
+    std::atomic<size_t> m_sleepers{0};
+    std::atomic<bool> m_stop{false};
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_wake;
+
+    void worker_loop(size_t queue_index);
+    bool find_task(size_t queue_index, Task& task);
+    void run_range(size_t queue_index, RangeJob* job, size_t low, size_t high);
+
+public:
+    explicit Scheduler(size_t thread_count = std::thread::hardware_concurrency());
+    ~Scheduler(void);
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    inline size_t thread_count(void) const { return m_thread_count; }
+
+    // pin thread t to cpus[t], thread 0 being the calling thread. returns false (and leaves the
+    // threads unpinned) where thread affinity isn't supported or the cpus are out of reach
+    bool pin_threads(const std::vector<int>& cpus);
+    inline const std::vector<int>& pinned_cpus(void) const { return m_pinned_cpus; }
+
+    // index in [0, thread_count) of the thread running the current piece of a job,
+    // 0 being the thread that called run
+    static size_t current_thread_index(void);
+
+    // process all of [begin, end) through job and return once every piece is done. may be
+    // called from inside a job running on this scheduler, but only one outside thread at a time.
+    void run(RangeJob& job, size_t begin, size_t end);
+};
@@ -0,0 +1,188 @@
+#include "slab_decomposition.hpp"
+
+#include <string.h>
+
+#include <chrono>
+using namespace std::chrono;
+
+#include "quad_tree.hpp"
+#include "random.hpp"
+#include "sparse_grid.hpp"
+
+// what a halo strip carries of each boid
+struct HaloBoid {
+    V2 pos;
+    V2 vel;
+};
+
+// messages are plain arrays of one of the structures above
+template <typename T>
+static void append_item(std::vector<uint8_t>& message, const T& item)
+{
+    const size_t at = message.size();
+    message.resize(at + sizeof(T));
+    memcpy(&message[at], &item, sizeof(T));
+}
+
+template <typename T>
+static T message_item(const std::vector<uint8_t>& message, size_t index)
+{
+    T item;
+    memcpy(&item, &message[index * sizeof(T)], sizeof(T));
+    return item;
+}
+
+static double seconds_since(steady_clock::time_point start)
+{
+    return duration_cast<duration<double>>(steady_clock::now() - start).count();
+}
+
+SlabDecomposition::SlabDecomposition(Transport& transport, float cell_span, int column_count)
+    : m_transport(transport), m_cell_span(cell_span)
+{
+    assert(cell_span > 0.f && column_count >= transport.rank_count());
+
+    const int64_t rank = transport.rank();
+    const int64_t rank_count = transport.rank_count();
+    m_first_column = static_cast<int>(rank * column_count / rank_count);
+    m_end_column = static_cast<int>((rank + 1) * column_count / rank_count);
+}
+
+void SlabDecomposition::scatter(BoidCollection& boids)
+{
+    m_leaving.clear();
+    boids.remove_boids([&](V2 pos) { return !owns(pos); }, m_leaving);
+    m_leaving.clear();
+}
+
+// a boid can have to cross every other slab, so it takes rank_count - 1 rounds of passing boids
+// on for all of them to arrive. whatever arrives is added in the order it came in, which is
+// the same on every run.
+bool SlabDecomposition::migrate(BoidCollection& boids)
+{
+    if (m_transport.rank_count() == 1) return true;
+
+    m_leaving.clear();
+    m_arrived.clear();
+    boids.remove_boids([&](V2 pos) { return !owns(pos); }, m_leaving);
+
+    for (int round = 0; round + 1 < m_transport.rank_count(); round++) {
+        for (std::vector<uint8_t>& out : m_out) out.clear();
+        for (const MigratingBoid& boid : m_leaving) {
+            append_item(m_out[column(boid.pos) < m_first_column ? NS_LOWER : NS_UPPER], boid);
+        }
+        m_stats.boids_migrated += m_leaving.size();
+        m_leaving.clear();
+
+        if (!m_transport.exchange(m_out, m_in)) return false;
+
+        for (const std::vector<uint8_t>& in : m_in) {
+            if (in.size() % sizeof(MigratingBoid) != 0) return false;
+
+            for (size_t i = 0; i < in.size() / sizeof(MigratingBoid); i++) {
+                const MigratingBoid boid = message_item<MigratingBoid>(in, i);
+                (owns(boid.pos) ? m_arrived : m_leaving).push_back(boid);
+            }
+        }
+    }
+
+    assert(m_leaving.empty());
+    boids.add_boids(m_arrived.data(), m_arrived.size());
+    return true;
+}
+
+bool SlabDecomposition::exchange_halos(BoidCollection& boids)
+{
+    for (std::vector<uint8_t>& out : m_out) out.clear();
+
+    const bool has_lower = m_transport.has_neighbor(NS_LOWER);
+    const bool has_upper = m_transport.has_neighbor(NS_UPPER);
+    const UninitializedVector<V2>& positions = boids.positions();
+    const UninitializedVector<V2>& velocities = boids.velocities();
+
+    for (size_t i = 0; i < boids.population(); i++) {
+        const int c = column(positions[i]);
+        const HaloBoid boid = {positions[i], velocities[i]};
+        if (has_lower && c <= m_first_column) append_item(m_out[NS_LOWER], boid);
+        if (has_upper && c >= m_end_column - 1) append_item(m_out[NS_UPPER], boid);
+    }
+
+    if (!m_transport.exchange(m_out, m_in)) return false;
+
+    m_ghost_pos.clear();
+    m_ghost_vel.clear();
+    for (const std::vector<uint8_t>& in : m_in) {
+        if (in.size() % sizeof(HaloBoid) != 0) return false;
+
+        for (size_t i = 0; i < in.size() / sizeof(HaloBoid); i++) {
+            const HaloBoid boid = message_item<HaloBoid>(in, i);
+            m_ghost_pos.push_back(boid.pos);
+            m_ghost_vel.push_back(boid.vel);
+        }
+    }
+
+    boids.set_ghosts(m_ghost_pos.size(), m_ghost_pos.data(), m_ghost_vel.data());
+    m_stats.ghosts += m_ghost_pos.size();
+    return true;
+}
+
+template <typename Grid>
+bool SlabDecomposition::update(BoidCollection& boids, float dt, const Rules& params, Grid& grid)
+{
+    const uint64_t bytes_before = m_transport.bytes_sent();
+
+    const auto migrate_start = steady_clock::now();
+    if (!migrate(boids)) return false;
+    m_stats.migrate_seconds += seconds_since(migrate_start);
+
+    const auto halo_start = steady_clock::now();
+    if (!exchange_halos(boids)) return false;
+    m_stats.halo_seconds += seconds_since(halo_start);
+
+    const auto compute_start = steady_clock::now();
+    boids.update(dt, params, grid);
+    m_stats.compute_seconds += seconds_since(compute_start);
+
+    m_stats.bytes_sent += m_transport.bytes_sent() - bytes_before;
+    m_stats.steps++;
+    return true;
+}
+
+// passed down the chain, each rank putting its own stats in front of those from above
+bool SlabDecomposition::gather_stats(const BoidCollection& boids, std::vector<RankStats>& all)
+{
+    RankStats mine = m_stats;
+    mine.population = boids.population();
+    mine.state_hash = boids.state_hash();
+
+    std::vector<uint8_t>& message = m_in[NS_UPPER];
+    message.clear();
+    if (m_transport.has_neighbor(NS_UPPER) && !m_transport.receive(NS_UPPER, message)) return false;
+    if (message.size() % sizeof(RankStats) != 0) return false;
+
+    all.clear();
+    all.push_back(mine);
+    for (size_t i = 0; i < message.size() / sizeof(RankStats); i++) {
+        all.push_back(message_item<RankStats>(message, i));
+    }
+
+    if (!m_transport.has_neighbor(NS_LOWER)) return true;
+
+    std::vector<uint8_t>& out = m_out[NS_LOWER];
+    out.clear();
+    for (const RankStats& stats : all) append_item(out, stats);
+    all.clear();
+    return m_transport.send(NS_LOWER, out);
+}
+
+uint64_t combined_state_hash(const std::vector<RankStats>& ranks)
+{
+    uint64_t hash = mix_bits(ranks.size());
+    for (const RankStats& rank : ranks) hash = mix_bits(hash ^ rank.state_hash);
+    return hash;
+}
+
+template bool SlabDecomposition::update(BoidCollection& boids, float dt, const Rules& params,
+                                        QuadTree& grid);
+template bool SlabDecomposition::update(BoidCollection& boids, float dt, const Rules& params,
+                                        SparseGrid& grid);
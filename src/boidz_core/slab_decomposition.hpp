@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <cmath>
+#include <vector>
+
+#include "boid_collection.hpp"
+#include "transport.hpp"
+#include "v2.hpp"
+
+// what one rank's steps cost, summed since the decomposition started (or the last reset_stats)
+struct RankStats {
+    uint64_t steps = 0;
+    double compute_seconds = 0.0;  // BoidCollection::update: grid insert, forces and integration
+    double migrate_seconds = 0.0;  // handing the boids that left the slab to the ranks owning them
+    double halo_seconds = 0.0;     // swapping halo strips with the neighbors
+    uint64_t bytes_sent = 0;
+    uint64_t boids_migrated = 0;  // boids sent away, including those only passed on
+    uint64_t ghosts = 0;          // halo boids received
+
+    // filled in by gather_stats
+    uint64_t population = 0;
+    uint64_t state_hash = 0;
+
+    inline double exchange_seconds(void) const { return migrate_seconds + halo_seconds; }
+};
+
+// splits the domain into vertical slabs, one per rank of a transport, each rank simulating the
+// boids of its own slab in its own BoidCollection. the slab edges fall on the edges of grid cells
+// (both grids use cells of the same span), so a boid's slab is decided by the same cell column
+// the grid puts it in. before every step:
+//   1. boids that left the slab go to the rank owning their new position, passed from neighbor
+//      to neighbor, since boids respawning after leaving the domain can land anywhere in it
+//   2. each rank sends the boids of its first and last cell column to the neighbor on that
+//      side, to be inserted into the neighbor's grid as ghosts. the grids' neighborhoods reach
+//      one cell in every direction, so every boid sees the same neighbors as in a single run.
+// boids keep their ids, so noise and respawns draw the same numbers as in a single run too. the
+// results still round differently than a single run's once boids migrate, since arrivals are
+// stored after the boids already there and a cell's members are summed in storage order. for a
+// given rank count they don't depend on the transport or the number of threads. (the dense
+// grid's neighborhood of a node in the first or last column also wraps around to the other end
+// of the row above or below, which no rank holds the boids of. the sparse grid doesn't wrap.)
+class SlabDecomposition {
+    Transport& m_transport;
+    float m_cell_span;
+    int m_first_column;  // cell columns [m_first_column, m_end_column) make up this rank's slab
+    int m_end_column;
+
+    // scratch space, kept around to avoid reallocating every step
+    std::vector<MigratingBoid> m_leaving;
+    std::vector<MigratingBoid> m_arrived;
+    std::vector<uint8_t> m_out[NS_COUNT];
+    std::vector<uint8_t> m_in[NS_COUNT];
+    std::vector<V2> m_ghost_pos;
+    std::vector<V2> m_ghost_vel;
+
+    RankStats m_stats;
+
+    inline int column(V2 pos) const { return static_cast<int>(std::floor(pos.x / m_cell_span)); }
+    inline bool owns(V2 pos) const
+    {
+        const int c = column(pos);
+        return (c >= m_first_column || m_transport.rank() == 0) &&
+               (c < m_end_column || m_transport.rank() + 1 == m_transport.rank_count());
+    }
+
+    bool migrate(BoidCollection& boids);
+    bool exchange_halos(BoidCollection& boids);
+
+public:
+    // the domain's column_count cell columns (of cell_span each) are split as evenly as possible
+    // between the ranks, each rank getting at least one
+    SlabDecomposition(Transport& transport, float cell_span, int column_count);
+
+    // keep only the boids in this rank's slab, out of a population every rank starts out with
+    void scatter(BoidCollection& boids);
+
+    // one step of the whole population, every rank calling it with the same arguments. grid is a
+    // QuadTree or a SparseGrid. false if the transport broke, the ranks are then out of step.
+    template <typename Grid>
+    bool update(BoidCollection& boids, float dt, const Rules& params, Grid& grid);
+
+    inline const RankStats& stats(void) const { return m_stats; }
+    inline void reset_stats(void) { m_stats = RankStats(); }
+
+    // rank 0 gets the stats of every rank in rank order, with their population and state hash,
+    // the other ranks an empty vector. every rank has to call it.
+    bool gather_stats(const BoidCollection& boids, std::vector<RankStats>& all);
+
+    // x range of this rank's slab, the ends of the domain being open
+    inline float low_edge(void) const { return m_first_column * m_cell_span; }
+    inline float high_edge(void) const { return m_end_column * m_cell_span; }
+};
+
+// one hash of a decomposed population, combining the per rank hashes in rank order
+uint64_t combined_state_hash(const std::vector<RankStats>& ranks);
@@ -0,0 +1,224 @@
+#include "sparse_grid.hpp"
+
+#include "boid_collection.hpp"
+#include "parallel.hpp"
+
+// claims a table slot for the cell of every boid, all threads inserting into the table at once,
+// and leaves each boid's slot in m_boid_cells. the table gets room for max_cells cells at half
+// load; returns false if the boids occupy more cells than that, with the table left half built.
+bool SparseGrid::claim_slots(const UninitializedVector<V2>& positions, size_t max_cells, Scheduler& scheduler)
+{
+    int slot_bits = 1;
+    while ((size_t(1) << slot_bits) < 2 * max_cells) slot_bits++;
+    const size_t slot_count = size_t(1) << slot_bits;
+
+    // grown whenever it has to be, shrunk only once it's far too large, so a cell count going
+    // back and forth doesn't reallocate every time
+    if (m_slot_keys.size() < slot_count || m_slot_keys.size() > 8 * slot_count) {
+        m_slot_keys = std::vector<std::atomic<uint64_t>>(slot_count);
+        m_slot_cells.resize(slot_count);
+        m_slot_cells.shrink_to_fit();
+    }
+    m_slot_bits = 0;
+    while ((size_t(1) << m_slot_bits) < m_slot_keys.size()) m_slot_bits++;
+
+    parallel_for_ranges(scheduler, m_slot_keys.size(), [&](size_t, size_t low, size_t high) {
+        for (size_t s = low; s < high; s++) m_slot_keys[s].store(s_empty_key, std::memory_order_relaxed);
+    });
+
+    // every thread stops at its next boid once the cells overflow, having claimed at most one
+    // slot past the limit, so with fewer threads than max_cells the probing always finds a free
+    // slot. the keys are all there is to synchronize, so relaxed order is enough.
+    const size_t cell_limit = m_slot_keys.size() / 2;
+    const size_t mask = m_slot_keys.size() - 1;
+    std::atomic<size_t> claimed(0);
+    std::atomic<bool> overflow(false);
+
+    parallel_for_ranges(scheduler, positions.size(), [&](size_t, size_t low, size_t high) {
+        for (size_t i = low; i < high && !overflow.load(std::memory_order_relaxed); i++) {
+            const uint64_t key = cell_key(cell_coordinate(positions[i].x), cell_coordinate(positions[i].y));
+
+            size_t slot = home_slot(key);
+            while (true) {
+                uint64_t slot_key = m_slot_keys[slot].load(std::memory_order_relaxed);
+                if (slot_key == s_empty_key &&
+                    m_slot_keys[slot].compare_exchange_strong(slot_key, key, std::memory_order_relaxed)) {
+                    if (claimed.fetch_add(1, std::memory_order_relaxed) >= cell_limit) {
+                        overflow.store(true, std::memory_order_relaxed);
+                    }
+                    break;
+                }
+                // a failed exchange left the key that got there first in slot_key
+                if (slot_key == key) break;
+                slot = (slot + 1) & mask;
+            }
+
+            m_boid_cells[i] = static_cast<uint32_t>(slot);
+        }
+    });
+
+    return !overflow.load(std::memory_order_relaxed);
+}
+
+// the steps are those of QuadTree::insert, with two more in front:
+//   1. each boid claims the table slot of its cell (see claim_slots)
+//   2. the claimed slots are numbered in table order, split over slot ranges
+//   3. counting sort of the boids by bucket and reduction of the pseudoboids, over the buckets
+//      of the cells instead of those of nodes
+void SparseGrid::insert(const BoidCollection& boids, Scheduler& scheduler)
+{
+    const UninitializedVector<V2>& positions = boids.positions();
+    const UninitializedVector<V2>& velocities = boids.velocities();
+    const size_t boid_count = boids.grid_population();
+    const size_t thread_count = scheduler.thread_count();
+    m_species_count = boids.species_count();
+    const size_t species_count = m_species_count;
+    const std::vector<size_t>& species_offsets = boids.species_offsets();
+    assert(thread_count < s_min_table_cells && boid_count * species_count < s_no_cell);
+
+    for (UninitializedVector<float>* vec : {&m_pos_x, &m_pos_y, &m_vel_x, &m_vel_y}) vec->resize(boid_count);
+    m_boid_cells.resize(boid_count);
+
+    // sized for twice the cells of the last insert, and when the flock spread out further than
+    // that, for four times as many again until it fits. a table for as many cells as boids
+    // always does, no matter how the boids are spread.
+    size_t max_cells = std::max(2 * m_cell_count, s_min_table_cells);
+    while (!claim_slots(positions, max_cells, scheduler)) {
+        max_cells = std::max(std::min(4 * max_cells, boid_count), s_min_table_cells);
+    }
+
+    const size_t slot_count = m_slot_keys.size();
+    m_range_totals.assign(thread_count, 0);
+
+    parallel_for_ranges(scheduler, slot_count, [&](size_t r, size_t low, size_t high) {
+        size_t occupied = 0;
+        for (size_t s = low; s < high; s++) {
+            occupied += m_slot_keys[s].load(std::memory_order_relaxed) != s_empty_key ? 1 : 0;
+        }
+        m_range_totals[r] = occupied;
+    });
+
+    parallel_for_ranges(scheduler, slot_count, [&](size_t r, size_t low, size_t high) {
+        size_t cell = 0;
+        for (size_t i = 0; i < r; i++) {
+            cell += m_range_totals[i];
+        }
+
+        for (size_t s = low; s < high; s++) {
+            const bool occupied = m_slot_keys[s].load(std::memory_order_relaxed) != s_empty_key;
+            m_slot_cells[s] = occupied ? static_cast<uint32_t>(cell++) : s_no_cell;
+        }
+    });
+
+    m_cell_count = 0;
+    for (size_t total : m_range_totals) m_cell_count += total;
+    const size_t cell_count = m_cell_count;
+
+    const size_t bucket_count = cell_count * species_count;
+
+    m_cell_offsets.resize(bucket_count + 1);
+    m_pseudoboids.resize(bucket_count);
+    m_cell_cursors.assign(thread_count * bucket_count, 0);
+
+    // ghosts count as the last species, the only one a collection with ghosts has
+    parallel_for_ranges(scheduler, boid_count, [&](size_t t, size_t low, size_t high) {
+        size_t* counts = &m_cell_cursors[t * bucket_count];
+        size_t species = boids.species_of(low);
+        size_t species_end = species + 1 < species_count ? species_offsets[species + 1] : SIZE_MAX;
+
+        for (size_t i = low; i < high; i++) {
+            while (i >= species_end) {
+                species++;
+                species_end = species + 1 < species_count ? species_offsets[species + 1] : SIZE_MAX;
+            }
+
+            const size_t cell = m_slot_cells[m_boid_cells[i]];
+            const uint32_t bucket = static_cast<uint32_t>(cell * species_count + species);
+            m_boid_cells[i] = bucket;
+            counts[bucket]++;
+        }
+    });
+
+    parallel_for_ranges(scheduler, bucket_count, [&](size_t r, size_t low, size_t high) {
+        size_t total = 0;
+        for (size_t c = low; c < high; c++) {
+            for (size_t t = 0; t < thread_count; t++) {
+                total += m_cell_cursors[t * bucket_count + c];
+            }
+        }
+        m_range_totals[r] = total;
+    });
+
+    parallel_for_ranges(scheduler, bucket_count, [&](size_t r, size_t low, size_t high) {
+        size_t offset = 0;
+        for (size_t i = 0; i < r; i++) {
+            offset += m_range_totals[i];
+        }
+
+        for (size_t c = low; c < high; c++) {
+            m_cell_offsets[c] = offset;
+            for (size_t t = 0; t < thread_count; t++) {
+                size_t& cursor = m_cell_cursors[t * bucket_count + c];
+                const size_t count = cursor;
+                cursor = offset;
+                offset += count;
+            }
+        }
+    });
+    m_cell_offsets[bucket_count] = boid_count;
+
+    parallel_for_ranges(scheduler, boid_count, [&](size_t t, size_t low, size_t high) {
+        size_t* cursors = &m_cell_cursors[t * bucket_count];
+        for (size_t i = low; i < high; i++) {
+            const size_t slot = cursors[m_boid_cells[i]]++;
+            m_pos_x[slot] = positions[i].x;
+            m_pos_y[slot] = positions[i].y;
+            m_vel_x[slot] = velocities[i].x;
+            m_vel_y[slot] = velocities[i].y;
+        }
+    });
+
+    parallel_for_ranges(scheduler, bucket_count, [&](size_t, size_t low, size_t high) {
+        for (size_t c = low; c < high; c++) {
+            const size_t begin = m_cell_offsets[c];
+            const size_t end = m_cell_offsets[c + 1];
+
+            if (begin == end) {
+                m_pseudoboids[c] = PseudoBoid();
+                continue;
+            }
+
+            V2 pos_sum = V2::null();
+            V2 vel_sum = V2::null();
+            for (size_t i = begin; i < end; i++) {
+                pos_sum += {m_pos_x[i], m_pos_y[i]};
+                vel_sum += {m_vel_x[i], m_vel_y[i]};
+            }
+
+            const float count = static_cast<float>(end - begin);
+            m_pseudoboids[c] = PseudoBoid(pos_sum / count, vel_sum / count, count);
+        }
+    });
+}
+
+void SparseGrid::place_pages(Scheduler& scheduler)
+{
+    for (UninitializedVector<float>* vec : {&m_pos_x, &m_pos_y, &m_vel_x, &m_vel_y}) {
+        ::place_pages(scheduler, *vec);
+    }
+    ::place_pages(scheduler, m_boid_cells);
+    ::place_pages(scheduler, m_cell_offsets);
+    ::place_pages(scheduler, m_pseudoboids);
+}
+
+size_t SparseGrid::memory_bytes(void) const
+{
+    size_t bytes = (m_pos_x.capacity() + m_pos_y.capacity() + m_vel_x.capacity() + m_vel_y.capacity()) *
+                   sizeof(float);
+    bytes += (m_cell_offsets.capacity() + m_cell_cursors.capacity() + m_range_totals.capacity()) *
+             sizeof(size_t);
+    bytes += m_pseudoboids.capacity() * sizeof(PseudoBoid);
+    bytes += m_slot_keys.capacity() * sizeof(uint64_t) + m_slot_cells.capacity() * sizeof(uint32_t);
+    bytes += m_boid_cells.capacity() * sizeof(uint32_t);
+    return bytes;
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+#include "parallel.hpp"
+#include "quad_tree.hpp"
+#include "scheduler.hpp"
+#include "v2.hpp"
+
+class BoidCollection;
+
+// a uniform grid of square cells, like the nodes of QuadTree, except that only the cells holding
+// boids exist. they are found through an open addressing hash table keyed by their coordinates,
+// so memory and rebuild time grow with the number of boids and occupied cells rather than with
+// the area of the domain, and the grid itself has no bounds at all.
+//
+// the neighbor queries are those of QuadTree's fixed stencil: the same visitors, the same
+// neighborhood and the same node cap, so the two are interchangeable for BoidCollection::update.
+// there is no cell hierarchy though, so no Barnes-Hut search, and no compact storage mode.
+class SparseGrid {
+    // boid positions/velocities sorted by cell and then species, so that bucket b = cell *
+    // m_species_count + species owns the slice [m_cell_offsets[b], m_cell_offsets[b + 1]). cells are
+    // numbered in the order of their table slots
+    UninitializedVector<float> m_pos_x;
+    UninitializedVector<float> m_pos_y;
+    UninitializedVector<float> m_vel_x;
+    UninitializedVector<float> m_vel_y;
+    UninitializedVector<size_t> m_cell_offsets;  // m_cell_count * m_species_count + 1 entries
+    UninitializedVector<PseudoBoid> m_pseudoboids;  // per bucket
+
+    // the hash table, probed linearly from the hash of a cell's key. slot s holds the key of a
+    // cell in m_slot_keys[s] (s_empty_key if none) and the cell's index in m_slot_cells[s]. the
+    // keys are atomic so that insert can claim slots from all threads at once.
+    std::vector<std::atomic<uint64_t>> m_slot_keys;
+    std::vector<uint32_t> m_slot_cells;
+    int m_slot_bits = 0;  // log2 of the slot count
+
+    // scratch space for insert, kept around to avoid reallocating every frame
+    UninitializedVector<uint32_t> m_boid_cells;  // table slot of each inserted boid, then its bucket index
+    std::vector<size_t> m_cell_cursors;  // per thread bucket counts, then next free slots
+    std::vector<size_t> m_range_totals;  // cells or members per range
+
+    size_t m_cell_count = 0;
+    size_t m_species_count = 1;  // of the boids of the last insert
+    float m_cell_span;
+    float m_radius_squared;
+    size_t m_node_cap = QuadTree::s_default_node_cap;
+
+    static constexpr uint64_t s_empty_key = UINT64_MAX;
+    static constexpr uint32_t s_no_cell = UINT32_MAX;
+
+    // the table never holds fewer slots than twice this, which also has to stay above the
+    // thread count (see claim_slots)
+    static constexpr size_t s_min_table_cells = 1024;
+
+    // cell coordinates are clamped to +-2^30, far beyond where floats can still tell the cells
+    // apart, and biased to 32 bit unsigned values. those are never all ones, so neither is a key.
+    static constexpr float s_max_cell_coordinate = 1073741824.f;
+
+    static inline uint64_t cell_key(int32_t x, int32_t y)
+    {
+        const uint32_t bias = 0x80000000u;
+        const uint64_t biased_x = static_cast<uint32_t>(x) + bias;
+        return (biased_x << 32) | (static_cast<uint32_t>(y) + bias);
+    }
+
+    inline int32_t cell_coordinate(float x) const
+    {
+        const float cell = std::floor(x / m_cell_span);
+        return static_cast<int32_t>(
+            std::min(s_max_cell_coordinate, std::max(-s_max_cell_coordinate, cell)));
+    }
+
+    // fibonacci hashing, the top bits of the key times 2^64 / golden ratio
+    inline size_t home_slot(uint64_t key) const
+    {
+        return static_cast<size_t>((key * 0x9e3779b97f4a7c15ull) >> (64 - m_slot_bits));
+    }
+
+    inline uint32_t find_cell(int32_t x, int32_t y) const
+    {
+        if (m_cell_count == 0) return s_no_cell;
+
+        const uint64_t key = cell_key(x, y);
+        const size_t mask = m_slot_keys.size() - 1;
+        for (size_t slot = home_slot(key);; slot = (slot + 1) & mask) {
+            const uint64_t slot_key = m_slot_keys[slot].load(std::memory_order_relaxed);
+            if (slot_key == key) return m_slot_cells[slot];
+            if (slot_key == s_empty_key) return s_no_cell;
+        }
+    }
+
+    inline size_t bucket_population(size_t bucket) const
+    {
+        return m_cell_offsets[bucket + 1] - m_cell_offsets[bucket];
+    }
+
+    inline NodeSpan bucket_members(size_t bucket) const
+    {
+        const size_t begin = m_cell_offsets[bucket];
+        const size_t end = m_cell_offsets[bucket + 1];
+        return {&m_pos_x[begin], &m_pos_y[begin], &m_vel_x[begin], &m_vel_y[begin], end - begin};
+    }
+
+    bool claim_slots(const UninitializedVector<V2>& positions, size_t max_cells, Scheduler& scheduler);
+
+    // the stencil of QuadTree::for_each_neighbor
+    static constexpr int s_fine_grain_node_limit = 0;
+    static constexpr int s_coarse_grain_node_limit = 1;
+
+public:
+    SparseGrid(void) : SparseGrid(WinProps::boid_span / 128.f) {}
+
+    // the effect radius starts out at half a cell
+    explicit SparseGrid(float cell_span)
+        : m_cell_span(cell_span), m_radius_squared(0.25f * cell_span * cell_span)
+    {
+        assert(cell_span > 0.f);
+    }
+
+    // the same parallel counting sort as QuadTree::insert, over the occupied cells only. the
+    // cells are found by claiming table slots from all threads at once, so which of two colliding
+    // cells gets the earlier slot (and index) can change from run to run. nothing depends on it:
+    // every cell's members stay in their original order, and queries look cells up by position.
+    void insert(const BoidCollection& boids, Scheduler& scheduler);
+
+    // see QuadTree::place_pages. the table isn't moved, it's small next to the boid arrays
+    void place_pages(Scheduler& scheduler);
+
+    // see QuadTree::for_each_neighbor. fine_visitor is only ever called with a NodeSpan
+    template <typename FineVisitor, typename CoarseVisitor>
+    void for_each_neighbor(V2 pos, FineVisitor&& fine_visitor, CoarseVisitor&& coarse_visitor) const
+    {
+        for_each_species_neighbor(
+            pos, UINT32_MAX, [&](size_t, const NodeSpan& node) { fine_visitor(node); },
+            [&](size_t, const PseudoBoid& pb) { coarse_visitor(pb); });
+    }
+
+    // see QuadTree::for_each_species_neighbor
+    template <typename FineVisitor, typename CoarseVisitor>
+    void for_each_species_neighbor(V2 pos, uint32_t species_mask, FineVisitor&& fine_visitor,
+                                   CoarseVisitor&& coarse_visitor) const;
+
+    float effect_radius_squared(void) const { return m_radius_squared; }
+    void set_effect_radius(float radius) { m_radius_squared = radius * radius; }
+    void set_effect_radius_squared(float radius_squared) { m_radius_squared = radius_squared; }
+
+    void set_node_cap(size_t cap) { m_node_cap = cap; }
+    size_t node_cap(void) const { return m_node_cap; }
+
+    // see QuadTree::crowd_at
+    inline const PseudoBoid* crowd_at(V2 pos, size_t species) const
+    {
+        const uint32_t cell = find_cell(cell_coordinate(pos.x), cell_coordinate(pos.y));
+        if (cell == s_no_cell) return nullptr;
+        const size_t bucket = cell * m_species_count + species;
+        return m_node_cap > 0 && bucket_population(bucket) > m_node_cap ? &m_pseudoboids[bucket] : nullptr;
+    }
+
+    float cell_span(void) const { return m_cell_span; }
+    size_t species_count(void) const { return m_species_count; }
+
+    // cells holding boids after the last insert, and the slots of the table finding them
+    size_t cell_count(void) const { return m_cell_count; }
+    size_t table_slots(void) const { return m_slot_keys.size(); }
+
+    // bytes held by the grid's arrays, scratch space included
+    size_t memory_bytes(void) const;
+
+    // the grid stores exact copies, neighbors see a boid just where it is
+    inline V2 stored_position(V2 pos) const { return pos; }
+    inline V2 stored_velocity(V2 vel) const { return vel; }
+};
+
+template <typename FineVisitor, typename CoarseVisitor>
+void SparseGrid::for_each_species_neighbor(V2 pos, uint32_t species_mask, FineVisitor&& fine_visitor,
+                                           CoarseVisitor&& coarse_visitor) const
+{
+    const int32_t focus_x = cell_coordinate(pos.x);
+    const int32_t focus_y = cell_coordinate(pos.y);
+    auto in_mask = [=](size_t species) { return ((species_mask >> species) & 1) != 0; };
+
+    for (int i = -s_fine_grain_node_limit; i <= s_fine_grain_node_limit; i++) {
+        for (int j = -s_fine_grain_node_limit; j <= s_fine_grain_node_limit; j++) {
+            const uint32_t cell = find_cell(focus_x + i, focus_y + j);
+            if (cell == s_no_cell) continue;
+
+            for (size_t species = 0; species < m_species_count; species++) {
+                const size_t bucket = cell * m_species_count + species;
+                const size_t population = bucket_population(bucket);
+                if (!in_mask(species) || population == 0) continue;
+
+                if (m_node_cap > 0 && population > m_node_cap) {
+                    coarse_visitor(species, m_pseudoboids[bucket]);
+                }
+                else {
+                    fine_visitor(species, bucket_members(bucket));
+                }
+            }
+        }
+    }
+
+    auto advance_coarse_cell_index = [](int idx) -> int {
+        return idx == -s_fine_grain_node_limit - 1 ? s_fine_grain_node_limit + 1 : idx + 1;
+    };
+
+    for (int i = -s_coarse_grain_node_limit; i <= s_coarse_grain_node_limit;
+         i = advance_coarse_cell_index(i)) {
+        for (int j = -s_coarse_grain_node_limit; j <= s_coarse_grain_node_limit;
+             j = advance_coarse_cell_index(j)) {
+            // empty cells don't exist, but with several species a cell can still lack some of them
+            const uint32_t cell = find_cell(focus_x + i, focus_y + j);
+            if (cell == s_no_cell) continue;
+
+            for (size_t species = 0; species < m_species_count; species++) {
+                const size_t bucket = cell * m_species_count + species;
+                if (in_mask(species) && bucket_population(bucket) > 0) {
+                    coarse_visitor(species, m_pseudoboids[bucket]);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,149 @@
+#include "topology.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <thread>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+// parse a sysfs cpu list like "0-3,8,10-11"
+static std::vector<int> parse_cpu_list(const char* list)
+{
+    std::vector<int> cpus;
+    const char* p = list;
+
+    while (*p != '\0' && *p != '\n') {
+        char* end = nullptr;
+        const long first = strtol(p, &end, 10);
+        if (end == p) break;
+
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+
+        for (long cpu = first; cpu <= last; cpu++) cpus.push_back(static_cast<int>(cpu));
+        if (*p == ',') p++;
+    }
+
+    return cpus;
+}
+
+// "0-3,8" style description of a sorted cpu list
+static std::string format_cpu_list(const std::vector<int>& cpus)
+{
+    std::string result;
+    char buffer[32];
+
+    for (size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) j++;
+
+        if (j == i) {
+            snprintf(buffer, sizeof(buffer), "%s%d", result.empty() ? "" : ",", cpus[i]);
+        }
+        else {
+            snprintf(buffer, sizeof(buffer), "%s%d-%d", result.empty() ? "" : ",", cpus[i], cpus[j]);
+        }
+        result += buffer;
+        i = j + 1;
+    }
+
+    return result;
+}
+
+Topology Topology::detect(void)
+{
+    Topology topology;
+
+#if defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    const bool have_affinity = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    auto is_allowed = [&](int cpu) {
+        return !have_affinity || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed));
+    };
+
+    std::vector<int> node_ids;
+    if (DIR* dir = opendir("/sys/devices/system/node")) {
+        while (const dirent* entry = readdir(dir)) {
+            int id = 0;
+            if (sscanf(entry->d_name, "node%d", &id) == 1) node_ids.push_back(id);
+        }
+        closedir(dir);
+    }
+    std::sort(node_ids.begin(), node_ids.end());
+
+    for (int id : node_ids) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", id);
+
+        FILE* file = fopen(path, "r");
+        if (!file) continue;
+
+        char line[4096] = {0};
+        const bool read_ok = fgets(line, sizeof(line), file) != nullptr;
+        fclose(file);
+        if (!read_ok) continue;
+
+        std::vector<int> cpus;
+        for (int cpu : parse_cpu_list(line)) {
+            if (is_allowed(cpu)) cpus.push_back(cpu);
+        }
+
+        // memory-only nodes, or nodes this process isn't allowed on
+        if (!cpus.empty()) topology.node_cpus.push_back(cpus);
+    }
+
+    if (topology.node_cpus.empty() && have_affinity) {
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+        }
+        if (!cpus.empty()) topology.node_cpus.push_back(cpus);
+    }
+#endif
+
+    if (topology.node_cpus.empty()) {
+        std::vector<int> cpus(std::max(1u, std::thread::hardware_concurrency()));
+        for (size_t i = 0; i < cpus.size(); i++) cpus[i] = static_cast<int>(i);
+        topology.node_cpus.push_back(cpus);
+    }
+
+    return topology;
+}
+
+std::vector<int> Topology::compact_cpus(size_t thread_count) const
+{
+    std::vector<int> all;
+    for (const std::vector<int>& cpus : node_cpus) all.insert(all.end(), cpus.begin(), cpus.end());
+
+    // with more threads than cpus, wrap around and double up in the same order
+    std::vector<int> result(thread_count);
+    for (size_t t = 0; t < thread_count; t++) result[t] = all[t % all.size()];
+    return result;
+}
+
+int Topology::node_of_cpu(int cpu) const
+{
+    for (size_t n = 0; n < node_cpus.size(); n++) {
+        if (std::find(node_cpus[n].begin(), node_cpus[n].end(), cpu) != node_cpus[n].end()) {
+            return static_cast<int>(n);
+        }
+    }
+    return -1;
+}
+
+std::string Topology::describe(void) const
+{
+    std::string result = std::to_string(node_cpus.size()) + (node_cpus.size() == 1 ? " node:" : " nodes:");
+    for (const std::vector<int>& cpus : node_cpus) result += " [" + format_cpu_list(cpus) + "]";
+    return result;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// the NUMA nodes of the machine and the cpus of each one that this process may run on.
+// outside of linux, or when sysfs has no node information, the whole machine is one node.
+struct Topology {
+    std::vector<std::vector<int>> node_cpus;
+
+    static Topology detect(void);
+
+    inline size_t node_count(void) const { return node_cpus.size(); }
+
+    // cpu for each of thread_count threads: consecutive threads fill up one node before
+    // moving on to the next, so a contiguous share of the work stays on one node
+    std::vector<int> compact_cpus(size_t thread_count) const;
+
+    // numa node of the cpu, -1 if it isn't part of the topology
+    int node_of_cpu(int cpu) const;
+
+    // e.g. "2 nodes: [0-7] [8-15]"
+    std::string describe(void) const;
+};
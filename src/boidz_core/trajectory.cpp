@@ -0,0 +1,179 @@
+#include "trajectory.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+
+// differences whose unary part would be this long or longer are stored raw instead
+static constexpr uint32_t s_rice_escape = 24;
+static constexpr uint32_t s_max_rice_parameter = 24;
+
+// small differences of either sign map to small unsigned values: 0, -1, 1, -2, ... -> 0, 1, 2, 3, ...
+static inline uint32_t zigzag(uint32_t difference)
+{
+    return (difference << 1) ^ (0u - (difference >> 31));
+}
+
+static inline uint32_t unzigzag(uint32_t value) { return (value >> 1) ^ (0u - (value & 1)); }
+
+// the Rice code with parameter k is close to optimal for geometrically distributed values with
+// a mean around 2^k, which is what the differences of a coherent flock look like
+static inline uint32_t rice_parameter(uint64_t sum, size_t count)
+{
+    const uint64_t mean = sum / count;
+    const uint32_t k = mean > 0 ? 63 - __builtin_clzll(mean) : 0;
+    return std::min(k, s_max_rice_parameter);
+}
+
+// appends bits least significant first. every put stores all 8 bytes of the buffer and moves on
+// by the whole bytes in it, which needs no branch but writes up to 8 bytes past the output
+class BitWriter {
+    uint8_t* m_next;
+    uint64_t m_bits = 0;
+    uint32_t m_fill = 0;  // always below 8 between puts
+
+public:
+    explicit BitWriter(uint8_t* out) : m_next(out) {}
+
+    // count <= 56
+    inline void put(uint64_t bits, uint32_t count)
+    {
+        m_bits |= bits << m_fill;
+        m_fill += count;
+        memcpy(m_next, &m_bits, sizeof(m_bits));
+        m_next += m_fill >> 3;
+        m_bits >>= m_fill & ~7u;
+        m_fill &= 7;
+    }
+
+    // end of the output, the last partial byte (already stored) padded with zeros
+    inline uint8_t* finish(void) const { return m_next + (m_fill > 0 ? 1 : 0); }
+};
+
+// reads what BitWriter wrote. bytes past the end read as zero, end() tells whether any were used
+class BitReader {
+    const uint8_t* m_next;
+    const uint8_t* m_end;
+    uint64_t m_bits = 0;
+    uint32_t m_fill = 0;
+
+public:
+    BitReader(const uint8_t* begin, const uint8_t* end) : m_next(begin), m_end(end) {}
+
+    // at least 56 bits available afterwards
+    inline void refill(void)
+    {
+        if (m_end - m_next >= 8) {
+            uint64_t word;
+            memcpy(&word, m_next, sizeof(word));
+            m_bits |= word << m_fill;
+            m_next += (63 - m_fill) >> 3;
+            m_fill |= 56;
+        }
+        else {
+            for (; m_fill < 56; m_fill += 8, m_next++) {
+                m_bits |= static_cast<uint64_t>(m_next < m_end ? *m_next : 0) << m_fill;
+            }
+        }
+    }
+
+    inline uint64_t bits(void) const { return m_bits; }
+
+    inline void consume(uint32_t count)
+    {
+        m_bits >>= count;
+        m_fill -= count;
+    }
+
+    // first byte after the bits consumed so far, counting a partly consumed byte as consumed
+    inline const uint8_t* end(void) const { return m_next - m_fill / 8; }
+};
+
+size_t max_coded_frame_bytes(size_t value_count)
+{
+    const size_t block_count = (value_count + s_trajectory_block - 1) / s_trajectory_block;
+    const size_t max_bits = 5 * block_count + (s_rice_escape + 32) * value_count;
+    return sizeof(uint64_t) + (max_bits + 7) / 8 + sizeof(uint64_t);
+}
+
+size_t encode_frame(uint64_t step, const int32_t* frame, const int32_t* previous, size_t value_count,
+                    uint8_t* out)
+{
+    memcpy(out, &step, sizeof(step));
+    BitWriter writer(out + sizeof(step));
+
+    uint32_t block[s_trajectory_block];
+
+    for (size_t low = 0; low < value_count; low += s_trajectory_block) {
+        const size_t count = std::min(s_trajectory_block, value_count - low);
+
+        uint64_t sum = 0;
+        for (size_t i = 0; i < count; i++) {
+            const uint32_t base = previous ? static_cast<uint32_t>(previous[low + i]) : 0;
+            block[i] = zigzag(static_cast<uint32_t>(frame[low + i]) - base);
+            sum += block[i];
+        }
+
+        const uint32_t k = rice_parameter(sum, count);
+        writer.put(k, 5);
+
+        for (size_t i = 0; i < count; i++) {
+            const uint32_t quotient = block[i] >> k;
+            if (quotient < s_rice_escape) {
+                // quotient ones and a zero, then the low k bits
+                const uint64_t low_bits = block[i] & ((1u << k) - 1);
+                writer.put((low_bits << (quotient + 1)) | ((1ull << quotient) - 1), quotient + 1 + k);
+            }
+            else {
+                writer.put((1ull << s_rice_escape) - 1, s_rice_escape);
+                writer.put(block[i], 32);
+            }
+        }
+    }
+
+    return writer.finish() - out;
+}
+
+size_t decode_frame(const uint8_t* data, size_t size, const int32_t* previous, size_t value_count,
+                    int32_t* frame, uint64_t& step)
+{
+    if (size < sizeof(step)) return 0;
+    memcpy(&step, data, sizeof(step));
+
+    BitReader reader(data + sizeof(step), data + size);
+
+    for (size_t low = 0; low < value_count; low += s_trajectory_block) {
+        const size_t count = std::min(s_trajectory_block, value_count - low);
+
+        reader.refill();
+        const uint32_t k = static_cast<uint32_t>(reader.bits() & 31);
+        reader.consume(5);
+
+        for (size_t i = 0; i < count; i++) {
+            reader.refill();
+
+            // the unary part is the number of ones before the first zero, up to the escape
+            const uint64_t zeros = ~reader.bits() | (1ull << s_rice_escape);
+            const uint32_t quotient = static_cast<uint32_t>(__builtin_ctzll(zeros));
+
+            uint32_t value;
+            if (quotient < s_rice_escape) {
+                reader.consume(quotient + 1);
+                value = (quotient << k) | static_cast<uint32_t>(reader.bits() & ((1u << k) - 1));
+                reader.consume(k);
+            }
+            else {
+                reader.consume(s_rice_escape);
+                reader.refill();
+                value = static_cast<uint32_t>(reader.bits());
+                reader.consume(32);
+            }
+
+            const uint32_t base = previous ? static_cast<uint32_t>(previous[low + i]) : 0;
+            frame[low + i] = static_cast<int32_t>(base + unzigzag(value));
+        }
+    }
+
+    const size_t consumed = static_cast<size_t>(reader.end() - data);
+    return consumed <= size ? consumed : 0;
+}
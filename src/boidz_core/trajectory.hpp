@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// a trajectory file records the boid positions of many steps, for offline analysis or playback.
+//
+// layout (little endian, version 1):
+//   TrajectoryHeader
+//   chunks, each a TrajectoryChunkHeader followed by payload_bytes of coded frames
+//   TrajectoryChunkEntry index[chunk_count]
+//   TrajectoryFooter
+//
+// a frame holds the positions of every boid in id order, quantized to multiples of quantum and
+// interleaved x, y. the first frame of a chunk is coded on its own and every later one as the
+// difference to the frame before it, so each chunk decodes without any other, and the index
+// finds the chunk holding any frame. a file whose writer never finished has no index, but its
+// complete chunks can still be found by walking the chunk headers from the start.
+//
+// coded frame: the step (uint64), then the zigzagged differences as Rice codes in blocks of
+// s_trajectory_block values, each block led by its 5 bit Rice parameter, padded to a whole byte.
+// differences too large for the unary part are escaped and stored as raw 32 bit values.
+
+static constexpr uint32_t s_trajectory_version = 1;
+static constexpr size_t s_trajectory_block = 128;
+
+struct TrajectoryHeader {
+    char magic[8];  // "BOIDZTRJ"
+    uint32_t version;
+    uint32_t frames_per_chunk;
+    uint64_t population;
+    uint64_t seed;
+    float quantum;  // positions are stored as whole multiples of quantum
+    float dt;       // simulated seconds per step
+    float domain_span;
+    uint32_t reserved;
+};
+
+struct TrajectoryChunkHeader {
+    char tag[4];  // "CHNK"
+    uint32_t frame_count;  // 0 while the chunk is still being written
+    uint64_t first_frame;
+    uint64_t payload_bytes;
+};
+
+struct TrajectoryChunkEntry {
+    uint64_t offset;  // of the chunk header, from the start of the file
+    uint64_t first_frame;
+    uint64_t first_step;
+};
+
+struct TrajectoryFooter {
+    uint64_t index_offset;
+    uint64_t chunk_count;
+    uint64_t frame_count;
+    char magic[8];  // "BOIDZEND"
+};
+
+static constexpr char TRAJECTORY_MAGIC[8] = {'B', 'O', 'I', 'D', 'Z', 'T', 'R', 'J'};
+static constexpr char TRAJECTORY_CHUNK_TAG[4] = {'C', 'H', 'N', 'K'};
+static constexpr char TRAJECTORY_FOOTER_MAGIC[8] = {'B', 'O', 'I', 'D', 'Z', 'E', 'N', 'D'};
+
+// most bytes encode_frame can produce for value_count values
+size_t max_coded_frame_bytes(size_t value_count);
+
+// codes value_count quantized values, against previous (nullptr for the first frame of a chunk)
+// into out, which must have room for max_coded_frame_bytes. returns the number of bytes written.
+size_t encode_frame(uint64_t step, const int32_t* frame, const int32_t* previous, size_t value_count,
+                    uint8_t* out);
+
+// inverse of encode_frame, reading at most size bytes. returns the number of bytes consumed, or
+// 0 if the frame runs past size.
+size_t decode_frame(const uint8_t* data, size_t size, const int32_t* previous, size_t value_count,
+                    int32_t* frame, uint64_t& step);
@@ -0,0 +1,599 @@
+#include "transport.hpp"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+using namespace std::chrono;
+
+#if defined(__unix__) || defined(__APPLE__)
+#define BOIDZ_HAVE_SOCKETS 1
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// every message starts with its length
+static constexpr size_t s_header_bytes = sizeof(uint64_t);
+
+// no single message comes anywhere near this, a larger length means the stream is garbled
+static constexpr uint64_t s_max_message_bytes = uint64_t(1) << 40;
+
+// one message going out and one coming in over one link, either of them optional
+struct Transport::Transfer {
+    Link* link = nullptr;
+    const std::vector<uint8_t>* out = nullptr;
+    std::vector<uint8_t>* in = nullptr;
+    uint64_t out_length = 0;
+    uint64_t in_length = 0;
+    size_t written = 0;  // bytes of out, length included
+    size_t read = 0;     // bytes of in, length included
+
+    inline bool writing(void) const { return out && written < s_header_bytes + out->size(); }
+    inline bool reading(void) const
+    {
+        return in && (read < s_header_bytes || read < s_header_bytes + in_length);
+    }
+};
+
+Transport::Transport(TransportKind kind, int rank, int rank_count, std::unique_ptr<Link> lower,
+                     std::unique_ptr<Link> upper, std::vector<int> children)
+    : m_kind(kind), m_rank(rank), m_rank_count(rank_count), m_children(std::move(children))
+{
+    assert(rank >= 0 && rank < rank_count);
+    m_links[NS_LOWER] = std::move(lower);
+    m_links[NS_UPPER] = std::move(upper);
+}
+
+Transport::~Transport(void) { join(); }
+
+bool Transport::transfer(Transfer* transfers, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (transfers[i].out) transfers[i].out_length = transfers[i].out->size();
+    }
+
+    while (true) {
+        bool busy = false;
+        bool progress = false;
+
+        for (size_t i = 0; i < count; i++) {
+            Transfer& t = transfers[i];
+
+            if (t.writing()) {
+                const uint8_t* data;
+                size_t left;
+                if (t.written < s_header_bytes) {
+                    data = reinterpret_cast<const uint8_t*>(&t.out_length) + t.written;
+                    left = s_header_bytes - t.written;
+                }
+                else {
+                    data = t.out->data() + (t.written - s_header_bytes);
+                    left = t.out->size() - (t.written - s_header_bytes);
+                }
+
+                const ptrdiff_t moved = t.link->write_some(data, left);
+                if (moved < 0) return false;
+                t.written += moved;
+                m_bytes_sent += moved;
+                progress = progress || moved > 0;
+            }
+
+            if (t.reading()) {
+                uint8_t* data;
+                size_t left;
+                if (t.read < s_header_bytes) {
+                    data = reinterpret_cast<uint8_t*>(&t.in_length) + t.read;
+                    left = s_header_bytes - t.read;
+                }
+                else {
+                    data = t.in->data() + (t.read - s_header_bytes);
+                    left = t.in_length - (t.read - s_header_bytes);
+                }
+
+                const ptrdiff_t moved = t.link->read_some(data, left);
+                if (moved < 0) return false;
+                t.read += moved;
+                progress = progress || moved > 0;
+
+                if (moved > 0 && t.read == s_header_bytes) {
+                    if (t.in_length > s_max_message_bytes) return false;
+                    t.in->resize(t.in_length);
+                }
+            }
+
+            busy = busy || t.writing() || t.reading();
+        }
+
+        if (!busy) return true;
+        if (!progress) wait(transfers, count);
+    }
+}
+
+// poll the sockets for whatever the transfers wait on, or just make way for other processes
+// while a shared memory link has nothing to move
+void Transport::wait(const Transfer* transfers, size_t count) const
+{
+#ifdef BOIDZ_HAVE_SOCKETS
+    struct pollfd fds[NS_COUNT];
+    size_t fd_count = 0;
+    bool pollable = true;
+
+    for (size_t i = 0; i < count && pollable; i++) {
+        const Transfer& t = transfers[i];
+        if (!t.writing() && !t.reading()) continue;
+
+        const int fd = t.link->poll_fd();
+        pollable = fd >= 0 && fd_count < NS_COUNT;
+        if (!pollable) break;
+
+        fds[fd_count].fd = fd;
+        fds[fd_count].events = static_cast<short>((t.writing() ? POLLOUT : 0) | (t.reading() ? POLLIN : 0));
+        fds[fd_count].revents = 0;
+        fd_count++;
+    }
+
+    if (pollable && fd_count > 0) {
+        poll(fds, fd_count, -1);
+        return;
+    }
+#else
+    (void)transfers;
+    (void)count;
+#endif
+
+    std::this_thread::yield();
+}
+
+bool Transport::exchange(const std::vector<uint8_t> out[NS_COUNT], std::vector<uint8_t> in[NS_COUNT])
+{
+    Transfer transfers[NS_COUNT];
+    size_t count = 0;
+
+    for (int side = 0; side < NS_COUNT; side++) {
+        if (!m_links[side]) {
+            in[side].clear();
+            continue;
+        }
+
+        Transfer& t = transfers[count++];
+        t.link = m_links[side].get();
+        t.out = &out[side];
+        t.in = &in[side];
+    }
+
+    return transfer(transfers, count);
+}
+
+bool Transport::send(NeighborSide side, const std::vector<uint8_t>& message)
+{
+    assert(m_links[side]);
+
+    Transfer t;
+    t.link = m_links[side].get();
+    t.out = &message;
+    return transfer(&t, 1);
+}
+
+bool Transport::receive(NeighborSide side, std::vector<uint8_t>& message)
+{
+    assert(m_links[side]);
+
+    Transfer t;
+    t.link = m_links[side].get();
+    t.in = &message;
+    return transfer(&t, 1);
+}
+
+bool Transport::join(void)
+{
+    for (std::unique_ptr<Link>& link : m_links) link.reset();
+
+    bool clean = true;
+#ifdef BOIDZ_HAVE_SOCKETS
+    for (int pid : m_children) {
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        }
+        clean = clean && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+#endif
+    m_children.clear();
+
+    return clean;
+}
+
+#ifdef BOIDZ_HAVE_SOCKETS
+
+namespace {
+
+// single producer, single consumer byte ring in memory shared between two processes. head and
+// tail count every byte ever written and read, so the ring is empty when they're equal and
+// full when they're capacity apart. mmap hands out zeroed memory, which is its empty state.
+struct SharedRing {
+    static constexpr size_t capacity = size_t(1) << 22;
+
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+    alignas(64) std::atomic<uint32_t> closed;  // set by either end when it goes away
+    alignas(64) uint8_t data[capacity];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+              "the rings are shared between processes, their atomics can't hide a lock");
+
+// the rings of all links, mapped before forking so that every rank sees the same pages
+class SharedRegion {
+    void* m_base;
+    size_t m_bytes;
+
+public:
+    SharedRegion(void* base, size_t bytes) : m_base(base), m_bytes(bytes) {}
+    ~SharedRegion(void) { munmap(m_base, m_bytes); }
+
+    SharedRegion(const SharedRegion&) = delete;
+    SharedRegion& operator=(const SharedRegion&) = delete;
+
+    static std::shared_ptr<SharedRegion> create(size_t ring_count)
+    {
+        const size_t bytes = std::max<size_t>(1, ring_count) * sizeof(SharedRing);
+        void* base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) return nullptr;
+        return std::make_shared<SharedRegion>(base, bytes);
+    }
+
+    inline SharedRing* ring(size_t index) const { return static_cast<SharedRing*>(m_base) + index; }
+};
+
+class SharedMemoryLink final : public Link {
+    std::shared_ptr<SharedRegion> m_region;
+    SharedRing* m_out;
+    SharedRing* m_in;
+
+public:
+    SharedMemoryLink(std::shared_ptr<SharedRegion> region, SharedRing* out, SharedRing* in)
+        : m_region(std::move(region)), m_out(out), m_in(in)
+    {
+    }
+
+    // a rank that goes down without running this (a crash) leaves its neighbors waiting
+    ~SharedMemoryLink(void) override
+    {
+        m_out->closed.store(1, std::memory_order_release);
+        m_in->closed.store(1, std::memory_order_release);
+    }
+
+    ptrdiff_t write_some(const void* data, size_t bytes) override
+    {
+        if (m_out->closed.load(std::memory_order_acquire)) return -1;
+
+        const uint64_t head = m_out->head.load(std::memory_order_relaxed);
+        const uint64_t tail = m_out->tail.load(std::memory_order_acquire);
+        const size_t moved = std::min<size_t>(bytes, SharedRing::capacity - (head - tail));
+
+        const size_t start = head % SharedRing::capacity;
+        const size_t first = std::min(moved, SharedRing::capacity - start);
+        memcpy(m_out->data + start, data, first);
+        memcpy(m_out->data, static_cast<const uint8_t*>(data) + first, moved - first);
+
+        m_out->head.store(head + moved, std::memory_order_release);
+        return static_cast<ptrdiff_t>(moved);
+    }
+
+    // whatever the other end wrote before closing can still be read
+    ptrdiff_t read_some(void* data, size_t bytes) override
+    {
+        const bool closed = m_in->closed.load(std::memory_order_acquire);
+        const uint64_t tail = m_in->tail.load(std::memory_order_relaxed);
+        const uint64_t head = m_in->head.load(std::memory_order_acquire);
+        const size_t moved = std::min<size_t>(bytes, head - tail);
+        if (moved == 0 && closed && bytes > 0) return -1;
+
+        const size_t start = tail % SharedRing::capacity;
+        const size_t first = std::min(moved, SharedRing::capacity - start);
+        memcpy(data, m_in->data + start, first);
+        memcpy(static_cast<uint8_t*>(data) + first, m_in->data, moved - first);
+
+        m_in->tail.store(tail + moved, std::memory_order_release);
+        return static_cast<ptrdiff_t>(moved);
+    }
+};
+
+class SocketLink final : public Link {
+    int m_fd;
+
+public:
+    explicit SocketLink(int fd) : m_fd(fd) { fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK); }
+    ~SocketLink(void) override { close(m_fd); }
+
+    ptrdiff_t write_some(const void* data, size_t bytes) override
+    {
+#ifdef MSG_NOSIGNAL
+        const ssize_t moved = ::send(m_fd, data, bytes, MSG_NOSIGNAL);
+#else
+        const ssize_t moved = ::send(m_fd, data, bytes, 0);
+#endif
+        if (moved >= 0) return moved;
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    }
+
+    ptrdiff_t read_some(void* data, size_t bytes) override
+    {
+        const ssize_t moved = ::recv(m_fd, data, bytes, 0);
+        if (moved > 0) return moved;
+        if (moved == 0) return -1;
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    }
+
+    int poll_fd(void) const override { return m_fd; }
+};
+
+}  // namespace
+
+std::unique_ptr<Transport> fork_ranks(TransportKind kind, int rank_count)
+{
+    assert(kind == TK_SHM || kind == TK_UNIX);
+    assert(rank_count >= 1);
+
+    // link i joins rank i (on its upper side) with rank i + 1. on shared memory it's rings 2i,
+    // written by rank i, and 2i + 1, written by rank i + 1
+    const int link_count = rank_count - 1;
+    std::shared_ptr<SharedRegion> region;
+    std::vector<int> fds;
+
+    if (kind == TK_SHM) {
+        region = SharedRegion::create(2 * static_cast<size_t>(link_count));
+        if (!region) return nullptr;
+    }
+    else {
+        for (int i = 0; i < link_count; i++) {
+            int pair[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+                for (int fd : fds) close(fd);
+                return nullptr;
+            }
+            fds.push_back(pair[0]);
+            fds.push_back(pair[1]);
+        }
+    }
+
+#ifndef MSG_NOSIGNAL
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    // anything still buffered would be written once by every process
+    fflush(nullptr);
+
+    int rank = 0;
+    std::vector<int> children;
+    for (int r = 1; r < rank_count; r++) {
+        const pid_t pid = fork();
+        if (pid == 0) {
+            rank = r;
+            children.clear();
+            break;
+        }
+
+        if (pid < 0) {
+            for (int fd : fds) close(fd);
+            for (int child : children) kill(child, SIGTERM);
+            for (int child : children) waitpid(child, nullptr, 0);
+            return nullptr;
+        }
+        children.push_back(pid);
+    }
+
+    std::unique_ptr<Link> links[NS_COUNT];
+    const int lower_link = rank - 1;
+    const int upper_link = rank;
+
+    if (kind == TK_SHM) {
+        if (rank > 0) {
+            links[NS_LOWER].reset(
+                new SharedMemoryLink(region, region->ring(2 * lower_link + 1), region->ring(2 * lower_link)));
+        }
+        if (rank + 1 < rank_count) {
+            links[NS_UPPER].reset(
+                new SharedMemoryLink(region, region->ring(2 * upper_link), region->ring(2 * upper_link + 1)));
+        }
+    }
+    else {
+        for (int i = 0; i < 2 * link_count; i++) {
+            const bool lower_end = i == 2 * lower_link + 1;
+            const bool upper_end = i == 2 * upper_link;
+            if (lower_end) links[NS_LOWER].reset(new SocketLink(fds[i]));
+            if (upper_end) links[NS_UPPER].reset(new SocketLink(fds[i]));
+            if (!lower_end && !upper_end) close(fds[i]);
+        }
+    }
+
+    return std::unique_ptr<Transport>(new Transport(kind, rank, rank_count, std::move(links[NS_LOWER]),
+                                                    std::move(links[NS_UPPER]), std::move(children)));
+}
+
+// blocking, for the handshake before the socket is handed to a link
+static bool send_all(int fd, const void* data, size_t bytes)
+{
+    const uint8_t* bytes_left = static_cast<const uint8_t*>(data);
+    while (bytes > 0) {
+        const ssize_t moved = ::send(fd, bytes_left, bytes, 0);
+        if (moved < 0 && errno == EINTR) continue;
+        if (moved <= 0) return false;
+        bytes_left += moved;
+        bytes -= moved;
+    }
+    return true;
+}
+
+static bool receive_all(int fd, void* data, size_t bytes)
+{
+    uint8_t* bytes_left = static_cast<uint8_t*>(data);
+    while (bytes > 0) {
+        const ssize_t moved = ::recv(fd, bytes_left, bytes, 0);
+        if (moved < 0 && errno == EINTR) continue;
+        if (moved <= 0) return false;
+        bytes_left += moved;
+        bytes -= moved;
+    }
+    return true;
+}
+
+static bool split_peer(const std::string& peer, std::string& host, std::string& port)
+{
+    const size_t colon = peer.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == peer.size()) return false;
+    host = peer.substr(0, colon);
+    port = peer.substr(colon + 1);
+    return true;
+}
+
+// the rank above announces itself with its rank and the rank count it was started with
+struct TcpHello {
+    int32_t rank;
+    int32_t rank_count;
+};
+
+std::unique_ptr<Transport> connect_tcp(int rank, const std::vector<std::string>& peers,
+                                       double timeout_seconds)
+{
+    const int rank_count = static_cast<int>(peers.size());
+    assert(rank >= 0 && rank < rank_count);
+
+    signal(SIGPIPE, SIG_IGN);
+    const auto deadline = steady_clock::now() + duration_cast<steady_clock::duration>(
+                                                    duration<double>(std::max(0.0, timeout_seconds)));
+
+    std::string host, port;
+    for (const std::string& peer : peers) {
+        if (!split_peer(peer, host, port)) {
+            fprintf(stderr, "peer '%s' isn't of the form host:port\n", peer.c_str());
+            return nullptr;
+        }
+    }
+
+    auto resolve = [&](const std::string& peer, bool passive) -> addrinfo* {
+        split_peer(peer, host, port);
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+        addrinfo* info = nullptr;
+        const int error = getaddrinfo(passive ? nullptr : host.c_str(), port.c_str(), &hints, &info);
+        if (error != 0) {
+            fprintf(stderr, "can't resolve '%s': %s\n", peer.c_str(), gai_strerror(error));
+            return nullptr;
+        }
+        return info;
+    };
+
+    // listen first, so that the rank above can connect while this one is still connecting below
+    int listen_fd = -1;
+    if (rank + 1 < rank_count) {
+        addrinfo* info = resolve(peers[rank], true);
+        if (!info) return nullptr;
+
+        listen_fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        const int reuse = 1;
+        const bool listening = listen_fd >= 0 &&
+                               setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == 0 &&
+                               bind(listen_fd, info->ai_addr, info->ai_addrlen) == 0 &&
+                               listen(listen_fd, 1) == 0;
+        freeaddrinfo(info);
+
+        if (!listening) {
+            fprintf(stderr, "can't listen on '%s': %s\n", peers[rank].c_str(), strerror(errno));
+            if (listen_fd >= 0) close(listen_fd);
+            return nullptr;
+        }
+    }
+
+    auto fail = [&](int fd) -> std::unique_ptr<Transport> {
+        if (fd >= 0) close(fd);
+        if (listen_fd >= 0) close(listen_fd);
+        return nullptr;
+    };
+
+    auto set_no_delay = [](int fd) {
+        const int no_delay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    };
+
+    std::unique_ptr<Link> links[NS_COUNT];
+
+    if (rank > 0) {
+        addrinfo* info = resolve(peers[rank - 1], false);
+        if (!info) return fail(-1);
+
+        int fd = -1;
+        while (true) {
+            fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+            if (fd >= 0 && connect(fd, info->ai_addr, info->ai_addrlen) == 0) break;
+            if (fd >= 0) close(fd);
+            fd = -1;
+            if (steady_clock::now() >= deadline) break;
+            std::this_thread::sleep_for(milliseconds(100));
+        }
+        freeaddrinfo(info);
+
+        const TcpHello hello = {rank, rank_count};
+        if (fd < 0 || !send_all(fd, &hello, sizeof(hello))) {
+            fprintf(stderr, "can't connect to rank %d at '%s'\n", rank - 1, peers[rank - 1].c_str());
+            return fail(fd);
+        }
+        set_no_delay(fd);
+        links[NS_LOWER].reset(new SocketLink(fd));
+    }
+
+    if (listen_fd >= 0) {
+        const double wait_ms =
+            duration_cast<duration<double, std::milli>>(deadline - steady_clock::now()).count();
+        struct pollfd pfd = {listen_fd, POLLIN, 0};
+        const int fd = poll(&pfd, 1, static_cast<int>(std::max(0.0, wait_ms))) == 1
+                           ? accept(listen_fd, nullptr, nullptr)
+                           : -1;
+
+        TcpHello hello = {-1, -1};
+        if (fd < 0 || !receive_all(fd, &hello, sizeof(hello))) {
+            fprintf(stderr, "rank %d never connected to '%s'\n", rank + 1, peers[rank].c_str());
+            return fail(fd);
+        }
+        if (hello.rank != rank + 1 || hello.rank_count != rank_count) {
+            fprintf(stderr, "expected rank %d of %d on '%s', got rank %d of %d\n", rank + 1, rank_count,
+                    peers[rank].c_str(), hello.rank, hello.rank_count);
+            return fail(fd);
+        }
+        set_no_delay(fd);
+        links[NS_UPPER].reset(new SocketLink(fd));
+
+        close(listen_fd);
+    }
+
+    return std::unique_ptr<Transport>(
+        new Transport(TK_TCP, rank, rank_count, std::move(links[NS_LOWER]), std::move(links[NS_UPPER])));
+}
+
+#else
+
+std::unique_ptr<Transport> fork_ranks(TransportKind, int) { return nullptr; }
+
+std::unique_ptr<Transport> connect_tcp(int, const std::vector<std::string>&, double)
+{
+    fprintf(stderr, "tcp ranks aren't supported on this system\n");
+    return nullptr;
+}
+
+#endif
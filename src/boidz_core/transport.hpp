@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// how the ranks of a decomposed simulation talk to each other: TK_SHM through ring buffers in
+// memory shared by processes forked from one another, TK_UNIX through unix domain socket pairs
+// between such processes, and TK_TCP through tcp connections between processes started anywhere
+enum TransportKind { TK_SHM, TK_UNIX, TK_TCP, TK_COUNT };
+
+static constexpr const char* TRANSPORT_NAMES[TK_COUNT] = {"shm", "unix", "tcp"};
+
+// ranks form a chain, each one only talking to the ranks right below and above it
+enum NeighborSide { NS_LOWER, NS_UPPER, NS_COUNT };
+
+// one end of a byte stream between two processes, in both directions
+class Link {
+public:
+    virtual ~Link(void) = default;
+
+    // move up to bytes without blocking. returns how many were moved, possibly 0, or -1 once
+    // the other end is gone
+    virtual ptrdiff_t write_some(const void* data, size_t bytes) = 0;
+    virtual ptrdiff_t read_some(void* data, size_t bytes) = 0;
+
+    // descriptor to poll for progress, -1 if the link can only be polled by retrying
+    virtual int poll_fd(void) const { return -1; }
+};
+
+// the link of one rank of a decomposed simulation to its neighbors. messages are byte buffers,
+// sent with their length in front. a call moves all of its messages at once, writing and
+// reading in turns as the links allow, so neighbors sending each other more than a link can
+// buffer never wait on each other.
+class Transport {
+    struct Transfer;
+
+    std::unique_ptr<Link> m_links[NS_COUNT];
+    TransportKind m_kind;
+    int m_rank;
+    int m_rank_count;
+    std::vector<int> m_children;  // processes forked by fork_ranks, only known to rank 0
+    uint64_t m_bytes_sent = 0;
+
+    bool transfer(Transfer* transfers, size_t count);
+    void wait(const Transfer* transfers, size_t count) const;
+
+public:
+    Transport(TransportKind kind, int rank, int rank_count, std::unique_ptr<Link> lower,
+              std::unique_ptr<Link> upper, std::vector<int> children = {});
+    ~Transport(void);
+
+    Transport(const Transport&) = delete;
+    Transport& operator=(const Transport&) = delete;
+
+    inline TransportKind kind(void) const { return m_kind; }
+    inline int rank(void) const { return m_rank; }
+    inline int rank_count(void) const { return m_rank_count; }
+    inline bool has_neighbor(NeighborSide side) const { return m_links[side] != nullptr; }
+
+    // send out[side] to and receive in[side] from the neighbor on each side there is one.
+    // false if a link broke, the messages are then incomplete
+    bool exchange(const std::vector<uint8_t> out[NS_COUNT], std::vector<uint8_t> in[NS_COUNT]);
+
+    // one message in one direction, the neighbor has to make the matching call
+    bool send(NeighborSide side, const std::vector<uint8_t>& message);
+    bool receive(NeighborSide side, std::vector<uint8_t>& message);
+
+    // payload and length bytes sent so far
+    inline uint64_t bytes_sent(void) const { return m_bytes_sent; }
+
+    // close the links and, in rank 0 of fork_ranks, wait for the other ranks to exit. true if
+    // all of them exited with status 0 (always, for any other rank)
+    bool join(void);
+};
+
+// start rank_count - 1 more processes by forking the calling one, linked to their neighbors by
+// kind (TK_SHM or TK_UNIX), and return the transport of whichever rank the calling process
+// turned into: 0 in the original one, which should join the others at the end. call it before
+// starting any thread, only the calling thread lives on in the new processes. nullptr if the
+// links or processes can't be created, or this system has neither.
+std::unique_ptr<Transport> fork_ranks(TransportKind kind, int rank_count);
+
+// connect rank to its neighbors over tcp, peers holding "host:port" of every rank (ipv4). each
+// rank listens on its own port for the rank above and connects to the one below, retrying for
+// up to timeout_seconds while that one isn't listening yet. messages are sent as the bytes of
+// the structures they hold, so every rank has to run on the same architecture. nullptr on
+// failure, with the reason on stderr.
+std::unique_ptr<Transport> connect_tcp(int rank, const std::vector<std::string>& peers,
+                                       double timeout_seconds = 30.0);
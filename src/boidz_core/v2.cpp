@@ -0,0 +1,20 @@
+#include "v2.hpp"
+
+std::ostream& operator<<(std::ostream& os, const V2& v)
+{
+    os << "(" << v.x << " , " << v.y << ")";
+    return os;
+}
+
+V2 average_of(const std::vector<V2>& vecs)
+{
+    if (vecs.size() == 0) return V2::null();
+
+    V2 accum = V2::null();
+
+    for (const V2& v : vecs) {
+        accum += v;
+    }
+
+    return accum / static_cast<float>(vecs.size());
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <assert.h>
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+// the arithmetic is defined inline here (rather than in v2.cpp) so that it can be inlined
+// into the hot neighbor loops of other translation units
+struct V2 {
+    float x = 0.f;
+    float y = 0.f;
+
+    inline V2& operator+=(const V2& rhs)
+    {
+        x += rhs.x;
+        y += rhs.y;
+        return *this;
+    }
+
+    inline V2& operator-=(const V2& rhs)
+    {
+        x -= rhs.x;
+        y -= rhs.y;
+        return *this;
+    }
+
+    inline V2& operator/=(float sf)
+    {
+        x /= sf;
+        y /= sf;
+        return *this;
+    }
+
+    inline V2& operator*=(float sf)
+    {
+        x *= sf;
+        y *= sf;
+        return *this;
+    }
+
+    inline float magnitude(void) const { return std::sqrt(x * x + y * y); }
+    static constexpr V2 null(void) { return {0.f, 0.f}; }
+};
+
+inline V2 operator*(const V2& v, float sf) { return {v.x * sf, v.y * sf}; }
+inline V2 operator*(float sf, const V2& v) { return {v.x * sf, v.y * sf}; }
+inline V2 operator-(const V2& lhs, const V2& rhs) { return {lhs.x - rhs.x, lhs.y - rhs.y}; }
+inline V2 operator+(const V2& lhs, const V2& rhs) { return {lhs.x + rhs.x, lhs.y + rhs.y}; }
+inline V2 operator/(const V2& v, float sf) { return {v.x / sf, v.y / sf}; }
+
+inline V2 clamp(V2 vec, float max_magnitude)
+{
+    const auto current_magnitude = vec.magnitude();
+    if (current_magnitude > max_magnitude) {
+        return vec * (max_magnitude / current_magnitude);
+    }
+    else {
+        return vec;
+    }
+}
+
+inline float distance_sq(const V2& a, const V2& b)
+{
+    const float dx = a.x - b.x;
+    const float dy = a.y - b.y;
+    return dx * dx + dy * dy;
+}
+
+std::ostream& operator<<(std::ostream& os, const V2& v);
+V2 average_of(const std::vector<V2>& vecs);
@@ -0,0 +1,1181 @@
+// headless simulation driver: steps a BoidCollection as fast as possible, without any
+// window or GL context, and reports the simulation throughput as JSON on stdout.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std::chrono;
+
+#include "boid_collection.hpp"
+#include "checkpoint.hpp"
+#include "distribution.hpp"
+#include "force_kernel.hpp"
+#include "props.hpp"
+#include "quad_tree.hpp"
+#include "recorder.hpp"
+#include "replay.hpp"
+#include "slab_decomposition.hpp"
+#include "neighbor_list.hpp"
+#include "sparse_grid.hpp"
+#include "transport.hpp"
+
+struct Config {
+    size_t boid_count = 30000;
+    size_t step_count = 1000;
+    size_t warmup_steps = 10;
+    size_t thread_count = std::thread::hardware_concurrency();
+    int nodes_per_axis = 128;
+    float domain_span = WinProps::boid_span;
+    bool sparse = false;
+    float opening_angle = 0.f;
+    float effect_radius = 0.f;  // 0 keeps the grid's default
+    size_t node_cap = QuadTree::s_default_node_cap;
+    float dt = 1.f / 60.f;
+    unsigned seed = 1;
+    bool fused_integration = true;
+    bool pin_threads = false;
+    bool compact = false;
+    bool neighbor_list = false;
+    float skin = 0.f;  // 0 lasts NeighborList::s_default_reuse_steps at the fastest Max_Speed
+    bool deterministic = false;
+    size_t reorder_interval = 0;
+    LoadBalancing load_balancing = LB_DYNAMIC;
+    RuleDispatch rule_dispatch = RD_SPECIALIZED;
+    KernelIsa kernel_isa = best_kernel_isa();
+    const char* restore_path = nullptr;
+    const char* checkpoint_path = nullptr;
+    size_t checkpoint_interval = 0;
+    const char* record_path = nullptr;
+    size_t record_interval = 1;
+    size_t record_buffers = 4;
+    float record_quantum = 0.f;  // 0 keeps the recorder's default
+    bool record_drop = false;
+    std::vector<size_t> verify_threads;
+    const char* replay_path = nullptr;
+    long long replay_speed = 1;
+    int rank_count = 1;
+    TransportKind transport = TK_SHM;
+    int rank = -1;  // only given with tcp, where every rank is started on its own
+    std::vector<std::string> peers;
+    std::vector<size_t> species_counts;  // boids of each species, just boid_count after parse_args
+    SpeciesRules rules;                  // every entry filled in, whatever the species count
+};
+
+static void print_usage(const char* program)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --boids N          number of boids (default 30000)\n"
+            "  --steps N          number of timed steps (default 1000)\n"
+            "  --warmup N         untimed steps run before measuring (default 10)\n"
+            "  --threads N        threads, including the calling one (default: hardware concurrency)\n"
+            "  --grid N           grid nodes per axis (default 128)\n"
+            "  --domain SPAN      side length of the square domain the boids live in (default 256)\n"
+            "  --sparse           keep only the occupied grid nodes, in a hash table, so that the grid's\n"
+            "                     memory and build time don't grow with the domain's area. no opening\n"
+            "                     angle, compact storage or checkpoints\n"
+            "  --opening-angle T  Barnes-Hut neighbor search with opening angle T, 0 uses the fixed\n"
+            "                     stencil of adjacent nodes (default 0)\n"
+            "  --radius R         interaction radius (default: half a grid node)\n"
+            "  --node-cap N       nodes with more boids only count as their aggregate, 0 for no cap\n"
+            "                     (default 512)\n"
+            "  --compact          store the grid's copy of the boids as 16 bit fixed point, positions\n"
+            "                     within domain / 2^17 and velocities within 1/128 of the real ones\n"
+            "  --neighbor-list    see every boid within the radius on its own, instead of the members of\n"
+            "                     a boid's node and the aggregates of the nodes around it, so the flock\n"
+            "                     differs from the default grid's (it is the one an opening angle small\n"
+            "                     enough to open every cell gives). each boid's neighbors within the\n"
+            "                     radius plus a skin are kept in a list, only found again once a boid\n"
+            "                     moved more than half the skin. no opening angle, compact storage or\n"
+            "                     checkpoints\n"
+            "  --skin F           with --neighbor-list, how much further than the radius the lists reach.\n"
+            "                     has to outlast a step at the fastest species' Max_Speed (default: as\n"
+            "                     much as lasts 2 steps at it)\n"
+            "  --dt SECONDS       simulation time step (default 1/60)\n"
+            "  --seed N           seed for the initial population (default 1)\n"
+            "  --pin              pin threads to cpus, filling one numa node after the other, and place\n"
+            "                     each thread's share of the arrays in memory it touched first\n"
+            "  --separate-integration\n"
+            "                     integrate in a second pass instead of inside the force pass\n"
+            "  --reorder N        sort the boids along a Morton curve every N steps, 0 never (default 0)\n"
+            "  --balance MODE     force pass load balancing: static,dynamic (default dynamic)\n"
+            "  --rule-dispatch MODE\n"
+            "                     specialized runs a kernel compiled for the enabled rules, branching one\n"
+            "                     that checks them for every boid (default specialized)\n"
+            "  --kernel ISA       force kernel instruction set: scalar,sse2,avx2,avx512 (default: best)\n"
+            "  --restore PATH     start from a checkpoint instead of a fresh population. its boids,\n"
+            "                     rules, grid settings, seed and step replace the options above\n"
+            "  --checkpoint PATH  save a checkpoint after the last step\n"
+            "  --checkpoint-interval N\n"
+            "                     with --checkpoint, also save every N steps (default 0, only at the end)\n"
+            "  --record PATH      record the positions of the timed steps to a compressed trajectory file,\n"
+            "                     written by a background thread\n"
+            "  --record-interval N\n"
+            "                     record every N'th step (default 1)\n"
+            "  --record-buffers N frames that can wait for the writer before recording stalls (default 4)\n"
+            "  --record-drop      drop frames while the writer is behind, instead of waiting for it\n"
+            "  --record-quantum Q round recorded positions to multiples of Q (default: the domain span\n"
+            "                     / 65536, 1/256 for the default domain)\n"
+            "  --replay PATH      instead of simulating, play back a recorded trajectory file and report\n"
+            "                     how fast its frames decode, in order and at random\n"
+            "  --replay-speed N   frames to advance per played frame, negative plays backward (default 1)\n"
+            "  --deterministic    same results on any machine: the scalar force kernel only (the result\n"
+            "                     never depends on the number of threads either way)\n"
+            "  --ranks N          split the domain into N slabs of grid columns, simulated by N processes\n"
+            "                     forked from this one, which exchange halo strips and migrating boids\n"
+            "                     every step (default 1). only the fixed stencil, no checkpoints,\n"
+            "                     recording or pinning; --threads is per rank\n"
+            "  --transport KIND   how the ranks talk: shm,unix,tcp (default shm)\n"
+            "  --rank R           with tcp, the rank this process runs. start one process per rank\n"
+            "  --peers LIST       with tcp, host:port of every rank in rank order, e.g.\n"
+            "                     --peers node0:7000,node1:7000. sets the rank count\n"
+            "  --verify-threads N,N,...\n"
+            "                     instead of timing, run once per thread count (N alone for hardware\n"
+            "                     concurrency), hash the state after every step and report the first\n"
+            "                     step where the runs diverge. exits with 1 if they do\n"
+            "  --rule NAME=VALUE  set a rule value, e.g. --rule Gravity=2.5\n"
+            "  --disable NAME     turn a rule off, e.g. --disable Random_Noise\n"
+            "  --species N,N,...  boids of each species, up to 8 of them, stored one species after the\n"
+            "                     other. replaces --boids. no ranks or checkpoints\n"
+            "  --species-rule S:NAME=VALUE\n"
+            "                     set a rule value of species S only, after --rule, e.g. --species-rule\n"
+            "                     1:Max_Speed=20\n"
+            "  --species-disable S:NAME\n"
+            "                     turn a rule of species S off\n"
+            "  --interaction A:B=F,S\n"
+            "                     species A weighs neighbors of species B by F in the center of mass and\n"
+            "                     average velocity rules and by S in the density rule (default 1,1), 0,0\n"
+            "                     ignores them altogether. e.g. --interaction 0:1=0,4 for prey fleeing 1\n"
+            "rule names:",
+            program);
+
+    for (int rt = 0; rt < RT_COUNT; rt++) {
+        fprintf(stderr, " %s", RULE_NAMES_NOSPACE[rt]);
+    }
+    fprintf(stderr, "\n");
+}
+
+static int find_rule(const char* name, size_t length)
+{
+    for (int rt = 0; rt < RT_COUNT; rt++) {
+        if (strlen(RULE_NAMES_NOSPACE[rt]) == length && strncmp(RULE_NAMES_NOSPACE[rt], name, length) == 0) {
+            return rt;
+        }
+    }
+    return -1;
+}
+
+// the "S:" in front of the per species options, returning S and leaving rest after the colon
+static int parse_species_prefix(const char* value, const char** rest)
+{
+    char* end = nullptr;
+    const long species = strtol(value, &end, 10);
+    const long species_count = static_cast<long>(SpeciesRules::max_species);
+    if (end == value || *end != ':' || species < 0 || species >= species_count) return -1;
+
+    *rest = end + 1;
+    return static_cast<int>(species);
+}
+
+static bool parse_args(int argc, char** argv, Config& cfg)
+{
+    size_t species_referenced = 0;  // one more than the highest species the options mention
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+
+        if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
+            return false;
+        }
+
+        if (strcmp(arg, "--separate-integration") == 0) {
+            cfg.fused_integration = false;
+            continue;
+        }
+
+        if (strcmp(arg, "--pin") == 0) {
+            cfg.pin_threads = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--compact") == 0) {
+            cfg.compact = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--sparse") == 0) {
+            cfg.sparse = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--neighbor-list") == 0) {
+            cfg.neighbor_list = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--record-drop") == 0) {
+            cfg.record_drop = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--deterministic") == 0) {
+            cfg.deterministic = true;
+            continue;
+        }
+
+        if (i + 1 >= argc) {
+            fprintf(stderr, "missing value for argument '%s'\n", arg);
+            return false;
+        }
+
+        const char* value = argv[++i];
+
+        if (strcmp(arg, "--boids") == 0) {
+            cfg.boid_count = strtoull(value, nullptr, 10);
+        }
+        else if (strcmp(arg, "--steps") == 0) {
+            cfg.step_count = strtoull(value, nullptr, 10);
+        }
+        else if (strcmp(arg, "--warmup") == 0) {
+            cfg.warmup_steps = strtoull(value, nullptr, 10);
+        }
+        else if (strcmp(arg, "--threads") == 0) {
+            cfg.thread_count = strtoull(value, nullptr, 10);
+        }
+        else if (strcmp(arg, "--grid") == 0) {
+            cfg.nodes_per_axis = atoi(value);
+        }
+        else if (strcmp(arg, "--domain") == 0) {
+            cfg.domain_span = strtof(value, nullptr);
+            if (!(cfg.domain_span > 0.f)) {
+                fprintf(stderr, "domain must be positive\n");
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--opening-angle") == 0) {
+            cfg.opening_angle = std::max(0.f, strtof(value, nullptr));
+        }
+        else if (strcmp(arg, "--radius") == 0) {
+            cfg.effect_radius = std::max(0.f, strtof(value, nullptr));
+        }
+        else if (strcmp(arg, "--node-cap") == 0) {
+            cfg.node_cap = strtoull(value, nullptr, 10);
+        }
+        else if (strcmp(arg, "--skin") == 0) {
+            cfg.skin = std::max(0.f, strtof(value, nullptr));
+        }
+        else if (strcmp(arg, "--dt") == 0) {
+            cfg.dt = strtof(value, nullptr);
+        }
+        else if (strcmp(arg, "--seed") == 0) {
+            cfg.seed = static_cast<unsigned>(strtoul(value, nullptr, 10));
+        }
+        else if (strcmp(arg, "--reorder") == 0) {
+            cfg.reorder_interval = strtoull(value, nullptr, 10);
+        }
+        else if (strcmp(arg, "--balance") == 0) {
+            const auto it = std::find_if(std::begin(LOAD_BALANCING_NAMES), std::end(LOAD_BALANCING_NAMES),
+                                         [&](const char* name) { return strcmp(value, name) == 0; });
+            if (it == std::end(LOAD_BALANCING_NAMES)) {
+                fprintf(stderr, "unknown load balancing mode '%s'\n", value);
+                return false;
+            }
+            cfg.load_balancing = static_cast<LoadBalancing>(it - std::begin(LOAD_BALANCING_NAMES));
+        }
+        else if (strcmp(arg, "--rule-dispatch") == 0) {
+            const auto it = std::find_if(std::begin(RULE_DISPATCH_NAMES), std::end(RULE_DISPATCH_NAMES),
+                                         [&](const char* name) { return strcmp(value, name) == 0; });
+            if (it == std::end(RULE_DISPATCH_NAMES)) {
+                fprintf(stderr, "unknown rule dispatch '%s'\n", value);
+                return false;
+            }
+            cfg.rule_dispatch = static_cast<RuleDispatch>(it - std::begin(RULE_DISPATCH_NAMES));
+        }
+        else if (strcmp(arg, "--kernel") == 0) {
+            const auto it = std::find_if(std::begin(KERNEL_ISA_NAMES), std::end(KERNEL_ISA_NAMES),
+                                         [&](const char* name) { return strcmp(value, name) == 0; });
+            const KernelIsa isa = static_cast<KernelIsa>(it - std::begin(KERNEL_ISA_NAMES));
+            if (it == std::end(KERNEL_ISA_NAMES) || !kernel_isa_supported(isa)) {
+                fprintf(stderr, "kernel '%s' is unknown or not supported by this cpu\n", value);
+                return false;
+            }
+            cfg.kernel_isa = isa;
+        }
+        else if (strcmp(arg, "--restore") == 0) {
+            cfg.restore_path = value;
+        }
+        else if (strcmp(arg, "--checkpoint") == 0) {
+            cfg.checkpoint_path = value;
+        }
+        else if (strcmp(arg, "--checkpoint-interval") == 0) {
+            cfg.checkpoint_interval = strtoull(value, nullptr, 10);
+        }
+        else if (strcmp(arg, "--record") == 0) {
+            cfg.record_path = value;
+        }
+        else if (strcmp(arg, "--record-interval") == 0) {
+            cfg.record_interval = std::max<size_t>(1, strtoull(value, nullptr, 10));
+        }
+        else if (strcmp(arg, "--record-buffers") == 0) {
+            cfg.record_buffers = std::max<size_t>(1, strtoull(value, nullptr, 10));
+        }
+        else if (strcmp(arg, "--record-quantum") == 0) {
+            cfg.record_quantum = std::max(0.f, strtof(value, nullptr));
+        }
+        else if (strcmp(arg, "--replay") == 0) {
+            cfg.replay_path = value;
+        }
+        else if (strcmp(arg, "--replay-speed") == 0) {
+            cfg.replay_speed = strtoll(value, nullptr, 10);
+            if (cfg.replay_speed == 0) {
+                fprintf(stderr, "replay speed can't be 0\n");
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--verify-threads") == 0) {
+            cfg.verify_threads.clear();
+            for (const char* c = value; *c != '\0';) {
+                const char* end = c + 1;
+                size_t threads = std::thread::hardware_concurrency();
+                if (*c != 'N') {
+                    char* number_end = nullptr;
+                    threads = strtoull(c, &number_end, 10);
+                    end = number_end;
+                }
+
+                if (end == c || threads == 0 || (*end != ',' && *end != '\0')) {
+                    fprintf(stderr, "invalid thread count list '%s'\n", value);
+                    return false;
+                }
+                cfg.verify_threads.push_back(threads);
+                c = *end == ',' ? end + 1 : end;
+            }
+        }
+        else if (strcmp(arg, "--ranks") == 0) {
+            cfg.rank_count = atoi(value);
+        }
+        else if (strcmp(arg, "--transport") == 0) {
+            const auto it = std::find_if(std::begin(TRANSPORT_NAMES), std::end(TRANSPORT_NAMES),
+                                         [&](const char* name) { return strcmp(value, name) == 0; });
+            if (it == std::end(TRANSPORT_NAMES)) {
+                fprintf(stderr, "unknown transport '%s'\n", value);
+                return false;
+            }
+            cfg.transport = static_cast<TransportKind>(it - std::begin(TRANSPORT_NAMES));
+        }
+        else if (strcmp(arg, "--rank") == 0) {
+            cfg.rank = atoi(value);
+        }
+        else if (strcmp(arg, "--peers") == 0) {
+            cfg.peers.clear();
+            for (const char* c = value; *c != '\0';) {
+                const char* end = strchr(c, ',');
+                if (!end) end = c + strlen(c);
+                cfg.peers.emplace_back(c, end);
+                c = *end == ',' ? end + 1 : end;
+            }
+        }
+        else if (strcmp(arg, "--rule") == 0) {
+            const char* eq = strchr(value, '=');
+            const int rt = eq ? find_rule(value, eq - value) : -1;
+            if (rt < 0) {
+                fprintf(stderr, "invalid rule assignment '%s'\n", value);
+                return false;
+            }
+            for (Rules& rules : cfg.rules.rules) {
+                rules.values[rt] = strtof(eq + 1, nullptr);
+                rules.toggles[rt] = true;
+            }
+        }
+        else if (strcmp(arg, "--disable") == 0) {
+            const int rt = find_rule(value, strlen(value));
+            if (rt < 0) {
+                fprintf(stderr, "unknown rule '%s'\n", value);
+                return false;
+            }
+            for (Rules& rules : cfg.rules.rules) rules.toggles[rt] = false;
+        }
+        else if (strcmp(arg, "--species") == 0) {
+            cfg.species_counts.clear();
+            for (const char* c = value; *c != '\0';) {
+                char* end = nullptr;
+                const size_t count = strtoull(c, &end, 10);
+                if (end == c || (*end != ',' && *end != '\0')) {
+                    fprintf(stderr, "invalid species list '%s'\n", value);
+                    return false;
+                }
+                cfg.species_counts.push_back(count);
+                c = *end == ',' ? end + 1 : end;
+            }
+        }
+        else if (strcmp(arg, "--species-rule") == 0) {
+            const char* rest = nullptr;
+            const int species = parse_species_prefix(value, &rest);
+            const char* eq = species >= 0 ? strchr(rest, '=') : nullptr;
+            const int rt = eq ? find_rule(rest, eq - rest) : -1;
+            if (rt < 0) {
+                fprintf(stderr, "invalid species rule assignment '%s'\n", value);
+                return false;
+            }
+            cfg.rules.rules[species].values[rt] = strtof(eq + 1, nullptr);
+            cfg.rules.rules[species].toggles[rt] = true;
+            species_referenced = std::max(species_referenced, species + size_t(1));
+        }
+        else if (strcmp(arg, "--species-disable") == 0) {
+            const char* rest = nullptr;
+            const int species = parse_species_prefix(value, &rest);
+            const int rt = species >= 0 ? find_rule(rest, strlen(rest)) : -1;
+            if (rt < 0) {
+                fprintf(stderr, "invalid species rule '%s'\n", value);
+                return false;
+            }
+            cfg.rules.rules[species].toggles[rt] = false;
+            species_referenced = std::max(species_referenced, species + size_t(1));
+        }
+        else if (strcmp(arg, "--interaction") == 0) {
+            const char* rest = nullptr;
+            const int species = parse_species_prefix(value, &rest);
+            char* end = nullptr;
+            const long neighbor = species >= 0 ? strtol(rest, &end, 10) : -1;
+            float flocking = 0.f;
+            float separation = 0.f;
+            const bool valid = neighbor >= 0 && neighbor < static_cast<long>(SpeciesRules::max_species) &&
+                               sscanf(end, "=%f,%f", &flocking, &separation) == 2;
+            if (!valid) {
+                fprintf(stderr, "invalid interaction '%s'\n", value);
+                return false;
+            }
+            cfg.rules.interactions[species][neighbor] = {flocking, separation};
+            const size_t highest = static_cast<size_t>(std::max<long>(species, neighbor));
+            species_referenced = std::max(species_referenced, highest + 1);
+        }
+        else {
+            fprintf(stderr, "unknown argument '%s'\n", arg);
+            return false;
+        }
+    }
+
+    if (cfg.species_counts.empty()) {
+        cfg.species_counts = {cfg.boid_count};
+    }
+    else {
+        cfg.boid_count = 0;
+        for (size_t count : cfg.species_counts) cfg.boid_count += count;
+    }
+
+    const size_t species_count = cfg.species_counts.size();
+    if (species_count > SpeciesRules::max_species || species_referenced > species_count) {
+        fprintf(stderr, "at most %zu species, and the per species options only for those in --species\n",
+                SpeciesRules::max_species);
+        return false;
+    }
+    cfg.rules.species_count = species_count;
+
+    if (species_count > 1 && (cfg.rank_count > 1 || cfg.transport == TK_TCP || cfg.restore_path ||
+                              cfg.checkpoint_path)) {
+        fprintf(stderr, "several species have no ranks or checkpoints\n");
+        return false;
+    }
+
+    if (cfg.boid_count == 0 || cfg.step_count == 0 || cfg.thread_count == 0 || cfg.nodes_per_axis < 2) {
+        fprintf(stderr, "boids, steps and threads must be positive and grid must be at least 2\n");
+        return false;
+    }
+
+    if (cfg.sparse && (cfg.opening_angle > 0.f || cfg.compact || cfg.restore_path || cfg.checkpoint_path)) {
+        fprintf(stderr, "the sparse grid has no opening angle, compact storage or checkpoints\n");
+        return false;
+    }
+
+    if (cfg.neighbor_list && (cfg.sparse || cfg.opening_angle > 0.f || cfg.compact || cfg.restore_path ||
+                              cfg.checkpoint_path)) {
+        fprintf(stderr, "neighbor lists have no sparse grid, opening angle, compact storage or "
+                        "checkpoints\n");
+        return false;
+    }
+
+    if (cfg.neighbor_list) {
+        float max_speed = 0.f;
+        for (size_t species = 0; species < cfg.rules.species_count; species++) {
+            max_speed = std::max(max_speed, std::fabs(cfg.rules.rules[species].values[RT_MAX_VELOCITY]));
+        }
+
+        // a skin a boid can cross half of in one step would have the lists built every step
+        const float step_skin = NeighborList::skin_lasting(max_speed, cfg.dt, 1);
+        if (cfg.skin == 0.f) {
+            cfg.skin = NeighborList::skin_lasting(max_speed, cfg.dt);
+        }
+        else if (cfg.skin <= step_skin && max_speed > 0.f) {
+            fprintf(stderr, "--skin has to be more than %g to outlast a step at Max_Speed %g\n", step_skin,
+                    max_speed);
+            return false;
+        }
+    }
+
+    if (cfg.transport == TK_TCP) {
+        if (cfg.peers.empty() || cfg.rank < 0 || cfg.rank >= static_cast<int>(cfg.peers.size())) {
+            fprintf(stderr, "tcp needs --peers and a --rank between 0 and the number of peers - 1\n");
+            return false;
+        }
+        if (cfg.rank_count > 1 && cfg.rank_count != static_cast<int>(cfg.peers.size())) {
+            fprintf(stderr, "--ranks doesn't match the number of peers\n");
+            return false;
+        }
+        cfg.rank_count = static_cast<int>(cfg.peers.size());
+    }
+    else if (cfg.rank >= 0 || !cfg.peers.empty()) {
+        fprintf(stderr, "--rank and --peers are only for tcp\n");
+        return false;
+    }
+
+    const bool decomposed = cfg.rank_count > 1 || cfg.transport == TK_TCP;
+    if (cfg.rank_count < 1 || cfg.rank_count > cfg.nodes_per_axis) {
+        fprintf(stderr, "ranks must be between 1 and the grid nodes per axis\n");
+        return false;
+    }
+    if (decomposed && (cfg.opening_angle > 0.f || cfg.neighbor_list || cfg.restore_path ||
+                       cfg.checkpoint_path || cfg.record_path || cfg.replay_path ||
+                       !cfg.verify_threads.empty() || cfg.pin_threads)) {
+        fprintf(stderr, "ranks have no opening angle, neighbor lists, checkpoints, recording, replay, "
+                        "thread verification or pinning\n");
+        return false;
+    }
+
+    return true;
+}
+
+// nearest-rank percentile of an already sorted sample
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    const size_t rank = static_cast<size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+static void configure(const Config& cfg, BoidCollection& boids)
+{
+    boids.set_domain_span(cfg.domain_span);
+    boids.set_fused_integration(cfg.fused_integration);
+    boids.set_kernel_isa(cfg.kernel_isa);
+    boids.set_deterministic(cfg.deterministic);
+    boids.set_reorder_interval(cfg.reorder_interval);
+    boids.set_load_balancing(cfg.load_balancing);
+    boids.set_rule_dispatch(cfg.rule_dispatch);
+    boids.set_seed(cfg.seed);
+}
+
+static void configure(const Config& cfg, BoidCollection& boids, QuadTree& grid)
+{
+    grid = QuadTree(cfg.nodes_per_axis);
+    grid.set_opening_angle(cfg.opening_angle);
+    if (cfg.effect_radius > 0.f) grid.set_effect_radius(cfg.effect_radius);
+    grid.set_node_cap(cfg.node_cap);
+    grid.set_compact_storage(cfg.compact);
+    configure(cfg, boids);
+}
+
+// cells as large as the nodes of the dense grid would be
+static void configure(const Config& cfg, BoidCollection& boids, SparseGrid& grid)
+{
+    grid = SparseGrid(cfg.domain_span / static_cast<float>(cfg.nodes_per_axis));
+    if (cfg.effect_radius > 0.f) grid.set_effect_radius(cfg.effect_radius);
+    grid.set_node_cap(cfg.node_cap);
+    configure(cfg, boids);
+}
+
+// cells found for the dense grid's effect radius, half a node by default
+static void configure(const Config& cfg, BoidCollection& boids, NeighborList& grid)
+{
+    grid = NeighborList(cfg.domain_span / static_cast<float>(cfg.nodes_per_axis), cfg.skin);
+    if (cfg.effect_radius > 0.f) grid.set_effect_radius(cfg.effect_radius);
+    grid.set_node_cap(cfg.node_cap);
+    configure(cfg, boids);
+}
+
+// a fresh population sampled from the distributions, or the one saved in cfg.restore_path
+// (which also brings its own rules, domain and grid)
+static bool initialize(const Config& cfg, const Distribution& d_pos, const Distribution& d_vel,
+                       BoidCollection& boids, SpeciesRules& rules, QuadTree& grid)
+{
+    if (!cfg.restore_path) {
+        boids.reset(cfg.species_counts, d_pos, d_vel);
+        return true;
+    }
+
+    // parse_args only allows a single species along with checkpoints
+    const CheckpointStatus status = load_checkpoint(cfg.restore_path, boids, rules.rules[0], grid);
+    if (status != CS_OK) {
+        fprintf(stderr, "can't restore '%s': %s\n", cfg.restore_path, CHECKPOINT_STATUS_NAMES[status]);
+    }
+    return status == CS_OK;
+}
+
+// checkpoints only hold dense grid settings, parse_args already turned them down for this one
+static bool initialize(const Config& cfg, const Distribution& d_pos, const Distribution& d_vel,
+                       BoidCollection& boids, SpeciesRules&, SparseGrid&)
+{
+    assert(!cfg.restore_path);
+    boids.reset(cfg.species_counts, d_pos, d_vel);
+    return true;
+}
+
+static bool initialize(const Config& cfg, const Distribution& d_pos, const Distribution& d_vel,
+                       BoidCollection& boids, SpeciesRules&, NeighborList&)
+{
+    assert(!cfg.restore_path);
+    boids.reset(cfg.species_counts, d_pos, d_vel);
+    return true;
+}
+
+static CheckpointStatus save_checkpoint(const Config& cfg, const BoidCollection& boids, const QuadTree& grid)
+{
+    return save_checkpoint(cfg.checkpoint_path, boids, cfg.rules.rules[0], grid);
+}
+
+static CheckpointStatus save_checkpoint(const Config&, const BoidCollection&, const SparseGrid&)
+{
+    assert(false);
+    return CS_WRITE_FAILED;
+}
+
+static CheckpointStatus save_checkpoint(const Config&, const BoidCollection&, const NeighborList&)
+{
+    assert(false);
+    return CS_WRITE_FAILED;
+}
+
+static void print_rules(const Rules& rules, const char* indent)
+{
+    printf("%s\"rules\": {", indent);
+    for (int rt = 0; rt < RT_COUNT; rt++) {
+        printf("%s\n%s  \"%s\": {\"enabled\": %s, \"value\": %g}", rt == 0 ? "" : ",", indent,
+               RULE_NAMES_NOSPACE[rt], rules.toggles[rt] ? "true" : "false", rules.values[rt]);
+    }
+    printf("\n%s}", indent);
+}
+
+// the rules above are those of species 0
+static void print_species(const SpeciesRules& species, const BoidCollection& boids)
+{
+    printf(",\n    \"species\": [");
+    for (size_t s = 0; s < species.species_count; s++) {
+        const size_t count = boids.species_offsets()[s + 1] - boids.species_offsets()[s];
+        printf("%s\n      {\n        \"boids\": %zu,\n", s == 0 ? "" : ",", count);
+        printf("        \"interactions\": [");
+        for (size_t b = 0; b < species.species_count; b++) {
+            const SpeciesInteraction& interaction = species.interactions[s][b];
+            printf("%s{\"flocking\": %g, \"separation\": %g}", b == 0 ? "" : ", ", interaction.flocking,
+                   interaction.separation);
+        }
+        printf("],\n");
+        print_rules(species.rules[s], "        ");
+        printf("\n      }");
+    }
+    printf("\n    ]");
+}
+
+static void print_grid(const QuadTree& grid)
+{
+    printf("    \"grid\": \"dense\",\n");
+    printf("    \"grid_nodes_per_axis\": %d,\n", grid.nodes_per_axis());
+    printf("    \"opening_angle\": %g,\n", grid.opening_angle());
+    printf("    \"effect_radius\": %g,\n", std::sqrt(grid.effect_radius_squared()));
+    printf("    \"node_cap\": %zu,\n", grid.node_cap());
+    printf("    \"compact\": %s,\n", grid.compact_storage() ? "true" : "false");
+    printf("    \"grid_bytes\": %zu,\n", grid.memory_bytes());
+}
+
+// the cell count is the one after the last step
+static void print_grid(const SparseGrid& grid)
+{
+    printf("    \"grid\": \"sparse\",\n");
+    printf("    \"cell_span\": %g,\n", grid.cell_span());
+    printf("    \"effect_radius\": %g,\n", std::sqrt(grid.effect_radius_squared()));
+    printf("    \"node_cap\": %zu,\n", grid.node_cap());
+    printf("    \"occupied_cells\": %zu,\n", grid.cell_count());
+    printf("    \"table_slots\": %zu,\n", grid.table_slots());
+    printf("    \"grid_bytes\": %zu,\n", grid.memory_bytes());
+}
+
+// rebuilds over the warmup and timed steps, list sizes as of the last one
+static void print_grid(const NeighborList& grid)
+{
+    const NeighborListStats& stats = grid.stats();
+    printf("    \"grid\": \"neighbor_list\",\n");
+    printf("    \"cells_per_axis\": %d,\n", grid.cells_per_axis());
+    printf("    \"effect_radius\": %g,\n", std::sqrt(grid.effect_radius_squared()));
+    printf("    \"skin\": %g,\n", grid.skin());
+    printf("    \"node_cap\": %zu,\n", grid.node_cap());
+    printf("    \"rebuilds\": {\"total\": %llu, \"displacement\": %llu, \"steps_per_rebuild\": %.2f},\n",
+           static_cast<unsigned long long>(stats.rebuilds),
+           static_cast<unsigned long long>(stats.displacement_rebuilds), stats.steps_per_rebuild());
+    printf("    \"mean_list_length\": %.2f,\n", stats.mean_list_length());
+    printf("    \"list_bytes\": %zu,\n", grid.list_bytes());
+    printf("    \"grid_bytes\": %zu,\n", grid.memory_bytes());
+}
+
+// runs the configured simulation (warmup and timed steps alike) once per thread count and
+// compares the state hashes after every step to those of the first run
+template <typename Grid>
+static int verify_threads(const Config& cfg, const Distribution& d_pos, const Distribution& d_vel)
+{
+    const size_t step_count = cfg.warmup_steps + cfg.step_count;
+    std::vector<std::vector<uint64_t>> hashes;
+    bool deterministic = false;
+    KernelIsa kernel_isa = KI_SCALAR;
+
+    for (size_t threads : cfg.verify_threads) {
+        BoidCollection boids(0, d_pos, d_vel, threads);
+        Grid grid;
+        SpeciesRules rules = cfg.rules;
+        configure(cfg, boids, grid);
+        if (!initialize(cfg, d_pos, d_vel, boids, rules, grid)) return 1;
+
+        // entry 0 is the initial state
+        std::vector<uint64_t> run_hashes = {boids.state_hash()};
+        for (size_t i = 0; i < step_count; i++) {
+            boids.update(cfg.dt, rules, grid);
+            run_hashes.push_back(boids.state_hash());
+        }
+
+        hashes.push_back(run_hashes);
+        deterministic = boids.deterministic();
+        kernel_isa = boids.kernel_isa();
+    }
+
+    size_t first_divergent = SIZE_MAX;
+    for (const std::vector<uint64_t>& run_hashes : hashes) {
+        const auto mismatch = std::mismatch(run_hashes.begin(), run_hashes.end(), hashes[0].begin());
+        const size_t step = static_cast<size_t>(mismatch.first - run_hashes.begin());
+        if (step < run_hashes.size()) first_divergent = std::min(first_divergent, step);
+    }
+
+    printf("{\n");
+    printf("  \"steps\": %zu,\n", step_count);
+    printf("  \"kernel\": \"%s\",\n", KERNEL_ISA_NAMES[kernel_isa]);
+    printf("  \"deterministic\": %s,\n", deterministic ? "true" : "false");
+    printf("  \"runs\": [");
+    for (size_t r = 0; r < hashes.size(); r++) {
+        printf("%s\n    {\"threads\": %zu, \"final_state_hash\": \"%016llx\"}", r == 0 ? "" : ",",
+               cfg.verify_threads[r], static_cast<unsigned long long>(hashes[r].back()));
+    }
+    printf("\n  ],\n");
+    // 0 is the initial state, n the state after the n'th step
+    if (first_divergent == SIZE_MAX) {
+        printf("  \"first_divergent_step\": null,\n");
+    }
+    else {
+        printf("  \"first_divergent_step\": %zu,\n", first_divergent);
+    }
+    printf("  \"identical\": %s\n", first_divergent == SIZE_MAX ? "true" : "false");
+    printf("}\n");
+
+    return first_divergent == SIZE_MAX ? 0 : 1;
+}
+
+// plays cfg.replay_path from one end to the other at cfg.replay_speed, then seeks to random
+// frames, timing every frame
+static int replay(const Config& cfg)
+{
+    static constexpr size_t s_random_seeks = 64;
+
+    const auto open_start = steady_clock::now();
+    Replay replay;
+    const ReplayStatus status = replay.open(cfg.replay_path);
+    const double open_time = duration_cast<duration<double>>(steady_clock::now() - open_start).count();
+
+    if (status != RP_OK) {
+        fprintf(stderr, "can't replay '%s': %s\n", cfg.replay_path, REPLAY_STATUS_NAMES[status]);
+        return 1;
+    }
+    if (replay.frame_count() == 0) {
+        fprintf(stderr, "'%s' holds no complete frame\n", cfg.replay_path);
+        return 1;
+    }
+
+    auto seek = [&](uint64_t frame, std::vector<double>& times) {
+        const auto start = steady_clock::now();
+        const bool found = replay.seek(frame);
+        times.push_back(duration_cast<duration<double>>(steady_clock::now() - start).count());
+        if (!found) fprintf(stderr, "can't decode frame %llu\n", static_cast<unsigned long long>(frame));
+        return found;
+    };
+
+    const long long frame_count = static_cast<long long>(replay.frame_count());
+    const long long first_frame = cfg.replay_speed > 0 ? 0 : frame_count - 1;
+    std::vector<double> frame_times;
+    const auto play_start = steady_clock::now();
+    for (long long f = first_frame; f >= 0 && f < frame_count; f += cfg.replay_speed) {
+        if (!seek(f, frame_times)) return 1;
+    }
+    const double play_time = duration_cast<duration<double>>(steady_clock::now() - play_start).count();
+    const uint64_t last_step = replay.step();
+
+    std::vector<double> seek_times;
+    const CounterRng rng(cfg.seed);
+    for (size_t i = 0; i < s_random_seeks; i++) {
+        if (!seek(rng.bits(i) % replay.frame_count(), seek_times)) return 1;
+    }
+
+    for (std::vector<double>* samples : {&frame_times, &seek_times}) {
+        std::sort(samples->begin(), samples->end());
+    }
+
+    const TrajectoryHeader& header = replay.header();
+    const double frames_per_sec = frame_times.size() / play_time;
+    auto ms = [](double seconds) { return 1e3 * seconds; };
+
+    printf("{\n");
+    printf("  \"replay\": \"%s\",\n", cfg.replay_path);
+    printf("  \"boids\": %zu,\n", replay.population());
+    printf("  \"frames\": %llu,\n", static_cast<unsigned long long>(replay.frame_count()));
+    printf("  \"frames_per_chunk\": %u,\n", header.frames_per_chunk);
+    printf("  \"indexed\": %s,\n", replay.indexed() ? "true" : "false");
+    printf("  \"quantum\": %g,\n", header.quantum);
+    printf("  \"domain_span\": %g,\n", header.domain_span);
+    printf("  \"dt\": %g,\n", header.dt);
+    printf("  \"seed\": %llu,\n", static_cast<unsigned long long>(header.seed));
+    printf("  \"speed\": %lld,\n", cfg.replay_speed);
+    printf("  \"open_ms\": %.3f,\n", ms(open_time));
+    printf("  \"frames_played\": %zu,\n", frame_times.size());
+    printf("  \"last_step\": %llu,\n", static_cast<unsigned long long>(last_step));
+    printf("  \"frames_per_sec\": %.3f,\n", frames_per_sec);
+    printf("  \"boids_per_sec\": %.1f,\n", frames_per_sec * replay.population());
+    printf("  \"frame_ms\": {\n");
+    printf("    \"min\": %.4f,\n", ms(frame_times.front()));
+    printf("    \"p50\": %.4f,\n", ms(percentile(frame_times, 50.0)));
+    printf("    \"p90\": %.4f,\n", ms(percentile(frame_times, 90.0)));
+    printf("    \"p99\": %.4f,\n", ms(percentile(frame_times, 99.0)));
+    printf("    \"max\": %.4f\n", ms(frame_times.back()));
+    printf("  },\n");
+    printf("  \"random_seek_ms\": {\"p50\": %.4f, \"p90\": %.4f, \"max\": %.4f}\n",
+           ms(percentile(seek_times, 50.0)), ms(percentile(seek_times, 90.0)), ms(seek_times.back()));
+    printf("}\n");
+
+    return 0;
+}
+
+// the timed run, reported as JSON
+template <typename Grid>
+static int simulate(Config& cfg, const Distribution& d_pos, const Distribution& d_vel)
+{
+    BoidCollection boids(0, d_pos, d_vel, cfg.thread_count);
+    Grid grid;
+    configure(cfg, boids, grid);
+
+    const auto init_start = steady_clock::now();
+    if (!initialize(cfg, d_pos, d_vel, boids, cfg.rules, grid)) return 1;
+    const double init_time = duration_cast<duration<double>>(steady_clock::now() - init_start).count();
+
+    double checkpoint_time = 0.0;
+    auto save = [&](void) {
+        const auto save_start = steady_clock::now();
+        const CheckpointStatus status = save_checkpoint(cfg, boids, grid);
+        checkpoint_time += duration_cast<duration<double>>(steady_clock::now() - save_start).count();
+
+        if (status != CS_OK) {
+            fprintf(stderr, "can't save '%s': %s\n", cfg.checkpoint_path, CHECKPOINT_STATUS_NAMES[status]);
+        }
+        return status == CS_OK;
+    };
+
+    const Topology topology = Topology::detect();
+    if (cfg.pin_threads && !boids.pin_threads(topology)) {
+        fprintf(stderr, "thread pinning isn't supported here, running unpinned\n");
+    }
+
+    for (size_t i = 0; i < cfg.warmup_steps; i++) {
+        boids.update(cfg.dt, cfg.rules, grid);
+    }
+
+    Recorder recorder;
+    recorder.set_buffer_count(cfg.record_buffers);
+    recorder.set_drop_frames(cfg.record_drop);
+    if (cfg.record_quantum > 0.f) recorder.set_quantum(cfg.record_quantum);
+    if (cfg.record_path && !recorder.open(cfg.record_path, boids, cfg.dt)) {
+        fprintf(stderr, "can't create '%s'\n", cfg.record_path);
+        return 1;
+    }
+
+    std::vector<double> step_times;
+    std::vector<double> imbalances;
+    std::vector<double> idle_fractions;
+    step_times.reserve(cfg.step_count);
+    imbalances.reserve(cfg.step_count);
+    idle_fractions.reserve(cfg.step_count);
+
+    const auto run_start = steady_clock::now();
+
+    for (size_t i = 0; i < cfg.step_count; i++) {
+        const auto start_time = steady_clock::now();
+        boids.update(cfg.dt, cfg.rules, grid);
+        // recording is part of the step, it should cost the simulation next to nothing
+        if (recorder.is_open() && boids.step() % cfg.record_interval == 0) recorder.record(boids);
+        const auto end_time = steady_clock::now();
+        step_times.push_back(duration_cast<duration<double>>(end_time - start_time).count());
+        imbalances.push_back(boids.force_balance().imbalance());
+        idle_fractions.push_back(boids.force_balance().idle_fraction());
+
+        const bool last_step = i + 1 == cfg.step_count;
+        const bool interval_step = cfg.checkpoint_interval > 0 && boids.step() % cfg.checkpoint_interval == 0;
+        if (cfg.checkpoint_path && (last_step || interval_step) && !save()) return 1;
+    }
+
+    // checkpoints aren't part of the simulation throughput
+    const double total_time =
+        duration_cast<duration<double>>(steady_clock::now() - run_start).count() - checkpoint_time;
+
+    // neither is waiting for the writer to catch up at the end
+    const auto drain_start = steady_clock::now();
+    if (recorder.is_open() && !recorder.close()) {
+        fprintf(stderr, "can't write '%s'\n", cfg.record_path);
+        return 1;
+    }
+    const double drain_time = duration_cast<duration<double>>(steady_clock::now() - drain_start).count();
+    const RecorderStats record_stats = recorder.stats();
+
+    for (std::vector<double>* samples : {&step_times, &imbalances, &idle_fractions}) {
+        std::sort(samples->begin(), samples->end());
+    }
+
+    const double steps_per_sec = cfg.step_count / total_time;
+    const double boid_updates_per_sec = steps_per_sec * boids.population();
+    auto ms = [](double seconds) { return 1e3 * seconds; };
+
+    printf("{\n");
+    printf("  \"config\": {\n");
+    printf("    \"boids\": %zu,\n", boids.population());
+    printf("    \"steps\": %zu,\n", cfg.step_count);
+    printf("    \"warmup_steps\": %zu,\n", cfg.warmup_steps);
+    printf("    \"threads\": %zu,\n", boids.thread_count());
+    printf("    \"topology\": \"%s\",\n", topology.describe().c_str());
+    printf("    \"pinned_cpus\": [");
+    for (size_t t = 0; t < boids.pinned_cpus().size(); t++) {
+        const int cpu = boids.pinned_cpus()[t];
+        printf("%s{\"cpu\": %d, \"node\": %d}", t == 0 ? "" : ", ", cpu, topology.node_of_cpu(cpu));
+    }
+    printf("],\n");
+    printf("    \"domain_span\": %g,\n", boids.domain_span());
+    print_grid(grid);
+    printf("    \"dt\": %g,\n", cfg.dt);
+    printf("    \"seed\": %llu,\n", static_cast<unsigned long long>(boids.seed()));
+    printf("    \"restored_from\": %s%s%s,\n", cfg.restore_path ? "\"" : "",
+           cfg.restore_path ? cfg.restore_path : "null", cfg.restore_path ? "\"" : "");
+    printf("    \"fused_integration\": %s,\n", cfg.fused_integration ? "true" : "false");
+    printf("    \"reorder_interval\": %zu,\n", cfg.reorder_interval);
+    printf("    \"load_balancing\": \"%s\",\n", LOAD_BALANCING_NAMES[cfg.load_balancing]);
+    printf("    \"rule_dispatch\": \"%s\",\n", RULE_DISPATCH_NAMES[boids.rule_dispatch()]);
+    printf("    \"kernel\": \"%s\",\n", KERNEL_ISA_NAMES[boids.kernel_isa()]);
+    printf("    \"deterministic\": %s,\n", boids.deterministic() ? "true" : "false");
+    print_rules(cfg.rules.rules[0], "    ");
+    if (cfg.rules.species_count > 1) print_species(cfg.rules, boids);
+    printf("\n  },\n");
+    // sampling a fresh population, or mapping and copying the checkpoint in
+    printf("  \"init_ms\": %.3f,\n", ms(init_time));
+    printf("  \"checkpoint_ms\": %.3f,\n", ms(checkpoint_time));
+    if (cfg.record_path) {
+        printf("  \"recording\": {\n");
+        printf("    \"path\": \"%s\",\n", cfg.record_path);
+        printf("    \"interval\": %zu,\n", cfg.record_interval);
+        printf("    \"buffers\": %zu,\n", recorder.buffer_count());
+        printf("    \"quantum\": %g,\n", recorder.quantum());
+        printf("    \"frames_recorded\": %zu,\n", record_stats.frames_recorded);
+        printf("    \"frames_dropped\": %zu,\n", record_stats.frames_dropped);
+        printf("    \"frames_written\": %zu,\n", record_stats.frames_written);
+        printf("    \"max_queued\": %zu,\n", record_stats.max_queued);
+        // on the simulation thread, inside the timed steps
+        printf("    \"copy_ms\": %.3f,\n", ms(record_stats.copy_seconds));
+        printf("    \"blocked_ms\": %.3f,\n", ms(record_stats.blocked_seconds));
+        // on the writer thread, and waiting for it after the last step
+        printf("    \"encode_ms\": %.3f,\n", ms(record_stats.encode_seconds));
+        printf("    \"write_ms\": %.3f,\n", ms(record_stats.write_seconds));
+        printf("    \"drain_ms\": %.3f,\n", ms(drain_time));
+        printf("    \"raw_bytes\": %llu,\n", static_cast<unsigned long long>(record_stats.raw_bytes));
+        printf("    \"file_bytes\": %llu,\n", static_cast<unsigned long long>(record_stats.file_bytes));
+        printf("    \"compression_ratio\": %.3f\n", record_stats.compression_ratio());
+        printf("  },\n");
+    }
+    else {
+        printf("  \"recording\": null,\n");
+    }
+    printf("  \"state_hash\": \"%016llx\",\n", static_cast<unsigned long long>(boids.state_hash()));
+    printf("  \"total_seconds\": %.6f,\n", total_time);
+    printf("  \"steps_per_sec\": %.3f,\n", steps_per_sec);
+    printf("  \"boid_updates_per_sec\": %.1f,\n", boid_updates_per_sec);
+    printf("  \"step_ms\": {\n");
+    printf("    \"min\": %.4f,\n", ms(step_times.front()));
+    printf("    \"p50\": %.4f,\n", ms(percentile(step_times, 50.0)));
+    printf("    \"p90\": %.4f,\n", ms(percentile(step_times, 90.0)));
+    printf("    \"p99\": %.4f,\n", ms(percentile(step_times, 99.0)));
+    printf("    \"max\": %.4f\n", ms(step_times.back()));
+    printf("  },\n");
+    // busiest thread over the mean one, and share of thread time spent idle, in the force pass
+    printf("  \"force_imbalance\": {\"p50\": %.3f, \"p90\": %.3f, \"max\": %.3f},\n",
+           percentile(imbalances, 50.0), percentile(imbalances, 90.0), imbalances.back());
+    printf("  \"force_idle_fraction\": {\"p50\": %.3f, \"p90\": %.3f, \"max\": %.3f}\n",
+           percentile(idle_fractions, 50.0), percentile(idle_fractions, 90.0), idle_fractions.back());
+    printf("}\n");
+
+    return 0;
+}
+
+// the timed run split over cfg.rank_count processes, each simulating one slab of the domain.
+// every rank starts from the same population and keeps its own slab's share of it. rank 0
+// reports the whole run as JSON, with each rank's compute and exchange times per step.
+template <typename Grid>
+static int simulate_ranks(Config& cfg, const Distribution& d_pos, const Distribution& d_vel)
+{
+    // before any thread starts, the processes forked here only get the calling one
+    std::unique_ptr<Transport> transport =
+        cfg.transport == TK_TCP ? connect_tcp(cfg.rank, cfg.peers) : fork_ranks(cfg.transport, cfg.rank_count);
+    if (!transport) {
+        fprintf(stderr, "can't start %d ranks over %s\n", cfg.rank_count, TRANSPORT_NAMES[cfg.transport]);
+        return 1;
+    }
+    const int rank = transport->rank();
+
+    BoidCollection boids(0, d_pos, d_vel, cfg.thread_count);
+    Grid grid;
+    configure(cfg, boids, grid);
+
+    const auto init_start = steady_clock::now();
+    boids.reset(cfg.boid_count, d_pos, d_vel);
+    SlabDecomposition slabs(*transport, cfg.domain_span / static_cast<float>(cfg.nodes_per_axis),
+                            cfg.nodes_per_axis);
+    slabs.scatter(boids);
+    const double init_time = duration_cast<duration<double>>(steady_clock::now() - init_start).count();
+
+    auto broken = [&](void) {
+        fprintf(stderr, "rank %d lost the link to a neighbor\n", rank);
+        return 1;
+    };
+
+    for (size_t i = 0; i < cfg.warmup_steps; i++) {
+        if (!slabs.update(boids, cfg.dt, cfg.rules.rules[0], grid)) return broken();
+    }
+    slabs.reset_stats();
+
+    std::vector<double> step_times;
+    step_times.reserve(cfg.step_count);
+    const auto run_start = steady_clock::now();
+
+    for (size_t i = 0; i < cfg.step_count; i++) {
+        const auto start_time = steady_clock::now();
+        if (!slabs.update(boids, cfg.dt, cfg.rules.rules[0], grid)) return broken();
+        step_times.push_back(duration_cast<duration<double>>(steady_clock::now() - start_time).count());
+    }
+
+    const double total_time = duration_cast<duration<double>>(steady_clock::now() - run_start).count();
+
+    std::vector<RankStats> ranks;
+    if (!slabs.gather_stats(boids, ranks)) return broken();
+    if (rank != 0) return 0;
+
+    std::sort(step_times.begin(), step_times.end());
+
+    size_t population = 0;
+    double compute_seconds = 0.0;
+    double exchange_seconds = 0.0;
+    for (const RankStats& r : ranks) {
+        population += r.population;
+        compute_seconds += r.compute_seconds;
+        exchange_seconds += r.exchange_seconds();
+    }
+
+    const double steps_per_sec = cfg.step_count / total_time;
+    auto ms = [](double seconds) { return 1e3 * seconds; };
+    auto fraction = [](double part, double whole) { return whole > 0.0 ? part / whole : 0.0; };
+
+    printf("{\n");
+    printf("  \"config\": {\n");
+    printf("    \"boids\": %zu,\n", population);
+    printf("    \"steps\": %zu,\n", cfg.step_count);
+    printf("    \"warmup_steps\": %zu,\n", cfg.warmup_steps);
+    printf("    \"ranks\": %d,\n", transport->rank_count());
+    printf("    \"transport\": \"%s\",\n", TRANSPORT_NAMES[transport->kind()]);
+    printf("    \"threads_per_rank\": %zu,\n", boids.thread_count());
+    printf("    \"domain_span\": %g,\n", boids.domain_span());
+    print_grid(grid);
+    printf("    \"dt\": %g,\n", cfg.dt);
+    printf("    \"seed\": %llu,\n", static_cast<unsigned long long>(boids.seed()));
+    printf("    \"kernel\": \"%s\",\n", KERNEL_ISA_NAMES[boids.kernel_isa()]);
+    printf("    \"deterministic\": %s\n", boids.deterministic() ? "true" : "false");
+    printf("  },\n");
+    printf("  \"init_ms\": %.3f,\n", ms(init_time));
+    // the per rank hashes combined in rank order, the same for any transport or thread count
+    printf("  \"state_hash\": \"%016llx\",\n", static_cast<unsigned long long>(combined_state_hash(ranks)));
+    printf("  \"total_seconds\": %.6f,\n", total_time);
+    printf("  \"steps_per_sec\": %.3f,\n", steps_per_sec);
+    printf("  \"boid_updates_per_sec\": %.1f,\n", steps_per_sec * population);
+    printf("  \"step_ms\": {\n");
+    printf("    \"min\": %.4f,\n", ms(step_times.front()));
+    printf("    \"p50\": %.4f,\n", ms(percentile(step_times, 50.0)));
+    printf("    \"p90\": %.4f,\n", ms(percentile(step_times, 90.0)));
+    printf("    \"p99\": %.4f,\n", ms(percentile(step_times, 99.0)));
+    printf("    \"max\": %.4f\n", ms(step_times.back()));
+    printf("  },\n");
+    // share of all ranks' step time spent exchanging rather than computing. waiting for a slower
+    // neighbor counts as exchange time
+    printf("  \"exchange_fraction\": %.3f,\n",
+           fraction(exchange_seconds, compute_seconds + exchange_seconds));
+    // per step averages over the timed steps
+    printf("  \"ranks\": [");
+    for (size_t r = 0; r < ranks.size(); r++) {
+        const RankStats& stats = ranks[r];
+        const double steps = static_cast<double>(std::max<uint64_t>(1, stats.steps));
+        printf("%s\n    {\"rank\": %zu, \"boids\": %llu, \"compute_ms\": %.4f, \"migrate_ms\": %.4f, "
+               "\"halo_ms\": %.4f, \"exchange_fraction\": %.3f, \"ghosts\": %.1f, \"migrated\": %.1f, "
+               "\"bytes_sent\": %.1f}",
+               r == 0 ? "" : ",", r, static_cast<unsigned long long>(stats.population),
+               ms(stats.compute_seconds) / steps, ms(stats.migrate_seconds) / steps,
+               ms(stats.halo_seconds) / steps,
+               fraction(stats.exchange_seconds(), stats.compute_seconds + stats.exchange_seconds()),
+               stats.ghosts / steps, stats.boids_migrated / steps, stats.bytes_sent / steps);
+    }
+    printf("\n  ]\n");
+    printf("}\n");
+    fflush(stdout);
+
+    if (!transport->join()) {
+        fprintf(stderr, "a rank failed\n");
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    Config cfg;
+
+    if (!parse_args(argc, argv, cfg)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    const float span = cfg.domain_span;
+    UniformDistribution d_pos(0.25f * span, 0.75f * span, 0.25f * span, 0.75f * span, cfg.seed);
+    UniformDistribution d_vel(-50.f, 50.f, -50.f, 50.f, cfg.seed + 1);
+
+    if (cfg.replay_path) {
+        return replay(cfg);
+    }
+
+    if (!cfg.verify_threads.empty()) {
+        if (cfg.neighbor_list) return verify_threads<NeighborList>(cfg, d_pos, d_vel);
+        return cfg.sparse ? verify_threads<SparseGrid>(cfg, d_pos, d_vel)
+                          : verify_threads<QuadTree>(cfg, d_pos, d_vel);
+    }
+
+    if (cfg.rank_count > 1 || cfg.transport == TK_TCP) {
+        return cfg.sparse ? simulate_ranks<SparseGrid>(cfg, d_pos, d_vel)
+                          : simulate_ranks<QuadTree>(cfg, d_pos, d_vel);
+    }
+
+    if (cfg.neighbor_list) return simulate<NeighborList>(cfg, d_pos, d_vel);
+    return cfg.sparse ? simulate<SparseGrid>(cfg, d_pos, d_vel) : simulate<QuadTree>(cfg, d_pos, d_vel);
+}